@@ -0,0 +1,339 @@
+#include "stdafx.h"
+#include "BatchMode.h"
+#include "NutScript.h"
+#include "ThreadPool.h"
+#include "FunctionPrerender.h"
+#include "FileUtils.h"
+#include "BoundedQueue.h"
+#include <chrono>
+#include <atomic>
+#include <set>
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t SlowestListSize = 10;
+static const size_t QueueDepth = 2;		// Files waiting in front of each worker of a stage
+
+
+// ************************************************************************************************************************************
+struct BatchItem
+{
+	std::string path;			// Relative to input and output directory
+	std::string error;			// Empty when file was decompiled
+	double seconds;
+
+	BatchItem() : seconds(0.0) {}
+};
+
+
+// ************************************************************************************************************************************
+static double SecondsSince( Clock::time_point start )
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+// ************************************************************************************************************************************
+// File on its way through pipeline, each stage releases data that later stages do not need
+struct BatchJob
+{
+	BatchItem* item;
+	std::vector<char> data;
+	std::unique_ptr<NutScript> script;
+	std::string text;
+
+	explicit BatchJob( BatchItem* item ) : item(item) {}
+};
+
+typedef std::shared_ptr<BatchJob> BatchJobPtr;
+typedef BoundedQueue<BatchJobPtr> BatchQueue;
+
+
+// ************************************************************************************************************************************
+// Limits number of scripts submitted to decompile pool and not finished yet
+class TaskLimit
+{
+private:
+	size_t m_Free;
+	std::mutex m_Mutex;
+	std::condition_variable m_Released;
+
+public:
+	explicit TaskLimit( size_t limit ) : m_Free(limit) {}
+
+	void Acquire( void )
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Released.wait(lock, [this] { return m_Free > 0; });
+		m_Free -= 1;
+	}
+
+	void Release( void )
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Free += 1;
+		}
+
+		m_Released.notify_one();
+	}
+};
+
+
+// ************************************************************************************************************************************
+static void ReadStage( std::vector<BatchItem>& items, std::atomic<size_t>& next, const std::string& inputDirectory, BatchQueue& output )
+{
+	for(size_t i = next++; i < items.size(); i = next++)
+	{
+		BatchJobPtr job = std::make_shared<BatchJob>(&items[i]);
+		Clock::time_point start = Clock::now();
+
+		try
+		{
+			ReadFileData(inputDirectory + '/' + job->item->path, job->data);
+		}
+		catch( std::exception& ex )
+		{
+			job->item->error = ex.what();
+		}
+
+		job->item->seconds += SecondsSince(start);
+		output.Push(job);
+	}
+
+	output.ProducerDone();
+}
+
+
+// ************************************************************************************************************************************
+static void LoadStage( BatchQueue& input, BatchQueue& output, const DecompileContext& context )
+{
+	BatchJobPtr job;
+	while(input.Pop(job))
+	{
+		Clock::time_point start = Clock::now();
+
+		if (job->item->error.empty())
+		{
+			try
+			{
+				job->script.reset(new NutScript(context));
+				job->script->LoadFromBuffer(job->data.data(), job->data.size());
+			}
+			catch( std::exception& ex )
+			{
+				job->item->error = ex.what();
+				job->script.reset();
+			}
+		}
+
+		std::vector<char>().swap(job->data);
+		job->item->seconds += SecondsSince(start);
+		output.Push(job);
+	}
+
+	output.ProducerDone();
+}
+
+
+// ************************************************************************************************************************************
+static void DecompileJob( BatchJob& job, ThreadPool& pool )
+{
+	Clock::time_point start = Clock::now();
+
+	if (job.script)
+	{
+		try
+		{
+			// Nested functions of large script are taken by workers that ran out of scripts
+			FunctionPrerender prerender(job.script->GetMain(), pool);
+
+			TextWriter out;
+			job.script->GetMain().GenerateBodySource(0, out);
+			job.text = out.GetText();
+		}
+		catch( std::exception& ex )
+		{
+			job.item->error = ex.what();
+			job.text.clear();
+		}
+
+		job.script.reset();
+	}
+
+	job.item->seconds += SecondsSince(start);
+}
+
+
+// ************************************************************************************************************************************
+// Only complete files are written, so that output tree contains no partial results of failed files. Output of failed
+// file left from earlier run is removed, so that it is not taken for result of this one.
+static void WriteStage( BatchQueue& input, const std::string& outputDirectory )
+{
+	BatchJobPtr job;
+	while(input.Pop(job))
+	{
+		Clock::time_point start = Clock::now();
+		std::string path = outputDirectory + '/' + job->item->path;
+
+		if (job->item->error.empty())
+		{
+			try
+			{
+				WriteFileText(path, job->text);
+			}
+			catch( std::exception& ex )
+			{
+				job->item->error = ex.what();
+			}
+		}
+
+		if (!job->item->error.empty())
+			remove(path.c_str());
+
+		job->text.clear();
+		job->item->seconds += SecondsSince(start);
+	}
+}
+
+
+// ************************************************************************************************************************************
+static bool SlowerThan( const BatchItem* a, const BatchItem* b )
+{
+	if (a->seconds != b->seconds)
+		return a->seconds > b->seconds;
+
+	return a->path < b->path;
+}
+
+
+// ************************************************************************************************************************************
+static void PrintSummary( const std::vector<BatchItem>& items, const BatchThreads& threads, double wallSeconds )
+{
+	size_t failed = 0;
+	double totalSeconds = 0.0;
+	std::vector<const BatchItem*> byTime;
+
+	for(std::vector<BatchItem>::const_iterator i = items.begin(); i != items.end(); ++i)
+	{
+		if (!i->error.empty())
+			failed += 1;
+
+		totalSeconds += i->seconds;
+		byTime.push_back(&*i);
+	}
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Files: " << items.size() << ", decompiled: " << (items.size() - failed) << ", failed: " << failed << std::endl;
+	std::cout << "Threads: read " << threads.read << ", load " << threads.load << ", decompile " << threads.decompile << ", write " << threads.write << std::endl;
+	std::cout << "Wall time: " << wallSeconds << " s, processing time: " << totalSeconds << " s" << std::endl;
+
+	if (failed > 0)
+	{
+		std::cout << std::endl << "Failed:" << std::endl;
+		for(std::vector<BatchItem>::const_iterator i = items.begin(); i != items.end(); ++i)
+			if (!i->error.empty())
+				std::cout << "  " << i->path << ": " << i->error << std::endl;
+	}
+
+	size_t slowest = std::min(SlowestListSize, byTime.size());
+	std::partial_sort(byTime.begin(), byTime.begin() + slowest, byTime.end(), SlowerThan);
+
+	std::cout << std::endl << "Slowest:" << std::endl;
+	for(size_t i = 0; i < slowest; ++i)
+		std::cout << "  " << std::setw(8) << byTime[i]->seconds << " s  " << byTime[i]->path << std::endl;
+}
+
+
+// ************************************************************************************************************************************
+int DecompileBatch( const char* inputDirectory, const char* outputDirectory, const BatchThreads& threads, const DecompileContext& context )
+{
+	Clock::time_point start = Clock::now();
+
+	std::vector<std::string> paths;
+	FindFiles(inputDirectory, ".nut", paths);
+
+	if (paths.empty())
+	{
+		std::cout << "No .nut files found in \"" << inputDirectory << "\"." << std::endl;
+		return 0;
+	}
+
+	// Output tree is created up front, workers only create files
+	std::set<std::string> directories;
+	directories.insert(outputDirectory);
+
+	for(std::vector<std::string>::const_iterator i = paths.begin(); i != paths.end(); ++i)
+	{
+		size_t slash = i->rfind('/');
+		if (slash != std::string::npos)
+			directories.insert(std::string(outputDirectory) + '/' + i->substr(0, slash));
+	}
+
+	for(std::set<std::string>::const_iterator i = directories.begin(); i != directories.end(); ++i)
+		MakeDirectories(*i);
+
+	std::vector<BatchItem> items(paths.size());
+	for(size_t i = 0; i < paths.size(); ++i)
+		items[i].path = paths[i];
+
+	std::string input = inputDirectory;
+	std::string output = outputDirectory;
+
+	ThreadPool pool(threads.decompile);
+	BatchThreads used = threads;
+	used.read = std::max<size_t>(1, threads.read);
+	used.load = std::max<size_t>(1, threads.load);
+	used.decompile = pool.GetThreadCount();
+	used.write = std::max<size_t>(1, threads.write);
+
+	BatchQueue read(QueueDepth * used.load, used.read);
+	BatchQueue loaded(QueueDepth * used.decompile, used.load);
+	BatchQueue rendered(QueueDepth * used.write, 1);
+
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+
+	for(size_t i = 0; i < used.read; ++i)
+		workers.push_back(std::thread([&items, &next, &input, &read] { ReadStage(items, next, input, read); }));
+
+	for(size_t i = 0; i < used.load; ++i)
+		workers.push_back(std::thread([&read, &loaded, &context] { LoadStage(read, loaded, context); }));
+
+	for(size_t i = 0; i < used.write; ++i)
+		workers.push_back(std::thread([&rendered, &output] { WriteStage(rendered, output); }));
+
+	// Loaded scripts are handed to decompile pool from this thread, largest of those in flight run first
+	TaskLimit inFlight(QueueDepth * used.decompile);
+	BatchJobPtr job;
+
+	while(loaded.Pop(job))
+	{
+		inFlight.Acquire();
+
+		size_t weight = job->script ? job->script->GetMain().GetWeight() : 0;
+		pool.Submit([job, &pool, &rendered, &inFlight]
+		{
+			DecompileJob(*job, pool);
+			rendered.Push(job);
+			inFlight.Release();
+		}, weight);
+
+		job.reset();
+	}
+
+	pool.Wait();
+	rendered.ProducerDone();
+
+	for(std::vector<std::thread>::iterator i = workers.begin(); i != workers.end(); ++i)
+		i->join();
+
+	PrintSummary(items, used, SecondsSince(start));
+
+	int failed = 0;
+	for(std::vector<BatchItem>::const_iterator i = items.begin(); i != items.end(); ++i)
+		if (!i->error.empty())
+			failed += 1;
+
+	return failed;
+}
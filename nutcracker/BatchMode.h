@@ -0,0 +1,21 @@
+#pragma once
+
+// ************************************************************************************************************************************
+// Worker threads of batch pipeline stages. Zero decompile threads means one per hardware thread.
+struct BatchThreads
+{
+	size_t read;			// Reading input files to memory
+	size_t load;			// Parsing scripts
+	size_t decompile;		// Generating source, nested functions of large scripts are shared by these threads
+	size_t write;			// Writing output files
+
+	BatchThreads() : read(2), load(1), decompile(0), write(2) {}
+};
+
+
+// ************************************************************************************************************************************
+// Batch mode - every .nut file of input directory tree is decompiled to the same relative path under output directory.
+// Files go through pipeline of read, load, decompile and write stages with bounded queues between them, so that disk
+// and CPU work overlap and only a few files per worker are held in memory at once. Output files do not depend on
+// number of threads. Summary of failures and timings is printed to standard output. Returns number of failed files.
+int DecompileBatch( const char* inputDirectory, const char* outputDirectory, const BatchThreads& threads, const DecompileContext& context );
@@ -3,14 +3,12 @@
 #include "LFile.h"
 
 // ************************************************************************************************************************************
-typedef void(*ReaderHooker)(void* obj, void* buffer, int size, bool bString);
 class BinaryReader
 {
 private:
 	LFile& m_file;
-
-	static ReaderHooker fnHook;
-	static void* s_hookObj;
+	const DecompileContext& m_Context;
+	std::vector<char> m_StringBuffer;		// Reused by ReadSQString, per reader so that files may be loaded on several threads
 
 	// Delete default methods
 	BinaryReader() = delete;
@@ -18,11 +16,14 @@ private:
 	BinaryReader& operator = ( const BinaryReader& ) = delete;
 
 public:
-	explicit BinaryReader(LFile& in)
+	explicit BinaryReader(LFile& in, const DecompileContext& context)
 		: m_file(in)
+		, m_Context(context)
 	{
 	}
 
+	const DecompileContext& GetContext( void ) const { return m_Context; }
+
 	// ******************************************************************************
 	unsigned int	ReadUInt32( void ){ return ReadValue<unsigned int>(); }
 	int				ReadInt32( void ){ return ReadValue<int>(); }
@@ -51,11 +52,10 @@ public:
 
 		size_t nReaded = m_file.readAs((char*)buffer, size);
 
-		if (nReaded < 0)
+		if (nReaded != (size_t)size)
 			throw Error("I/O Error while reading from file.");
 
-		if (fnHook)
-			fnHook(s_hookObj, buffer, size, bString);
+		m_Context.CallReaderHook(buffer, size, bString);
 	}
 
 
@@ -70,16 +70,15 @@ public:
 	// ******************************************************************************
 	void ReadSQString(LString& str)
 	{
-		static std::vector<char> buf;
 		int len = ReadInt32();
 		if (len < 0)
 			len = 0;
-		if (buf.size() < (size_t)len)
-			buf.resize(len);
+		if (m_StringBuffer.size() < (size_t)len)
+			m_StringBuffer.resize(len);
 
-		Read((void*)buf.data(), len, true);
+		Read((void*)m_StringBuffer.data(), len, true);
 
-		str.assign(buf.data(), len);
+		str.assign(m_StringBuffer.data(), len, m_Context.GetLocale());
 	}
 
 
@@ -95,26 +94,4 @@ public:
 		else
 			throw Error("Expected string object not found in source binary file.");
 	}
-
-	static void SetReaderHook(ReaderHooker fn, void* obj)
-	{
-		fnHook = fn;
-		s_hookObj = s_hookObj;
-	}
-	static void SetLocale(const char* pName)
-	{
-		try
-		{
-			LString::setLocal(std::locale(pName));
-			setlocale(LC_ALL, pName);
-		}
-		catch (std::exception& e)
-		{
-			throw Error(e.what());
-		}
-	}
 };
-
-__declspec(selectany) void* BinaryReader::s_hookObj = nullptr;
-
-__declspec(selectany) ReaderHooker BinaryReader::fnHook = nullptr;
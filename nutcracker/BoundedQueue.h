@@ -0,0 +1,68 @@
+#pragma once
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// ************************************************************************************************************************************
+// Queue between stages of a pipeline. Push blocks while queue is full, so that fast producer waits for slow consumer
+// instead of piling up items. Queue ends when all producers called ProducerDone, Pop returns false after that once
+// queue is empty.
+template <typename T>
+class BoundedQueue
+{
+private:
+	std::deque<T> m_Items;
+	size_t m_Capacity;
+	size_t m_Producers;
+	std::mutex m_Mutex;
+	std::condition_variable m_NotFull;
+	std::condition_variable m_NotEmpty;
+
+	BoundedQueue( const BoundedQueue& );
+	BoundedQueue& operator= ( const BoundedQueue& );
+
+public:
+	BoundedQueue( size_t capacity, size_t producers )
+	: m_Capacity(std::max<size_t>(1, capacity))
+	, m_Producers(producers)
+	{
+	}
+
+	void Push( T item )
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_NotFull.wait(lock, [this] { return m_Items.size() < m_Capacity; });
+			m_Items.push_back(std::move(item));
+		}
+
+		m_NotEmpty.notify_one();
+	}
+
+	bool Pop( T& item )
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_NotEmpty.wait(lock, [this] { return !m_Items.empty() || m_Producers == 0; });
+
+			if (m_Items.empty())
+				return false;
+
+			item = std::move(m_Items.front());
+			m_Items.pop_front();
+		}
+
+		m_NotFull.notify_one();
+		return true;
+	}
+
+	void ProducerDone( void )
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Producers -= 1;
+		}
+
+		m_NotEmpty.notify_all();
+	}
+};
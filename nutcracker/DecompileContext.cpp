@@ -0,0 +1,53 @@
+#include "stdafx.h"
+#include "DecompileContext.h"
+
+
+// ************************************************************************************************************************************
+DecompileContext::DecompileContext()
+: m_Locale(std::locale::classic())
+, m_DebugMode(false)
+, m_InstructionBudget(0)
+, m_TimeBudget(0)
+, m_ReaderHook(NULL)
+, m_ReaderHookObj(NULL)
+{
+	BuildPrintable();
+}
+
+
+// ************************************************************************************************************************************
+DecompileContext::DecompileContext( const char* localeName )
+: m_DebugMode(false)
+, m_InstructionBudget(0)
+, m_TimeBudget(0)
+, m_ReaderHook(NULL)
+, m_ReaderHookObj(NULL)
+{
+	try
+	{
+		m_Locale = std::locale(localeName);
+	}
+	catch( std::exception& ex )
+	{
+		throw Error("%s", ex.what());
+	}
+
+	BuildPrintable();
+}
+
+
+// ************************************************************************************************************************************
+// Character classes of whole basic plane are fetched by single call of locale facet
+void DecompileContext::BuildPrintable( void )
+{
+	std::vector<wchar_t> chars(0x10000);
+	for(unsigned int c = 0; c < 0x10000; ++c)
+		chars[c] = static_cast<wchar_t>(c);
+
+	std::vector<std::ctype_base::mask> masks(0x10000);
+	std::use_facet< std::ctype<wchar_t> >(m_Locale).is(chars.data(), chars.data() + chars.size(), masks.data());
+
+	for(unsigned int c = 0; c < 0x10000; ++c)
+		if (masks[c] & std::ctype_base::print)
+			m_Printable.set(c);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <bitset>
+
+typedef void(*ReaderHooker)(void* obj, void* buffer, int size, bool bString);
+
+// ************************************************************************************************************************************
+// Settings of decompilation - locale of multibyte strings, debug mode, reader hook. Context is passed to script when
+// it is loaded and reached from there by functions and decompiler, it is not changed while scripts decompile, so that
+// any number of decompilations with same or different contexts may run concurrently in one process.
+class DecompileContext
+{
+private:
+	std::locale m_Locale;
+	std::bitset<0x10000> m_Printable;		// Basic plane characters printable in m_Locale
+	bool m_DebugMode;
+	size_t m_InstructionBudget;
+	size_t m_TimeBudget;					// Milliseconds
+	ReaderHooker m_ReaderHook;
+	void* m_ReaderHookObj;
+
+	DecompileContext( const DecompileContext& );
+	DecompileContext& operator= ( const DecompileContext& );
+
+	void BuildPrintable( void );
+
+public:
+	// Classic "C" locale
+	DecompileContext();
+
+	// Named locale (see setlocale), throws Error for unknown name
+	explicit DecompileContext( const char* localeName );
+
+	const std::locale& GetLocale( void ) const			{ return m_Locale;		}
+
+	bool IsPrintable( wchar_t c ) const
+	{
+		if (static_cast<unsigned int>(c) < 0x10000)
+			return m_Printable.test(static_cast<unsigned int>(c));
+
+		return std::isprint(c, m_Locale);
+	}
+
+	// Debug decompilation prints function listings with decompiled code and does not generate nested functions
+	void SetDebugMode( bool debugMode )					{ m_DebugMode = debugMode;	}
+	bool IsDebugMode( void ) const						{ return m_DebugMode;		}
+
+	// Budget of decompilation of single function - instructions decompiled and wall time in milliseconds, zero is
+	// unlimited. Function that runs out of budget is printed as commented disassembly.
+	void SetBudget( size_t instructions, size_t milliseconds )	{ m_InstructionBudget = instructions; m_TimeBudget = milliseconds;	}
+	size_t GetInstructionBudget( void ) const			{ return m_InstructionBudget;	}
+	size_t GetTimeBudget( void ) const					{ return m_TimeBudget;			}
+
+	// Hook called with every block of data read from binary file
+	void SetReaderHook( ReaderHooker hook, void* obj )	{ m_ReaderHook = hook; m_ReaderHookObj = obj;	}
+
+	void CallReaderHook( void* buffer, int size, bool bString ) const
+	{
+		if (m_ReaderHook)
+			m_ReaderHook(m_ReaderHookObj, buffer, size, bString);
+	}
+};
@@ -15,6 +15,15 @@ public:
 };
 
 
+// ************************************************************************************************************************************
+// Decompilation of function ran out of budget set in DecompileContext
+class BudgetError : public Error
+{
+public:
+	explicit BudgetError( const std::string& message ) : Error("%s", message.c_str()) {}
+};
+
+
 // ************************************************************************************************************************************
 struct BadFormatError : public std::exception
 {
@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include "SqObject.h"
 #include "Formatters.h"
+#include "StringEscape.h"
 
 using namespace std;
 using namespace std::tr1;
@@ -24,15 +25,26 @@ enum ExpressionType
 
 
 // ************************************************************************************************************************************
+// Node kind is stored inline, code generation is dispatched by switch over it (see end of file) so that node
+// methods are not virtual and can be inlined.
 class Expression
 {
+private:
+	const int m_Type;
+
+protected:
+	explicit Expression( int type )
+	: m_Type(type)
+	{
+	}
+
 public:
-	virtual int GetType( void ) const = 0;
+	int GetType( void ) const			{ return m_Type;														}
 	//virtual LString ToString( void ) const = 0;
-	virtual void GenerateCode( std::wostream& out, int indent ) const = 0;
+	void GenerateCode( TextWriter& out, int indent ) const;
 
-	bool IsOperator( void ) const		{ return GetType() == Exp_Operator;										}
-	bool IsVariable( void ) const		{ return GetType() == Exp_Variable || GetType() == Exp_LocalVariable;	}
+	bool IsOperator( void ) const		{ return m_Type == Exp_Operator;										}
+	bool IsVariable( void ) const		{ return m_Type == Exp_Variable || m_Type == Exp_LocalVariable;			}
 };
 
 typedef std::shared_ptr<Expression> ExpressionPtr;
@@ -44,7 +56,7 @@ struct expression_out
 
 	explicit expression_out( ExpressionPtr expr, int n ) : m_expr(expr), m_indent(n) {}
 
-	friend std::wostream& operator<< ( std::wostream& out, const expression_out& e )
+	friend TextWriter& operator<< ( TextWriter& out, const expression_out& e )
 	{
 		e.m_expr->GenerateCode(out, e.m_indent);
 		return out;
@@ -61,16 +73,20 @@ private:
 
 public:
 	explicit VariableExpression( const LString& name )
-	: m_name(name)
+	: Expression(Exp_Variable)
+	, m_name(name)
 	{
 	}
 
-	virtual int GetType( void ) const
+protected:
+	VariableExpression( int type, const LString& name )
+	: Expression(type)
+	, m_name(name)
 	{
-		return Exp_Variable;
 	}
 
-	virtual void GenerateCode( std::wostream& out, int ) const
+public:
+	void GenerateCode( TextWriter& out, int ) const
 	{
 		out << m_name;
 	}
@@ -87,13 +103,8 @@ class LocalVariableExpression : public VariableExpression
 {
 public:
 	explicit LocalVariableExpression( const LString& name )
-	: VariableExpression(name)
-	{
-	}
-
-	virtual int GetType( void ) const
+	: VariableExpression(Exp_LocalVariable, name)
 	{
-		return Exp_LocalVariable;
 	}
 };
 
@@ -101,185 +112,178 @@ public:
 // *****************************************************************************************
 class ConstantExpression : public Expression
 {
+public:
+	// Rendered source text of constant. Literals of function are rendered once and shared by all expressions.
+	struct Text
+	{
+		LString text;
+		LString label;		// String literal content without quotes
+		bool isLiteral;
+		bool isLabel;
+	};
+	typedef shared_ptr<const Text> TextPtr;
+
 protected:
-	LString m_text;
-	bool m_isLiteral;
+	TextPtr m_Text;
 
-	char ToHex( int value )
+	static TextPtr MakeText( const LString& text, bool isLiteral )
 	{
-		if (value < 10)
-			return '0' + value;
-		else if (value < 16)
-			return 'a' + (value - 10);
-		else
-			return '0';
+		shared_ptr<Text> result = std::make_shared<Text>();
+		result->text = text;
+		result->isLiteral = isLiteral;
+		result->isLabel = false;
+
+		if (!isLiteral || text.size() < 3)
+			return result;
+
+		result->label = text.mid(1, text.size() - 2);
+		result->isLabel = true;
+
+		for(int i = 1; i < (int)(text.size() - 1); ++i)
+		{
+			auto c = text[i];
+
+			bool isValidChar = 
+				(i > 1 && c >= '0' && c <= '9') ||
+				(c >= 'a' && c <= 'z') ||
+				(c >= 'A' && c <= 'Z') ||
+				c == '_';
+
+			if (!isValidChar)
+			{
+				result->isLabel = false;
+				break;
+			}
+		}
+
+		return result;
 	}
 
 	ConstantExpression()
+	: Expression(Exp_Constant)
 	{
-		m_isLiteral = false;
 	}
 
 
 public:
-	explicit ConstantExpression( const LString& str )
+	explicit ConstantExpression( TextPtr text )
+	: Expression(Exp_Constant)
+	, m_Text(text)
+	{
+	}
+
+	// Printability of characters in string literals depends on locale of context
+	explicit ConstantExpression( const LString& str, const DecompileContext& context )
+	: Expression(Exp_Constant)
+	, m_Text(Render(str, context))
 	{
-		set(str);
 	}
 
 	explicit ConstantExpression( unsigned int value )
+	: Expression(Exp_Constant)
+	, m_Text(Render(value))
 	{
-		set(value);
 	}
 
 	explicit ConstantExpression( float value )
+	: Expression(Exp_Constant)
+	, m_Text(Render(value))
 	{
-		set(value);
 	}
 
 	explicit ConstantExpression( bool value )
+	: Expression(Exp_Constant)
+	, m_Text(Render(value))
 	{
-		set(value);
 	}
 
-	explicit ConstantExpression( const SqObject& obj )
+	explicit ConstantExpression( const SqObject& obj, const DecompileContext& context )
+	: Expression(Exp_Constant)
+	, m_Text(Render(obj, context))
+	{
+	}
+
+
+	static TextPtr Render( const SqObject& obj, const DecompileContext& context )
 	{
 		switch(obj.GetType())
 		{
 			default:
 			case OT_NULL:
-				m_isLiteral = true;
-				m_text.clear();
-				break;
+				return MakeText(LString(), true);
 
 			case OT_STRING:
-				set(obj.GetString());
-				break;
+				return Render(obj.GetString(), context);
 
 			case OT_BOOL:
-				set(obj.GetInteger() != 0);
-				break;
+				return Render(obj.GetInteger() != 0);
 
 			case OT_INTEGER:
-				set(obj.GetInteger());
-				break;
+				return Render(obj.GetInteger());
 
 			case OT_FLOAT:
-				set(obj.GetFloat());
-				break;
+				return Render(obj.GetFloat());
 		}
 	}
 
 
-	void set( const LString& str )
+	static TextPtr Render( const LString& str, const DecompileContext& context )
 	{
-		m_text.clear();
-		m_text.reserve(str.size() + 2);
-
-		m_text += '\"';
-		for( auto iter = str.begin(); iter != str.end(); ++iter)
-		{
-			switch(*iter)
-			{
-				case '\"':	m_text += L"\\\"";			break;
-				case '\'':	m_text += L"\\\'";			break;
-				case '\r':	m_text += L"\\r";			break;
-				case '\n':	m_text += L"\\n";			break;
-				case '\t':	m_text += L"\\t";			break;
-				case '\v':	m_text += L"\\v";			break;
-				case '\a':	m_text += L"\\a";			break;
-				case '\\':	m_text += L"\\\\";			break;
-			
-				default:
-					{
-						auto c = *iter;
-
-						if (!iswprint(c))
-						{
-							m_text += LStrBuilder("\\x%1").arg((int)c, 4, 16, L'0');
-						}
-						else
-						{
-							m_text += c;
-						}
-					}
-					break;
-			}
-		}
-		m_text += '\"';
-
-		m_isLiteral = true;
+		LString text;
+		AppendEscapedLiteral(text, str, context);
+		return MakeText(text, true);
 	}
 
 
-	void set( unsigned int value )
+	static TextPtr Render( unsigned int value )
 	{
-		m_isLiteral = false;
-		m_text.setNum(int(value));
+		LString text;
+		text.setNum(int(value));
+		return MakeText(text, false);
 	}
 
-	void set( float value )
+	static TextPtr Render( float value )
 	{
-		m_isLiteral = false;
-		m_text.setNum(value, 8);
+		LString text;
+		text.setNumRoundTrip(value);
 
-		if (m_text.indexOf('.') == std::string::npos)
-			m_text.append(L".0");
-	}
+		// Keep it float literal
+		if (text.find_first_of(L".en") == std::string::npos)
+			text.append(L".0");
 
-	void set(bool value)
-	{
-		m_isLiteral = false;
-		m_text = value ? L"true" : L"false";
+		return MakeText(text, false);
 	}
 
-	virtual int GetType( void ) const
+	static TextPtr Render( bool value )
 	{
-		return Exp_Constant;
+		return MakeText(value ? L"true" : L"false", false);
 	}
 
 
-	virtual void GenerateCode( std::wostream& out, int ) const
+	void GenerateCode( TextWriter& out, int ) const
 	{
-		out << m_text;
+		out << m_Text->text;
 	}
 
 
 	bool IsLiteral( void ) const
 	{
-		return m_isLiteral;
+		return m_Text->isLiteral;
 	}
 
 
 	bool IsLabel( void ) const
 	{
-		if (!m_isLiteral || m_text.size() < 3)
-			return false;
-
-		for(int i = 1; i < (int)(m_text.size() - 1); ++i)
-		{
-			auto c = m_text[i];
-
-			bool isValidChar = 
-				(i > 1 && c >= '0' && c <= '9') ||
-				(c >= 'a' && c <= 'z') ||
-				(c >= 'A' && c <= 'Z') ||
-				c == '_';
-
-			if (!isValidChar)
-				return false;
-		}
-
-		return true;
+		return m_Text->isLabel;
 	}
 
 
-	LString GetLabel( void ) const
+	const LString& GetLabel( void ) const
 	{
-		if (!m_isLiteral || m_text.size() < 3)
-			return m_text;
+		if (!m_Text->isLiteral || m_Text->text.size() < 3)
+			return m_Text->text;
 
-		return m_text.mid(1, m_text.size() - 2);
+		return m_Text->label;
 	}
 
 	static shared_ptr<ConstantExpression> AsLabelExpression( ExpressionPtr exp )
@@ -303,7 +307,7 @@ class LiteralConstantExpression : public ConstantExpression
 public:
 	explicit LiteralConstantExpression( const char* name )
 	{
-		m_text = name;
+		m_Text = MakeText(name, false);
 	}
 };
 
@@ -313,17 +317,13 @@ class RootTableExpression : public Expression
 {
 public:
 	RootTableExpression()
+	: Expression(Exp_RootTable)
 	{
 	}
 
 
-	virtual int GetType( void ) const
-	{
-		return Exp_RootTable;
-	}
-
 
-	virtual void GenerateCode( std::wostream& out, int ) const
+	void GenerateCode( TextWriter& out, int ) const
 	{
 		out << "getroottable()";
 	}
@@ -335,17 +335,13 @@ class NullExpression : public Expression
 {
 public:
 	NullExpression()
+	: Expression(Exp_Null)
 	{
 	}
 
 
-	virtual int GetType( void ) const
-	{
-		return Exp_Null;
-	}
-
 
-	virtual void GenerateCode( std::wostream& out, int ) const
+	void GenerateCode( TextWriter& out, int ) const
 	{
 		out << "null";
 	}
@@ -367,16 +363,33 @@ public:
 	static const int OPER_DELEGATE =	OPER_SPECIAL_MARKER | 6;
 	static const int OPER_ARRAYIND =	OPER_SPECIAL_MARKER | 7;
 
+	// Kind of operator node, selects generating class
+	enum OperatorNode
+	{
+		Node_Unary,
+		Node_UnaryPostfix,
+		Node_Binary,
+		Node_Condition,
+		Node_Delegate,
+		Node_ArrayIndexing,
+	};
+
 protected:
 	int m_operator;
+	const OperatorNode m_Node;
+	const int m_Priority;
 
-	OperatorExpression()
+	OperatorExpression( OperatorNode node, int op, int priority )
+	: Expression(Exp_Operator)
+	, m_operator(op)
+	, m_Node(node)
+	, m_Priority(priority)
 	{
 	}
 
 
 protected:
-	void GenerateOpName( std::wostream& out ) const
+	void GenerateOpName( TextWriter& out ) const
 	{
 		int op = m_operator;
 		if (!op) return;
@@ -422,7 +435,7 @@ protected:
 	}
 
 
-	void GenerateArgument( std::wostream& out, int n, ExpressionPtr arg, bool parenthesis ) const
+	void GenerateArgument( TextWriter& out, int n, ExpressionPtr arg, bool parenthesis ) const
 	{
 		if (parenthesis)
 		{
@@ -438,17 +451,30 @@ protected:
 
 
 public:
-	virtual int GetType( void ) const
-	{
-		return Exp_Operator;
-	}
 
 	int GetOperatorType( void ) const
 	{
 		return m_operator;
 	}
 
-	virtual int GetOperatorPriority( void ) const = 0;
+	int GetOperatorPriority( void ) const
+	{
+		return m_Priority;
+	}
+
+	OperatorNode GetOperatorNode( void ) const
+	{
+		return m_Node;
+	}
+
+	// Dispatches to class of operator node
+	void GenerateCode( TextWriter& out, int n ) const;
+
+	// Priority of argument expression - operands that are not operators bind tighter than any operator
+	static int PriorityOf( const ExpressionPtr& exp )
+	{
+		return exp->IsOperator() ? static_cast<const OperatorExpression*>(exp.get())->m_Priority : 1000;
+	}
 };
 
 
@@ -461,28 +487,23 @@ protected:
 
 public:
 	explicit UnaryOperatorExpression( int op, ExpressionPtr arg )
+	: OperatorExpression(Node_Unary, op, 200)
 	{
-		m_operator = op;
 		m_arg = arg;
 	}
 
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		GenerateOpName(out);
 
 		if (OPER_SPECIAL_MARKER == (m_operator & OPER_MASK))
 			out << ' ';
 
-		bool parenthesis = m_arg->IsOperator() && (static_pointer_cast<OperatorExpression>(m_arg)->GetOperatorPriority() < this->GetOperatorPriority());
+		bool parenthesis = PriorityOf(m_arg) < GetOperatorPriority();
 		GenerateArgument(out, n, m_arg, parenthesis);
 	}
 
-
-	virtual int GetOperatorPriority( void ) const
-	{
-		return 200;
-	}
 };
 
 
@@ -494,17 +515,17 @@ protected:
 
 public:
 	explicit UnaryPostfixOperatorExpression( int op, ExpressionPtr arg )
+	: OperatorExpression(Node_UnaryPostfix, op, 300)
 	{
-		m_operator = op;
 		m_arg = arg;
 	}
 
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		LString text;
 		
-		bool parenthesis = m_arg->IsOperator() && (static_pointer_cast<OperatorExpression>(m_arg)->GetOperatorPriority() < this->GetOperatorPriority());
+		bool parenthesis = PriorityOf(m_arg) < GetOperatorPriority();
 		GenerateArgument(out, n, m_arg, parenthesis);
 
 		if (OPER_SPECIAL_MARKER == (m_operator & OPER_MASK))
@@ -513,11 +534,6 @@ public:
 		GenerateOpName(out);
 	}
 
-
-	virtual int GetOperatorPriority( void ) const
-	{
-		return 300;
-	}
 };
 
 
@@ -529,8 +545,8 @@ protected:
 
 public:
 	explicit BinaryOperatorExpression( int op, ExpressionPtr arg1, ExpressionPtr arg2 )
+	: OperatorExpression(Node_Binary, op, OperatorPriority(op))
 	{
-		m_operator = op;
 		m_arg1 = arg1;
 		m_arg2 = arg2;
 	}
@@ -540,41 +556,16 @@ public:
 	ExpressionPtr GetArg2( void )		{ return m_arg2;	}
 
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{	
 		int myPriority = GetOperatorPriority();
 		bool rightToLeft = 0 != (myPriority & 1);
 
-		bool leftParenthesis = false;
-		bool rightParenthesis = false;
-
-		if (m_arg1->IsOperator())
-		{
-			if (!rightToLeft)
-			{
-				if (static_pointer_cast<OperatorExpression>(m_arg1)->GetOperatorPriority() < myPriority)
-					leftParenthesis = true;
-			}
-			else
-			{
-				if (static_pointer_cast<OperatorExpression>(m_arg1)->GetOperatorPriority() <= myPriority)
-					leftParenthesis = true;
-			}
-		}
+		int leftPriority = PriorityOf(m_arg1);
+		int rightPriority = PriorityOf(m_arg2);
 
-		if (m_arg2->IsOperator())
-		{
-			if (!rightToLeft)
-			{
-				if (static_pointer_cast<OperatorExpression>(m_arg2)->GetOperatorPriority() <= myPriority)
-					rightParenthesis = true;
-			}
-			else
-			{
-				if (static_pointer_cast<OperatorExpression>(m_arg2)->GetOperatorPriority() < myPriority)
-					rightParenthesis = true;
-			}
-		}
+		bool leftParenthesis = rightToLeft ? (leftPriority <= myPriority) : (leftPriority < myPriority);
+		bool rightParenthesis = rightToLeft ? (rightPriority < myPriority) : (rightPriority <= myPriority);
 
 		GenerateArgument(out, n, m_arg1, leftParenthesis);
 		out << ' ';
@@ -584,9 +575,9 @@ public:
 	}
 
 
-	virtual int GetOperatorPriority( void ) const
+	static int OperatorPriority( int op )
 	{
-		switch(m_operator)
+		switch(op)
 		{
 			case '/':
 			case '*':
@@ -654,20 +645,20 @@ private:
 
 public:
 	explicit ConditionOperatorExpression( ExpressionPtr condition, ExpressionPtr whenTrue, ExpressionPtr whenFalse )
+	: OperatorExpression(Node_Condition, '?:', 60)
 	{
-		m_operator = '?:';
 		m_condition = condition;
 		m_whenTrue = whenTrue;
 		m_whenFalse = whenFalse;
 	}
 
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		int myPriority = GetOperatorPriority();
-		bool condParethesis = (m_condition->IsOperator() && (static_pointer_cast<OperatorExpression>(m_condition)->GetOperatorPriority() <= myPriority));
-		bool arg1Parenthesis = (m_whenTrue->IsOperator() && (static_pointer_cast<OperatorExpression>(m_whenTrue)->GetOperatorPriority() <= myPriority));
-		bool arg2Parenthesis = (m_whenFalse->IsOperator() && (static_pointer_cast<OperatorExpression>(m_whenFalse)->GetOperatorPriority() < myPriority));
+		bool condParethesis = (PriorityOf(m_condition) <= myPriority);
+		bool arg1Parenthesis = (PriorityOf(m_whenTrue) <= myPriority);
+		bool arg2Parenthesis = (PriorityOf(m_whenFalse) < myPriority);
 
 		GenerateArgument(out, n, m_condition, condParethesis);
 		out << " ? ";
@@ -677,11 +668,6 @@ public:
 	}
 
 
-	virtual int GetOperatorPriority( void ) const
-	{
-		return 60;
-	}
-
 	ExpressionPtr GetConditionExp( void ) const		{ return m_condition;	}
 	ExpressionPtr GetTrueExp( void ) const			{ return m_whenTrue;	}
 	ExpressionPtr GetFalseExp( void ) const			{ return m_whenFalse;	}
@@ -695,29 +681,24 @@ protected:
 
 public:
 	explicit DelegateOperatorExpression( ExpressionPtr arg1, ExpressionPtr arg2 )
+	: OperatorExpression(Node_Delegate, OPER_DELEGATE, 60)
 	{
-		m_operator = OPER_DELEGATE;
 		m_arg1 = arg1;
 		m_arg2 = arg2;
 	}
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		out << "delegate ";
 		
 		int myPriority = GetOperatorPriority();
-		bool arg1Parenthesis = (m_arg1->IsOperator() && (static_pointer_cast<OperatorExpression>(m_arg1)->GetOperatorPriority() <= myPriority));
-		bool arg2Parenthesis = (m_arg2->IsOperator() && (static_pointer_cast<OperatorExpression>(m_arg2)->GetOperatorPriority() <= myPriority));
+		bool arg1Parenthesis = (PriorityOf(m_arg1) <= myPriority);
+		bool arg2Parenthesis = (PriorityOf(m_arg2) <= myPriority);
 
 		GenerateArgument(out, n, m_arg1, arg1Parenthesis);
 		out << " : ";
 		GenerateArgument(out, n, m_arg2, arg2Parenthesis);
 	}
-
-	virtual int GetOperatorPriority( void ) const
-	{
-		return 60;
-	}
 };
 
 
@@ -731,8 +712,8 @@ protected:
 
 public:
 	explicit ArrayIndexingExpression( ExpressionPtr obj, ExpressionPtr indexer )
+	: OperatorExpression(Node_ArrayIndexing, OPER_ARRAYIND, 300)
 	{
-		m_operator = OPER_ARRAYIND;
 		m_obj = obj;
 		m_indexer = indexer;
 	}
@@ -761,11 +742,9 @@ public:
 		}
 	}
 
-	void GenerateCode( std::wostream& out, int n, const char* labelsDelimiter, bool allowExplicitThis ) const
+	void GenerateCode( TextWriter& out, int n, const char* labelsDelimiter, bool allowExplicitThis ) const
 	{
-		bool parenthesis = 
-			m_obj->IsOperator() &&
-			static_pointer_cast<OperatorExpression>(m_obj)->GetOperatorPriority() < this->GetOperatorPriority();
+		bool parenthesis = PriorityOf(m_obj) < GetOperatorPriority();
 
 		shared_ptr<ConstantExpression> labelIndexer = ConstantExpression::AsLabelExpression(m_indexer);
 		if (labelIndexer)
@@ -805,30 +784,68 @@ public:
 		out << ']';
 	}
 
+	// Appends name of simple member dereference (see IsSimpleMemberDeref) straight from labels of the chain,
+	// same text as generated by GenerateCode
+	void AppendMemberName( LString& name, const wchar_t* labelsDelimiter, bool allowExplicitThis ) const
+	{
+		if (m_obj->GetType() == Exp_RootTable)
+		{
+			name.append(L"::");
+		}
+		else if (m_obj->GetType() == Exp_Operator)
+		{
+			static_pointer_cast<ArrayIndexingExpression>(m_obj)->AppendMemberName(name, labelsDelimiter, allowExplicitThis);
+			name.append(labelsDelimiter);
+		}
+		else if (allowExplicitThis)
+		{
+			name.append(L"this").append(labelsDelimiter);
+		}
+
+		name.append(ConstantExpression::AsLabelExpression(m_indexer)->GetLabel());
+	}
+
 	LString ToString( void ) const
 	{
-		std::wstringstream buffer;
-		GenerateCode(buffer, 0);
-		return buffer.str();
+		LString name;
+
+		if (IsSimpleMemberDeref())
+		{
+			AppendMemberName(name, L".", true);
+		}
+		else
+		{
+			TextWriter buffer;
+			GenerateCode(buffer, 0);
+			name = buffer.GetWideText();
+		}
+
+		return name;
 	}
 
 	LString ToFunctionNameString( void ) const
 	{
-		std::wstringstream buffer;
-		GenerateCode(buffer, 0, "::", false);
-		return buffer.str();
+		LString name;
+
+		if (IsSimpleMemberDeref())
+		{
+			AppendMemberName(name, L"::", false);
+		}
+		else
+		{
+			TextWriter buffer;
+			GenerateCode(buffer, 0, "::", false);
+			name = buffer.GetWideText();
+		}
+
+		return name;
 	}
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		GenerateCode(out, n, ".", true);
 	}
 
-
-	virtual int GetOperatorPriority( void ) const
-	{
-		return 300;
-	}
 };
 
 
@@ -842,6 +859,7 @@ private:
 
 public:
 	explicit FunctionCallExpression( ExpressionPtr func )
+	: Expression(Exp_FunctionCall)
 	{
 		m_function = func;
 	}
@@ -852,13 +870,8 @@ public:
 	}
 
 
-	virtual int GetType( void ) const
-	{
-		return Exp_FunctionCall;
-	}
-
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		m_function->GenerateCode(out, n);
 		out << '(';
@@ -885,18 +898,22 @@ protected:
 
 public:
 	explicit FunctionExpression( int functionIndex )
-	: m_FunctionIndex(functionIndex)
+	: Expression(Exp_Function)
+	, m_FunctionIndex(functionIndex)
 	{
 	}
 
+	// Function body is generated by decompiler (FunctionGeneratingExpression) - only virtual call of code generation
+	virtual void GenerateFunctionCode( TextWriter& out, int n ) const = 0;
+
 	void SetName( const LString& name )
 	{
 		m_name = name;
 	}
 
-	virtual int GetType( void ) const
+	const LString& GetName( void ) const
 	{
-		return Exp_Function;
+		return m_name;
 	}
 };
 
@@ -905,7 +922,12 @@ public:
 class TableBaseExpression : public Expression
 {
 protected:
-	void GenerateElementCode( ExpressionPtr key, ExpressionPtr value, char eolChar, std::wostream& out, int n ) const;
+	explicit TableBaseExpression( int type )
+	: Expression(type)
+	{
+	}
+
+	void GenerateElementCode( ExpressionPtr key, ExpressionPtr value, char eolChar, TextWriter& out, int n ) const;
 };
 
 
@@ -918,17 +940,13 @@ private:
 
 public:
 	NewTableExpression()
+	: TableBaseExpression(Exp_NewTableExpression)
 	{
 	}
 
 
-	virtual int GetType( void ) const
-	{
-		return Exp_NewTableExpression;
-	}
-
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		if (m_Elements.empty())
 		{
@@ -936,19 +954,19 @@ public:
 			return;
 		}
 
-		out << "{" << std::endl;
+		out << "{" << '\n';
 		for( vector< std::pair<ExpressionPtr, ExpressionPtr> >::const_iterator i = m_Elements.begin(); i != m_Elements.end(); ++i)
 		{
 			out << indent(n + 1);
 			GenerateElementCode(i->first, i->second, (*i != m_Elements.back()) ? ',' : 0, out, n + 1);
-			out << std::endl;
+			out << '\n';
 		}
 
 		out << indent(n) << '}';
 	}
 
 
-	virtual void GenerateAttributesCode( std::wostream& out, int n ) const
+	void GenerateAttributesCode( TextWriter& out, int n ) const
 	{
 		out << "</ ";
 		for( vector< std::pair<ExpressionPtr, ExpressionPtr> >::const_iterator i = m_Elements.begin(); i != m_Elements.end(); ++i)
@@ -974,17 +992,13 @@ private:
 
 public:
 	NewArrayExpression()
+	: Expression(Exp_NewArrayExpression)
 	{
 	}
 
 
-	virtual int GetType( void ) const
-	{
-		return Exp_NewArrayExpression;
-	}
-
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		if (m_Elements.empty())
 		{
@@ -992,7 +1006,7 @@ public:
 			return;
 		}
 
-		out << "[" << std::endl;
+		out << "[" << '\n';
 		for( vector< ExpressionPtr >::const_iterator i = m_Elements.begin(); i != m_Elements.end(); ++i)
 		{
 			out << indent(n + 1);
@@ -1001,7 +1015,7 @@ public:
 			if (*i != m_Elements.back())
 				out << ',';
 			
-			out << std::endl;
+			out << '\n';
 		}
 
 		out << indent(n) << ']';
@@ -1035,6 +1049,7 @@ private:
 
 public:
 	explicit NewClassExpression( ExpressionPtr BaseClass, ExpressionPtr Attributes )
+	: TableBaseExpression(Exp_NewClassExpression)
 	{
 		m_BaseClass = BaseClass;
 		m_Attributes = Attributes;
@@ -1045,12 +1060,12 @@ public:
 		m_Name = name;
 	}
 
-	virtual int GetType( void ) const
+	const LString& GetName( void ) const
 	{
-		return Exp_NewClassExpression;
+		return m_Name;
 	}
 
-	void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		out << "class ";
 
@@ -1069,15 +1084,15 @@ public:
 			static_pointer_cast<NewTableExpression>(m_Attributes)->GenerateAttributesCode(out, n);
 		}
 
-		out << std::endl;
-		out << indent(n) << '{' << std::endl;
+		out << '\n';
+		out << indent(n) << '{' << '\n';
 		for( vector< ClassElement >::const_iterator i = m_Elements.begin(); i != m_Elements.end(); ++i)
 		{
 			if (i->attributes && i->attributes->GetType() == Exp_NewTableExpression)
 			{
 				out << indent(n + 1);
 				static_pointer_cast<NewTableExpression>(i->attributes)->GenerateAttributesCode(out, n);
-				out << std::endl;
+				out << '\n';
 			}
 
 			out << indent(n +	1);
@@ -1086,7 +1101,7 @@ public:
 				out << "static ";
 
 			GenerateElementCode(i->key, i->value, ';', out, n + 1);
-			out << std::endl;			
+			out << '\n';			
 		}
 
 		out << indent(n) << '}';
@@ -1106,7 +1121,7 @@ public:
 
 
 // ******************************************************************************************************************************************************************************
-inline void TableBaseExpression::GenerateElementCode( ExpressionPtr key, ExpressionPtr value, char eolChar, std::wostream& out, int n ) const
+inline void TableBaseExpression::GenerateElementCode( ExpressionPtr key, ExpressionPtr value, char eolChar, TextWriter& out, int n ) const
 {
 	if (value->GetType() == Exp_Function || value->GetType() == Exp_NewClassExpression)
 	{
@@ -1144,7 +1159,7 @@ inline void TableBaseExpression::GenerateElementCode( ExpressionPtr key, Express
 			}
 
 			value->GenerateCode(out, n);
-			out << std::endl;
+			out << '\n';
 			return;
 		}
 	}
@@ -1167,3 +1182,38 @@ inline void TableBaseExpression::GenerateElementCode( ExpressionPtr key, Express
 	if (eolChar != 0)
 		out << eolChar;
 }
+
+
+// ************************************************************************************************************************************
+inline void OperatorExpression::GenerateCode( TextWriter& out, int n ) const
+{
+	switch(m_Node)
+	{
+		case Node_Unary:			static_cast<const UnaryOperatorExpression*>(this)->GenerateCode(out, n);			break;
+		case Node_UnaryPostfix:		static_cast<const UnaryPostfixOperatorExpression*>(this)->GenerateCode(out, n);	break;
+		case Node_Binary:			static_cast<const BinaryOperatorExpression*>(this)->GenerateCode(out, n);			break;
+		case Node_Condition:		static_cast<const ConditionOperatorExpression*>(this)->GenerateCode(out, n);		break;
+		case Node_Delegate:			static_cast<const DelegateOperatorExpression*>(this)->GenerateCode(out, n);		break;
+		case Node_ArrayIndexing:	static_cast<const ArrayIndexingExpression*>(this)->GenerateCode(out, n);			break;
+	}
+}
+
+
+// ************************************************************************************************************************************
+inline void Expression::GenerateCode( TextWriter& out, int n ) const
+{
+	switch(m_Type)
+	{
+		case Exp_Constant:				static_cast<const ConstantExpression*>(this)->GenerateCode(out, n);				break;
+		case Exp_RootTable:				static_cast<const RootTableExpression*>(this)->GenerateCode(out, n);			break;
+		case Exp_Null:					static_cast<const NullExpression*>(this)->GenerateCode(out, n);					break;
+		case Exp_Variable:
+		case Exp_LocalVariable:			static_cast<const VariableExpression*>(this)->GenerateCode(out, n);				break;
+		case Exp_Operator:				static_cast<const OperatorExpression*>(this)->GenerateCode(out, n);				break;
+		case Exp_Function:				static_cast<const FunctionExpression*>(this)->GenerateFunctionCode(out, n);		break;
+		case Exp_FunctionCall:			static_cast<const FunctionCallExpression*>(this)->GenerateCode(out, n);			break;
+		case Exp_NewTableExpression:	static_cast<const NewTableExpression*>(this)->GenerateCode(out, n);				break;
+		case Exp_NewArrayExpression:	static_cast<const NewArrayExpression*>(this)->GenerateCode(out, n);				break;
+		case Exp_NewClassExpression:	static_cast<const NewClassExpression*>(this)->GenerateCode(out, n);				break;
+	}
+}
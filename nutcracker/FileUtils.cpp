@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include "FileUtils.h"
+#include <direct.h>
+#include <io.h>
+#include <sys/stat.h>
+
+
+// ************************************************************************************************************************************
+void MakeDirectories( const std::string& path )
+{
+	for(size_t pos = path.find_first_of("/\\", 1); ; pos = path.find_first_of("/\\", pos + 1))
+	{
+		std::string part = path.substr(0, pos);
+
+		// Skip drive part of path ("c:")
+		if (!part.empty() && part[part.size() - 1] != ':' && _mkdir(part.c_str()) != 0 && errno != EEXIST)
+			throw Error("Unable to create directory: \"%s\"", part.c_str());
+
+		if (pos == std::string::npos)
+			break;
+	}
+}
+
+
+// ************************************************************************************************************************************
+FILE* CreateOutputFile( const std::string& path )
+{
+	FILE* file = NULL;
+	if (fopen_s(&file, path.c_str(), "w") != 0 || !file)
+		throw Error("Unable to create file: \"%s\"", path.c_str());
+
+	return file;
+}
+
+
+// ************************************************************************************************************************************
+void ReadFileData( const std::string& path, std::vector<char>& data )
+{
+	FILE* file = NULL;
+	if (fopen_s(&file, path.c_str(), "rb") != 0 || !file)
+		throw Error("Unable to open file: \"%s\"", path.c_str());
+
+	data.resize(static_cast<size_t>(GetFileSize(path)));
+	size_t size = data.empty() ? 0 : fread(data.data(), 1, data.size(), file);
+	fclose(file);
+
+	if (size != data.size())
+		throw Error("Unable to read file: \"%s\"", path.c_str());
+}
+
+
+// ************************************************************************************************************************************
+void WriteFileText( const std::string& path, const std::string& text )
+{
+	FILE* file = CreateOutputFile(path);
+	size_t size = fwrite(text.data(), 1, text.size(), file);
+
+	if (fclose(file) != 0 || size != text.size())
+	{
+		remove(path.c_str());
+		throw Error("Unable to write file: \"%s\"", path.c_str());
+	}
+}
+
+
+// ************************************************************************************************************************************
+unsigned long long GetFileSize( const std::string& path )
+{
+	FileStamp stamp;
+	return GetFileStamp(path, stamp) ? stamp.size : 0;
+}
+
+
+// ************************************************************************************************************************************
+bool GetFileStamp( const std::string& path, FileStamp& stamp )
+{
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0)
+		return false;
+
+	stamp.size = info.st_size;
+	stamp.modified = info.st_mtime;
+	return true;
+}
+
+
+// ************************************************************************************************************************************
+static bool HasExtension( const std::string& name, const char* extension )
+{
+	size_t length = strlen(extension);
+	return name.size() > length && 0 == _stricmp(name.c_str() + name.size() - length, extension);
+}
+
+
+// ************************************************************************************************************************************
+static void FindFilesIn( const std::string& directory, const std::string& prefix, const char* extension, std::vector<std::string>& relativePaths )
+{
+	_finddata_t data;
+	intptr_t handle = _findfirst((directory + "/*").c_str(), &data);
+	if (handle == -1)
+		return;
+
+	do
+	{
+		std::string name = data.name;
+		if (name == "." || name == "..")
+			continue;
+
+		if (data.attrib & _A_SUBDIR)
+			FindFilesIn(directory + '/' + name, prefix + name + '/', extension, relativePaths);
+		else if (HasExtension(name, extension))
+			relativePaths.push_back(prefix + name);
+	}
+	while(_findnext(handle, &data) == 0);
+
+	_findclose(handle);
+}
+
+
+// ************************************************************************************************************************************
+void FindFiles( const std::string& directory, const char* extension, std::vector<std::string>& relativePaths )
+{
+	size_t first = relativePaths.size();
+	FindFilesIn(directory, std::string(), extension, relativePaths);
+
+	// Order of directory listing depends on file system
+	std::sort(relativePaths.begin() + first, relativePaths.end());
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// ************************************************************************************************************************************
+// File system helpers of directory output modes. Paths are narrow strings with '/' separators.
+
+// Creates directory with all missing parents, existing directories are not an error
+void MakeDirectories( const std::string& path );
+
+// Opens file for text output, throws on failure
+FILE* CreateOutputFile( const std::string& path );
+
+// Reads whole file in binary mode, throws on failure
+void ReadFileData( const std::string& path, std::vector<char>& data );
+
+// Writes text to new file, throws on failure (partially written file is removed)
+void WriteFileText( const std::string& path, const std::string& text );
+
+// Size of file in bytes, zero if it can not be read
+unsigned long long GetFileSize( const std::string& path );
+
+// Size and modification time, changes when file is rewritten
+struct FileStamp
+{
+	unsigned long long size;
+	long long modified;
+
+	bool operator == ( const FileStamp& other ) const	{ return size == other.size && modified == other.modified;	}
+};
+
+// Returns false if file does not exist
+bool GetFileStamp( const std::string& path, FileStamp& stamp );
+
+// Appends paths of files with given extension in directory tree, relative to directory and sorted by name
+void FindFiles( const std::string& directory, const char* extension, std::vector<std::string>& relativePaths );
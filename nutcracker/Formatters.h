@@ -7,11 +7,9 @@ struct indent
 
 	indent( int n ) : _n(n) {}
 
-	friend std::wostream& operator << (std::wostream& os, const indent& _i)
+	friend TextWriter& operator << (TextWriter& os, const indent& _i)
 	{
-		for(int i = 0; i < _i._n; ++i)
-			os << '\t';
-
+		os.Fill('\t', _i._n);
 		return os;
 	}
 };
@@ -24,29 +22,9 @@ struct spaces
 
 	spaces( int n ) : _n(n) {}
 
-	friend std::wostream& operator<< (std::wostream& os, const spaces& _i)
+	friend TextWriter& operator<< (TextWriter& os, const spaces& _i)
 	{
-		for(int i = 0; i < _i._n; ++i)
-			os << ' ';
-
+		os.Fill(' ', _i._n);
 		return os;
 	}
 };
-
-// ******************************************************************************
-inline void AssureIndents( LString& text, int n )
-{
-	LString::size_type pos = 0;
-	LString indents(n, L'\t');
-
-	while (pos < text.size())
-	{
-		pos = text.indexOf(L'\n', pos);
-		if (pos == LString::npos)
-			break;
-
-		pos += 1;
-		text.insert(pos, indents);
-		pos += n;
-	}
-}
@@ -0,0 +1,147 @@
+#include "stdafx.h"
+#include "FunctionPrerender.h"
+
+
+// ************************************************************************************************************************************
+// State shared with queued tasks - tasks queued after prerender ended do nothing
+struct FunctionPrerender::Group
+{
+	std::mutex mutex;
+	std::condition_variable idle;
+	bool cancelled;
+	int running;
+
+	Group() : cancelled(false), running(0) {}
+};
+
+
+// ************************************************************************************************************************************
+FunctionPrerender::FunctionPrerender( const NutFunction& function, ThreadPool& pool )
+: m_Function(function)
+, m_Group(std::make_shared<Group>())
+{
+	if (!function.GetContext().IsDebugMode())
+		SubmitNested(function, pool);
+}
+
+
+// ************************************************************************************************************************************
+FunctionPrerender::~FunctionPrerender()
+{
+	std::unique_lock<std::mutex> lock(m_Group->mutex);
+	m_Group->cancelled = true;
+	m_Group->idle.wait(lock, [this] { return m_Group->running == 0; });
+	lock.unlock();
+
+	ClearNested(m_Function);
+}
+
+
+// ************************************************************************************************************************************
+// Every nested function is separate task weighted by its own body, so that large bodies start first. All slots are
+// set before first task is queued, because task reads slots of functions nested in its own.
+void FunctionPrerender::SubmitNested( const NutFunction& function, ThreadPool& pool )
+{
+	std::vector<const NutFunction*> nested;
+	CollectNested(function, nested);
+
+	for(std::vector<const NutFunction*>::const_iterator i = nested.begin(); i != nested.end(); ++i)
+	{
+		const NutFunction* nestedFunction = *i;
+		std::shared_ptr<PrerenderSlot> slot = nestedFunction->m_Prerendered;
+		std::shared_ptr<Group> group = m_Group;
+
+		pool.Submit([nestedFunction, slot, group]
+		{
+			{
+				std::lock_guard<std::mutex> lock(group->mutex);
+				if (group->cancelled)
+					return;
+
+				group->running += 1;
+			}
+
+			Render(*nestedFunction, *slot);
+
+			std::lock_guard<std::mutex> lock(group->mutex);
+			group->running -= 1;
+			group->idle.notify_all();
+		}, nestedFunction->GetWeight());
+	}
+}
+
+
+// ************************************************************************************************************************************
+void FunctionPrerender::CollectNested( const NutFunction& function, std::vector<const NutFunction*>& nested )
+{
+	for(std::vector<NutFunction>::const_iterator i = function.m_Functions.begin(); i != function.m_Functions.end(); ++i)
+	{
+		i->m_Prerendered = std::make_shared<PrerenderSlot>();
+		nested.push_back(&*i);
+		CollectNested(*i, nested);
+	}
+}
+
+
+// ************************************************************************************************************************************
+void FunctionPrerender::ClearNested( const NutFunction& function )
+{
+	for(std::vector<NutFunction>::const_iterator i = function.m_Functions.begin(); i != function.m_Functions.end(); ++i)
+	{
+		i->m_Prerendered.reset();
+		ClearNested(*i);
+	}
+}
+
+
+// ************************************************************************************************************************************
+// Renders body unless some thread already started it, errors are kept for thread that prints the body
+void FunctionPrerender::Render( const NutFunction& function, PrerenderSlot& slot )
+{
+	{
+		std::lock_guard<std::mutex> lock(slot.mutex);
+		if (slot.state != PrerenderSlot::Pending)
+			return;
+
+		slot.state = PrerenderSlot::Running;
+	}
+
+	TextWriter out;
+	std::exception_ptr error;
+
+	try
+	{
+		function.GenerateBodySource(0, out);
+	}
+	catch(...)
+	{
+		error = std::current_exception();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(slot.mutex);
+		slot.text = out.GetText();
+		slot.error = error;
+		slot.state = PrerenderSlot::Done;
+	}
+
+	slot.done.notify_all();
+}
+
+
+// ************************************************************************************************************************************
+void FunctionPrerender::WriteBody( const NutFunction& function, int n, TextWriter& out )
+{
+	PrerenderSlot& slot = *function.m_Prerendered;
+	Render(function, slot);
+
+	std::unique_lock<std::mutex> lock(slot.mutex);
+	slot.done.wait(lock, [&slot] { return slot.state == PrerenderSlot::Done; });
+
+	lock.unlock();
+
+	if (slot.error)
+		std::rethrow_exception(slot.error);
+
+	out.WriteShifted(slot.text, n);
+}
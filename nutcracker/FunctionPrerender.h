@@ -0,0 +1,53 @@
+#pragma once
+#include "NutScript.h"
+#include "ThreadPool.h"
+
+// ************************************************************************************************************************************
+// Body text of nested function, rendered ahead with indent 0
+struct PrerenderSlot
+{
+	enum State
+	{
+		Pending,
+		Running,
+		Done,
+	};
+
+	std::mutex mutex;
+	std::condition_variable done;
+	State state;
+	std::string text;
+	std::exception_ptr error;
+
+	PrerenderSlot() : state(Pending) {}
+};
+
+
+// ************************************************************************************************************************************
+// Nested functions are decompiled as independent tasks on thread pool while their parent is generated. Parent splices
+// rendered body in when it prints the function (name and default parameters are still supplied by parent). Body that
+// no thread has started yet is rendered in place by thread that needs it, so waiting happens only on bodies being
+// rendered, which never wait on their parents. Active for lifetime of object.
+class FunctionPrerender
+{
+private:
+	struct Group;
+
+	const NutFunction& m_Function;
+	std::shared_ptr<Group> m_Group;
+
+	FunctionPrerender( const FunctionPrerender& );
+	FunctionPrerender& operator= ( const FunctionPrerender& );
+
+	void SubmitNested( const NutFunction& function, ThreadPool& pool );
+	static void CollectNested( const NutFunction& function, std::vector<const NutFunction*>& nested );
+	static void ClearNested( const NutFunction& function );
+	static void Render( const NutFunction& function, PrerenderSlot& slot );
+
+public:
+	FunctionPrerender( const NutFunction& function, ThreadPool& pool );
+	~FunctionPrerender();
+
+	// Writes body of nested function indented by n, rethrows error of its decompilation
+	static void WriteBody( const NutFunction& function, int n, TextWriter& out );
+};
@@ -0,0 +1,445 @@
+#include "stdafx.h"
+#include "JsonLine.h"
+
+
+// ************************************************************************************************************************************
+static void SkipSpace( const std::string& text, size_t& pos )
+{
+	while(pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n'))
+		++pos;
+}
+
+
+// ************************************************************************************************************************************
+static void Expect( const std::string& text, size_t& pos, char c )
+{
+	SkipSpace(text, pos);
+	if (pos >= text.size() || text[pos] != c)
+		throw Error("Bad JSON: '%c' expected at %d.", c, (int)pos);
+
+	++pos;
+}
+
+
+// ************************************************************************************************************************************
+static void AppendUtf8( std::string& result, unsigned int code )
+{
+	if (code < 0x80)
+	{
+		result += (char)code;
+	}
+	else if (code < 0x800)
+	{
+		result += (char)(0xC0 | (code >> 6));
+		result += (char)(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000)
+	{
+		result += (char)(0xE0 | (code >> 12));
+		result += (char)(0x80 | ((code >> 6) & 0x3F));
+		result += (char)(0x80 | (code & 0x3F));
+	}
+	else
+	{
+		result += (char)(0xF0 | (code >> 18));
+		result += (char)(0x80 | ((code >> 12) & 0x3F));
+		result += (char)(0x80 | ((code >> 6) & 0x3F));
+		result += (char)(0x80 | (code & 0x3F));
+	}
+}
+
+
+// ************************************************************************************************************************************
+static unsigned int ParseHex4( const std::string& text, size_t& pos )
+{
+	if (pos + 4 > text.size())
+		throw Error("Bad JSON: incomplete \\u escape.");
+
+	unsigned int code = 0;
+	for(size_t end = pos + 4; pos < end; ++pos)
+	{
+		char c = text[pos];
+		code <<= 4;
+
+		if (c >= '0' && c <= '9')
+			code |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			code |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			code |= c - 'A' + 10;
+		else
+			throw Error("Bad JSON: invalid \\u escape.");
+	}
+
+	return code;
+}
+
+
+// ************************************************************************************************************************************
+static bool IsDigitAt( const std::string& text, size_t pos )
+{
+	return pos < text.size() && text[pos] >= '0' && text[pos] <= '9';
+}
+
+
+// ************************************************************************************************************************************
+// Returns end of JSON number or true, false, null literal starting at pos, throws for anything else
+static size_t ScanLiteral( const std::string& text, size_t pos )
+{
+	static const char* const words[] = { "true", "false", "null" };
+
+	for(size_t i = 0; i < 3; ++i)
+		if (text.compare(pos, strlen(words[i]), words[i]) == 0)
+			return pos + strlen(words[i]);
+
+	size_t start = pos;
+	if (pos < text.size() && text[pos] == '-')
+		++pos;
+
+	if (!IsDigitAt(text, pos))
+		throw Error("Bad JSON: value expected at %d.", (int)start);
+
+	// No leading zeros
+	if (text[pos] == '0')
+		++pos;
+	else while(IsDigitAt(text, pos))
+		++pos;
+
+	if (pos < text.size() && text[pos] == '.')
+	{
+		if (!IsDigitAt(text, ++pos))
+			throw Error("Bad JSON: digit expected at %d.", (int)pos);
+
+		while(IsDigitAt(text, pos))
+			++pos;
+	}
+
+	if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E'))
+	{
+		++pos;
+		if (pos < text.size() && (text[pos] == '+' || text[pos] == '-'))
+			++pos;
+
+		if (!IsDigitAt(text, pos))
+			throw Error("Bad JSON: digit expected at %d.", (int)pos);
+
+		while(IsDigitAt(text, pos))
+			++pos;
+	}
+
+	return pos;
+}
+
+
+// ************************************************************************************************************************************
+// pos is at opening quote, ends after closing quote
+static std::string ParseString( const std::string& text, size_t& pos )
+{
+	Expect(text, pos, '"');
+
+	std::string result;
+
+	for(;;)
+	{
+		if (pos >= text.size())
+			throw Error("Bad JSON: unterminated string.");
+
+		char c = text[pos++];
+		if (c == '"')
+			return result;
+
+		if ((unsigned char)c < 0x20)
+			throw Error("Bad JSON: control character in string at %d.", (int)pos - 1);
+
+		if (c != '\\')
+		{
+			result += c;
+			continue;
+		}
+
+		if (pos >= text.size())
+			throw Error("Bad JSON: unterminated string.");
+
+		c = text[pos++];
+		switch(c)
+		{
+			case '"':	result += '"';		break;
+			case '\\':	result += '\\';		break;
+			case '/':	result += '/';		break;
+			case 'b':	result += '\b';		break;
+			case 'f':	result += '\f';		break;
+			case 'n':	result += '\n';		break;
+			case 'r':	result += '\r';		break;
+			case 't':	result += '\t';		break;
+
+			case 'u':
+			{
+				unsigned int code = ParseHex4(text, pos);
+
+				// Surrogates are valid only as high and low half of pair
+				if (code >= 0xDC00 && code < 0xE000)
+					throw Error("Bad JSON: lone low surrogate.");
+
+				if (code >= 0xD800 && code < 0xDC00)
+				{
+					if (pos + 1 >= text.size() || text[pos] != '\\' || text[pos + 1] != 'u')
+						throw Error("Bad JSON: lone high surrogate.");
+
+					pos += 2;
+					unsigned int low = ParseHex4(text, pos);
+					if (low < 0xDC00 || low >= 0xE000)
+						throw Error("Bad JSON: invalid surrogate pair.");
+
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+
+				AppendUtf8(result, code);
+				break;
+			}
+
+			default:
+				throw Error("Bad JSON: invalid escape '\\%c'.", c);
+		}
+	}
+}
+
+
+// ************************************************************************************************************************************
+// Length of well formed UTF-8 sequence starting at pos, zero for invalid byte (overlong forms, surrogates and codes above
+// U+10FFFF are invalid)
+static size_t Utf8SequenceLength( const std::string& text, size_t pos )
+{
+	unsigned char lead = (unsigned char)text[pos];
+	size_t size;
+	unsigned int code;
+
+	if (lead < 0x80)
+		return 1;
+	else if (lead >= 0xC2 && lead < 0xE0)
+		size = 2, code = lead & 0x1F;
+	else if (lead >= 0xE0 && lead < 0xF0)
+		size = 3, code = lead & 0x0F;
+	else if (lead >= 0xF0 && lead < 0xF5)
+		size = 4, code = lead & 0x07;
+	else
+		return 0;
+
+	if (pos + size > text.size())
+		return 0;
+
+	for(size_t i = 1; i < size; ++i)
+	{
+		unsigned char c = (unsigned char)text[pos + i];
+		if ((c & 0xC0) != 0x80)
+			return 0;
+
+		code = (code << 6) | (c & 0x3F);
+	}
+
+	static const unsigned int minCode[] = { 0, 0, 0x80, 0x800, 0x10000 };
+	if (code < minCode[size] || code > 0x10FFFF || (code >= 0xD800 && code < 0xE000))
+		return 0;
+
+	return size;
+}
+
+
+// ************************************************************************************************************************************
+// Bytes that are not valid UTF-8 (such as multibyte text of error messages) are written as U+FFFD
+static void AppendEscaped( std::string& result, const std::string& text )
+{
+	static const char hex[] = "0123456789abcdef";
+
+	result += '"';
+
+	for(size_t pos = 0; pos < text.size(); ++pos)
+	{
+		unsigned char c = (unsigned char)text[pos];
+		if (c >= 0x80)
+		{
+			size_t size = Utf8SequenceLength(text, pos);
+			if (size == 0)
+			{
+				result += "\xEF\xBF\xBD";
+			}
+			else
+			{
+				result.append(text, pos, size);
+				pos += size - 1;
+			}
+			continue;
+		}
+
+		switch(c)
+		{
+			case '"':	result += "\\\"";	break;
+			case '\\':	result += "\\\\";	break;
+			case '\n':	result += "\\n";	break;
+			case '\r':	result += "\\r";	break;
+			case '\t':	result += "\\t";	break;
+
+			default:
+				if (c < 0x20)
+				{
+					result += "\\u00";
+					result += hex[c >> 4];
+					result += hex[c & 15];
+				}
+				else
+				{
+					result += (char)c;
+				}
+				break;
+		}
+	}
+
+	result += '"';
+}
+
+
+// ************************************************************************************************************************************
+void JsonObject::Parse( const std::string& text )
+{
+	m_Values.clear();
+
+	size_t pos = 0;
+	Expect(text, pos, '{');
+	SkipSpace(text, pos);
+
+	if (pos < text.size() && text[pos] == '}')
+	{
+		++pos;
+	}
+	else for(;;)
+	{
+		std::string key = ParseString(text, pos);
+		Expect(text, pos, ':');
+		SkipSpace(text, pos);
+
+		if (pos >= text.size())
+			throw Error("Bad JSON: value expected.");
+
+		Value value;
+		size_t start = pos;
+
+		if (text[pos] == '"')
+		{
+			value.text = ParseString(text, pos);
+			value.isString = true;
+		}
+		else if (text[pos] == '{' || text[pos] == '[')
+		{
+			throw Error("Bad JSON: nested value of \"%s\" is not supported.", key.c_str());
+		}
+		else
+		{
+			pos = ScanLiteral(text, pos);
+			value.text = text.substr(start, pos - start);
+			value.isString = false;
+		}
+
+		value.raw = text.substr(start, pos - start);
+		m_Values[key] = value;
+
+		SkipSpace(text, pos);
+		if (pos < text.size() && text[pos] == ',')
+		{
+			++pos;
+			continue;
+		}
+
+		Expect(text, pos, '}');
+		break;
+	}
+
+	SkipSpace(text, pos);
+	if (pos != text.size())
+		throw Error("Bad JSON: unexpected text after object.");
+}
+
+
+// ************************************************************************************************************************************
+const JsonObject::Value* JsonObject::Find( const char* key ) const
+{
+	std::map<std::string, Value>::const_iterator i = m_Values.find(key);
+	return (i != m_Values.end()) ? &i->second : NULL;
+}
+
+
+// ************************************************************************************************************************************
+std::string JsonObject::GetString( const char* key, const char* defaultValue ) const
+{
+	const Value* value = Find(key);
+	if (!value)
+		return defaultValue;
+
+	if (!value->isString)
+		throw Error("Value of \"%s\" has to be a string.", key);
+
+	return value->text;
+}
+
+
+// ************************************************************************************************************************************
+bool JsonObject::GetBool( const char* key, bool defaultValue ) const
+{
+	const Value* value = Find(key);
+	if (!value)
+		return defaultValue;
+
+	if (value->isString || (value->text != "true" && value->text != "false"))
+		throw Error("Value of \"%s\" has to be true or false.", key);
+
+	return value->text == "true";
+}
+
+
+// ************************************************************************************************************************************
+std::string JsonObject::GetRaw( const char* key ) const
+{
+	const Value* value = Find(key);
+	return value ? value->raw : std::string("null");
+}
+
+
+// ************************************************************************************************************************************
+void JsonWriter::AddKey( const char* key )
+{
+	if (m_Text.size() > 1)
+		m_Text += ',';
+
+	AppendEscaped(m_Text, key);
+	m_Text += ':';
+}
+
+
+// ************************************************************************************************************************************
+void JsonWriter::Add( const char* key, const std::string& value )
+{
+	AddKey(key);
+	AppendEscaped(m_Text, value);
+}
+
+
+// ************************************************************************************************************************************
+void JsonWriter::Add( const char* key, bool value )
+{
+	AddKey(key);
+	m_Text += value ? "true" : "false";
+}
+
+
+// ************************************************************************************************************************************
+void JsonWriter::AddRaw( const char* key, const std::string& json )
+{
+	AddKey(key);
+	m_Text += json;
+}
+
+
+// ************************************************************************************************************************************
+const std::string& JsonWriter::Finish( void )
+{
+	m_Text += '}';
+	return m_Text;
+}
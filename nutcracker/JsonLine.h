@@ -0,0 +1,50 @@
+#pragma once
+#include <map>
+
+// ************************************************************************************************************************************
+// Flat JSON object of one protocol line - string, number, true, false and null values only. Strings are UTF-8.
+class JsonObject
+{
+private:
+	struct Value
+	{
+		std::string text;		// Unescaped string, or literal as written
+		std::string raw;		// JSON text of value
+		bool isString;
+	};
+
+	std::map<std::string, Value> m_Values;
+
+	const Value* Find( const char* key ) const;
+
+public:
+	// Throws Error for malformed or nested objects
+	void Parse( const std::string& text );
+
+	bool Has( const char* key ) const								{ return Find(key) != NULL;		}
+	std::string GetString( const char* key, const char* defaultValue = "" ) const;
+	bool GetBool( const char* key, bool defaultValue ) const;
+	std::string GetRaw( const char* key ) const;					// "null" when missing
+};
+
+
+// ************************************************************************************************************************************
+// Builds flat JSON object on one line. String values should be UTF-8, invalid bytes are written as U+FFFD.
+class JsonWriter
+{
+private:
+	std::string m_Text;
+
+	void AddKey( const char* key );
+
+public:
+	JsonWriter() : m_Text("{")	{}
+
+	void Add( const char* key, const std::string& value );
+	void Add( const char* key, const char* value )				{ Add(key, std::string(value));	}
+	void Add( const char* key, bool value );
+	void AddRaw( const char* key, const std::string& json );
+
+	// Closes object, writer can not be used after that
+	const std::string& Finish( void );
+};
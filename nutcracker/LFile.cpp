@@ -23,6 +23,17 @@ bool LFile::openRead(CWStrPtr pFileName)
 	return true;
 }
 
+bool LFile::openMemory(const void* pData, size_t size)
+{
+	if (m_hFile || m_pData || !pData)
+		return false;
+
+	m_pData = static_cast<const char*>(pData);
+	m_dataSize = size;
+	m_dataPos = 0;
+	return true;
+}
+
 bool LFile::openWrite(CStrPtr pFileName)
 {
 	return open(pFileName, fopen_s, "wb");
@@ -32,3 +43,18 @@ bool LFile::openWrite(CWStrPtr pFileName)
 {
 	return open(pFileName, _wfopen_s, L"wb");
 }
+
+size_t LFile::readBytes(void* pBuf, size_t elemSize, size_t cnt)
+{
+	if (!m_pData)
+		return fread_s(pBuf, elemSize * cnt, elemSize, cnt, m_hFile);
+
+	// Whole elements only, like fread
+	size_t avail = (m_dataSize - m_dataPos) / elemSize;
+	if (cnt > avail)
+		cnt = avail;
+
+	memcpy(pBuf, m_pData + m_dataPos, elemSize * cnt);
+	m_dataPos += elemSize * cnt;
+	return cnt;
+}
@@ -15,6 +15,7 @@ public:
 
 	bool openRead(CStrPtr pFileName);
 	bool openRead(CWStrPtr pFileName);
+	bool openMemory(const void* pData, size_t size);	// reads from buffer kept alive by caller
 	template <typename T> size_t readAs(T& var);
 	template <typename T> size_t readAs(T* pBuf, size_t cnt);
 	template <typename T> T read();
@@ -26,32 +27,33 @@ public:
 
 	bool opened() const { return m_hFile != nullptr; }
 	fpos_t size() const { return m_size; }
-	bool eof() const { return (0 != feof(m_hFile)); }
-	int error() const { return ferror(m_hFile); }
+	bool eof() const { return m_pData ? (m_dataPos >= m_dataSize) : (0 != feof(m_hFile)); }
+	int error() const { return m_pData ? 0 : ferror(m_hFile); }
 
 private:
 	template <typename CharType, typename Function>
 	bool open(const CharType* pFileName, Function fnOpen_s, const CharType* pMode);
 
+	size_t readBytes(void* pBuf, size_t elemSize, size_t cnt);	// short count at end of data, checked by caller
+
 private:
 	FILE* m_hFile	{ nullptr };
 	fpos_t m_size	{ 0 };
+	const char* m_pData	{ nullptr };
+	size_t m_dataSize	{ 0 };
+	size_t m_dataPos	{ 0 };
 };
 
 template <typename T>
 size_t LFile::readAs(T& var)
 {
-	size_t sz = fread_s((void*)&var, sizeof(T), sizeof(T), 1, m_hFile);
-	CheckSize(1, sz);
-	return sz;
+	return readBytes((void*)&var, sizeof(T), 1);
 }
 
 template <typename T>
 size_t LFile::readAs(T* pBuf, size_t cnt)
 {
-	size_t sz = fread_s((void*)pBuf, sizeof(T) * cnt, sizeof(T), cnt, m_hFile);
-	CheckSize(cnt, sz);
-	return sz;
+	return readBytes((void*)pBuf, sizeof(T), cnt);
 }
 
 template <typename T>
@@ -81,7 +83,7 @@ size_t LFile::write(T* pBuf, size_t cnt)
 template <typename CharType, typename Function>
 bool LFile::open(const CharType* pFileName, Function fnOpen_s, const CharType* pMode)
 {
-	if (m_hFile)
+	if (m_hFile || m_pData)
 		return false;
 
 	errno_t err = fnOpen_s(&m_hFile, pFileName, pMode);
@@ -1,9 +1,8 @@
 #include "stdafx.h"
 #include "LString.h"
 #include <codecvt>
-#include <map>
-
-std::locale LString::s_defaultLocale;
+#include <cfloat>
+#include <cmath>
 
 LString& LString::assign(CStrPtr pcstr, size_t size, const std::locale& locale)
 {
@@ -25,31 +24,70 @@ LString& LString::assign(CStrPtr pcstr, size_t size, const std::locale& locale)
 	}
 	else
 	{
-		LStrBuilder builder(LStrBuilder::modeJoin, L"\\x");
+		reserve(size * 4);
 		for (CStrPtr pch = pcstr; pch < pcstr + size; ++pch)
-			builder.arg(*(Byte*)pch, 2, 16, L'0');
-		(*this) = LString(L"\\x") + builder.apply();
+		{
+			Base::append(L"\\x");
+			appendNum(*(Byte*)pch, 16, 2, L'0');
+		}
 	}
 	return (*this);
 }
 
+// digits of val are written backwards from end of buffer, returns first character
+static wchar_t* FormatDigits(unsigned int val, int base, bool negative, wchar_t* end)
+{
+	static const wchar_t digits[] = L"0123456789abcdefghijklmnopqrstuvwxyz";
+	assert(base >= 2 && base <= 36);
+
+	wchar_t* p = end;
+	do
+	{
+		*--p = digits[val % base];
+		val /= base;
+	} while (val);
+
+	if (negative)
+		*--p = L'-';
+	return p;
+}
+
 LString& LString::setNum(int val, int base /*= 10*/)
 {
+	clear();
+	return appendNum(val, base);
+}
+
+LString& LString::appendNum(int val, int base /*= 10*/)
+{
+	// like _itow_s - sign is written only for decimal numbers
 	const size_t buffsize = 33;
-	wchar_t buff[buffsize] = { 0 };
-	errno_t err = _itow_s(val, buff, base);
-	assert(0 == err);
-	Base::assign(buff);
+	wchar_t buff[buffsize];
+	bool negative = (base == 10 && val < 0);
+	unsigned int magnitude = negative ? 0u - static_cast<unsigned int>(val) : static_cast<unsigned int>(val);
+	WStrPtr first = FormatDigits(magnitude, base, negative, buff + buffsize);
+	Base::append(first, buff + buffsize);
+	return (*this);
+}
+
+LString& LString::appendNum(unsigned int val, int base, size_t fieldWidth, wchar_t fillChar)
+{
+	const size_t buffsize = 33;
+	wchar_t buff[buffsize];
+	WStrPtr first = FormatDigits(val, base, false, buff + buffsize);
+	size_t size = buff + buffsize - first;
+	if (size < fieldWidth)
+		Base::append(fieldWidth - size, fillChar);
+	Base::append(first, size);
 	return (*this);
 }
 
 LString& LString::setNum(unsigned int val, int base /*= 10*/)
 {
 	const size_t buffsize = 33;
-	wchar_t buff[buffsize] = { 0 };
-	errno_t err = _ultow_s(val, buff, base);
-	assert(0 == err);
-	Base::assign(buff);
+	wchar_t buff[buffsize];
+	WStrPtr first = FormatDigits(val, base, false, buff + buffsize);
+	Base::assign(first, buff + buffsize);
 	return (*this);
 }
 
@@ -63,6 +101,26 @@ LString& LString::setNum(float val, int prec /*= 6*/)
 	return (*this);
 }
 
+LString& LString::setNumRoundTrip(float val)
+{
+	// Fewer than 6 significant digits are covered by %.6g as trailing zeros are stripped (except for
+	// denormals with reduced precision), 9 digits always identify a float
+	char buff[32] = { 0 };
+	int size = 0;
+	int firstPrec = (val != 0 && std::fabs(val) < FLT_MIN) ? 1 : 6;
+	for (int prec = firstPrec; prec <= 9; ++prec)
+	{
+		size = sprintf_s(buff, "%.*g", prec, static_cast<double>(val));
+		if (strtof(buff, nullptr) == val)
+			break;
+	}
+
+	resize(std::max(size, 0));
+	for (int i = 0; i < size; ++i)
+		(*this)[i] = static_cast<wchar_t>(buff[i]);
+	return (*this);
+}
+
 std::string LString::toUtf8() const
 {
 	std::wstring_convert<std::codecvt_utf8<wchar_t>> conv;
@@ -90,200 +148,3 @@ LString LString::fromUtf8(const std::string& bytes)
 	std::wstring_convert<std::codecvt_utf8<wchar_t>> conv;
 	return conv.from_bytes(bytes);
 }
-
-//////////////////////////////////////////////////////////////////////////
-LStrBuilder::LStrBuilder(CWStrPtr pPattern)
-{
-	resetPattern(pPattern);
-}
-
-LStrBuilder::LStrBuilder(CStrPtr pPattern)
-{
-	resetPattern(pPattern);
-}
-
-LStrBuilder::LStrBuilder(Mode mode, CWStrPtr pArg)
-	: m_mode(mode)
-{
-	if (m_mode == modePattern)
-		resetPattern(pArg);
-	else
-		m_pattern = pArg;
-}
-
-LStrBuilder::~LStrBuilder()
-{
-
-}
-
-void LStrBuilder::resetPattern(CWStrPtr pPattern)
-{
-	m_pattern = pPattern;
-	reset(modePattern);
-}
-
-void LStrBuilder::resetPattern(CStrPtr pPattern)
-{
-	m_pattern = pPattern;
-	reset(modePattern);
-}
-
-LString LStrBuilder::apply() const
-{
-	if (m_mode == modePattern)
-		return applyPattern();
-	else
-		return applyJoin();
-}
-
-void LStrBuilder::reset(Mode mode)
-{
-	m_mode = mode;
-	m_argCount = 0;
-	m_chpxes.clear();
-	m_args.clear();
-	analyzePattern();
-}
-
-LString LStrBuilder::applyPattern() const
-{
-	if (m_chpxes.empty() || m_args.empty())
-		return m_pattern;
-
-	LString result;
-	size_t pos = 0;
-	CWStrPtr pBegin = m_pattern.c_str();
-	CWStrPtr pPos = pBegin;
-	for (auto iter = m_chpxes.begin(); iter != m_chpxes.end(); ++iter)
-	{
-		const ChpxInfo& info = *iter;
-
-		size_t prevLen = pBegin + info.begin - pPos;
-		result.append(pPos, prevLen);
-		result.append(m_args[info.argID]);
-
-		pPos = pBegin + info.begin + info.len;
-	}
-
-	if (pPos < pBegin + m_pattern.size())
-		result.append(pPos);
-
-	return result;
-}
-
-LString LStrBuilder::applyJoin() const
-{
-	if (m_args.empty())
-		return LString();
-
-	size_t cap = m_pattern.size() * (m_args.size() - 1);
-	for (const LString& arg : m_args)
-		cap += arg.size();
-
-	LString result;
-	result.reserve(cap);
-	for (const LString& arg : m_args)
-	{
-		if (!result.empty())
-			result.append(m_pattern);
-		result.append(arg);
-	}
-	return result;
-}
-
-void LStrBuilder::analyzePattern()
-{
-	if (m_pattern.empty())
-		return;
-
-	const wchar_t* pBegin = m_pattern.c_str();
-	const wchar_t* pEnd = pBegin + m_pattern.size();
-
-	std::map<size_t, size_t> idMap;
-	for (const wchar_t* pch = pBegin; pch < pEnd; ++pch)
-	{
-		if (*pch != L'%')
-			continue;
-
-		++pch;
-		if (pch >= pEnd)
-			break;
-
-		const wchar_t ch = *pch;
-
-		int num = ch - L'0';
-		if (num <= 0 || num > 9)
-			continue;
-
-		const wchar_t* pArgBegin = pch - 1;
-		if (pch + 1 < pEnd)
-		{
-			int num2 = pch[1] - L'0';
-			if (num2 >= 0 && num2 <= 9)
-			{
-				++pch;
-				num *= 10;
-				num += num2;
-			}
-		}
-
-		ChpxInfo info;
-		info.begin = pArgBegin - pBegin;
-		info.len = pch - pArgBegin + 1;
-		info.argID = num;
-		idMap[num] = 0;
-		m_chpxes.push_back(info);
-	}
-	if (idMap.empty())
-		return;
-
-	size_t relID = 0;
-	for (auto iter = idMap.begin(); iter != idMap.end(); ++iter, ++relID)
-		iter->second = relID;
-
-	for (auto iter = m_chpxes.begin(); iter != m_chpxes.end(); ++iter)
-		iter->argID = idMap[iter->argID];
-}
-
-bool LStrBuilder::isFull()
-{
-	if (m_args.size() >= m_argCount)
-	{
-		assert(!"Argument number mismatch!");
-		return true;
-	}
-	return false;
-}
-
-LStrBuilder& LStrBuilder::arg(CWStrPtr val)
-{
-	m_args.push_back(val);
-	return (*this);
-}
-
-LStrBuilder& LStrBuilder::arg(int val)
-{
-	m_args.emplace_back(LString::number(val));
-	return (*this);
-}
-
-LStrBuilder& LStrBuilder::arg(int val, size_t fieldWidth, int base, wchar_t fillChar)
-{
-	LString str = LString::number(val, base);
-	if (str.size() < fieldWidth)
-	{
-		m_args.emplace_back(LString(fieldWidth, fillChar));
-		memcpy(&m_args.back()[fieldWidth - str.size()], str.c_str(), str.size());
-	}
-	else
-	{
-		m_args.push_back(str);
-	}
-	return (*this);
-}
-
-LStrBuilder& LStrBuilder::arg(float val)
-{
-	m_args.emplace_back(LString::number(val));
-	return (*this);
-}
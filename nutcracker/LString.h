@@ -22,7 +22,7 @@ public:
 	using Base::append;
 
 	LString& assign(CStrPtr pcstr, size_t size, const std::locale& locale);
-	LString& assign(CStrPtr pcstr, size_t size) { return assign(pcstr, size, s_defaultLocale); }
+	LString& assign(CStrPtr pcstr, size_t size) { return assign(pcstr, size, std::locale::classic()); }
 	LString& assign(CStrPtr pcstr) { return assign(pcstr, strlen(pcstr)); }
 
 	LString& append(char c) { Base::push_back(c); return (*this); }
@@ -30,6 +30,9 @@ public:
 	LString& setNum(int val, int base = 10);
 	LString& setNum(unsigned int val, int base = 10);
 	LString& setNum(float val, int prec = 6);
+	LString& setNumRoundTrip(float val);	// shortest text that reads back as the same float
+	LString& appendNum(int val, int base = 10);
+	LString& appendNum(unsigned int val, int base, size_t fieldWidth, wchar_t fillChar);
 
 	std::string toUtf8() const;
 
@@ -42,56 +45,85 @@ public:
 	static LString number(int val, int base = 10) { return LString().setNum(val, base); }
 	static LString number(float val, int prec = 6) { return LString().setNum(val, prec); }
 	static LString fromUtf8(const std::string& bytes);
-	static void setLocal(std::locale& locale) { s_defaultLocale = locale; }
-
-protected:
-	static std::locale s_defaultLocale;
 };
 
-class LStrBuilder
+// Format pattern with placeholders %1, %2 ... used once each in ascending order. Placeholders are found when pattern
+// constant is built at compile time, formatting appends literal segments and arguments to caller string:
+//     static constexpr LStrPattern pattern("line %1");
+//     LStrFormat(text, pattern).arg(line);
+class LStrPattern
 {
-	typedef wchar_t* WStrPtr;
-	typedef const wchar_t* CWStrPtr;
-	typedef char* StrPtr;
-	typedef const char* CStrPtr;
 public:
-	enum Mode { modePattern, modeJoin };
-
-	LStrBuilder(CWStrPtr pPattern);
-	LStrBuilder(CStrPtr pPattern);
-	LStrBuilder(Mode mode, CWStrPtr pArg);
-	~LStrBuilder();
+	static const int MaxArgs = 4;
 
-	operator LString() { return apply(); }
-	void resetPattern(CWStrPtr pPattern);
-	void resetPattern(CStrPtr pPattern);
-	LString apply() const;
+	template <size_t N>
+	constexpr LStrPattern(const char (&text)[N])
+		: m_text(text), m_size(N - 1), m_argCount(countArgs(text, N - 1, 0, 1))
+		, m_argPos{ findArg(text, N - 1, 0, 1), findArg(text, N - 1, 0, 2), findArg(text, N - 1, 0, 3), findArg(text, N - 1, 0, 4) }
+	{
+	}
 
-	LStrBuilder& arg(CWStrPtr val);
-	LStrBuilder& arg(int val);
-	LStrBuilder& arg(int val, size_t fieldWidth, int base, wchar_t fillChar);
-	LStrBuilder& arg(float val);
+	constexpr int argCount() const { return m_argCount; }
 
-	LStrBuilder& arg(const std::wstring& val) { return arg(val.c_str()); }
+	// Literal text before placeholder of argument index, or after last placeholder for index == argCount()
+	constexpr const char* segmentBegin(int index) const { return m_text + (index == 0 ? 0 : m_argPos[index - 1] + 2); }
+	constexpr const char* segmentEnd(int index) const { return m_text + (index < m_argCount ? m_argPos[index] : m_size); }
 
 private:
-	void reset(Mode mode);
-	void analyzePattern();
-	bool isFull();
-	LString applyPattern() const;
-	LString applyJoin() const;
+	static constexpr bool isArg(const char* text, size_t size, size_t pos)
+	{
+		return text[pos] == '%' && pos + 1 < size && text[pos + 1] >= '0' && text[pos + 1] <= '9';
+	}
+
+	// '%' not followed by digit is plain text
+	static constexpr int countArgs(const char* text, size_t size, size_t pos, int next)
+	{
+		return pos >= size ? next - 1 :
+			!isArg(text, size, pos) ? countArgs(text, size, pos + 1, next) :
+			(text[pos + 1] == '0' + next && next <= MaxArgs) ? countArgs(text, size, pos + 2, next + 1) :
+			throw "LStrPattern placeholders must go as %1, %2 ... %4 in ascending order";
+	}
+
+	static constexpr size_t findArg(const char* text, size_t size, size_t pos, int arg)
+	{
+		return pos >= size ? size :
+			(isArg(text, size, pos) && text[pos + 1] == '0' + arg) ? pos :
+			findArg(text, size, pos + 1, arg);
+	}
+
+	const char* m_text;
+	size_t m_size;
+	int m_argCount;
+	size_t m_argPos[MaxArgs];
+};
+
+// Appends formatted pattern to result - literal segments are copied without scanning, arguments appended in place
+class LStrFormat
+{
+	typedef const wchar_t* CWStrPtr;
+public:
+	LStrFormat(LString& result, const LStrPattern& pattern)
+		: m_result(result), m_pattern(pattern), m_index(0)
+	{
+		appendSegment();
+	}
+
+	~LStrFormat() { assert(m_index == m_pattern.argCount()); }
+
+	LStrFormat& arg(CWStrPtr val) { m_result.append(val); return next(); }
+	LStrFormat& arg(const std::wstring& val) { m_result.append(val); return next(); }
+	LStrFormat& arg(int val) { m_result.appendNum(val); return next(); }
 
 private:
-	LString m_pattern;
+	LStrFormat& next() { ++m_index; appendSegment(); return (*this); }
 
-	struct ChpxInfo
+	void appendSegment()
 	{
-		size_t begin{ 0 };
-		size_t len{ 0 };
-		size_t argID{ 0 };
-	};
-	std::vector<ChpxInfo> m_chpxes;
-	std::vector<LString> m_args;
-	size_t m_argCount{ 0 };
-	Mode m_mode{ modeJoin };
+		for (const char* pos = m_pattern.segmentBegin(m_index); pos < m_pattern.segmentEnd(m_index); ++pos)
+			m_result.push_back(static_cast<unsigned char>(*pos));
+	}
+
+	LString& m_result;
+	const LStrPattern& m_pattern;
+	int m_index;
 };
@@ -0,0 +1,290 @@
+#include "stdafx.h"
+#include "NutCrackerApi.h"
+#include "NutScript.h"
+#include "ThreadPool.h"
+#include "FunctionPrerender.h"
+
+static thread_local std::string t_LastError;
+
+
+// ************************************************************************************************************************************
+struct NutContext
+{
+	DecompileContext context;
+	ThreadPool pool;
+
+	NutContext( const char* localeName, size_t threads )
+	: context(localeName)
+	, pool(threads)
+	{
+	}
+
+	NutContext( size_t threads )
+	: pool(threads)
+	{
+	}
+};
+
+
+// ************************************************************************************************************************************
+struct NutScriptObject
+{
+	NutContext* owner;
+	NutScript script;
+	std::string functionName;		// Function of rendered text, empty for whole script
+	bool rendered;
+	std::string text;
+
+	explicit NutScriptObject( NutContext* owner )
+	: owner(owner)
+	, script(owner->context)
+	, rendered(false)
+	{
+	}
+};
+
+
+// ************************************************************************************************************************************
+// Does not throw - copy of message that runs out of memory leaves message empty
+static int Fail( int code, const char* message )
+{
+	try
+	{
+		t_LastError = message;
+	}
+	catch(...)
+	{
+		t_LastError.clear();
+	}
+	return code;
+}
+
+
+// ************************************************************************************************************************************
+// Copies text with terminating zero if it fits to buffer
+static int CopyOut( const std::string& text, char* buffer, size_t bufferSize, size_t* requiredSize )
+{
+	if (requiredSize)
+		*requiredSize = text.size() + 1;
+
+	if (!buffer || bufferSize < text.size() + 1)
+		return Fail(NUT_ERROR_BUFFER_TOO_SMALL, "Buffer is too small.");
+
+	memcpy(buffer, text.c_str(), text.size() + 1);
+	return NUT_OK;
+}
+
+
+// ************************************************************************************************************************************
+NutContextHandle NutCreateContext( const char* localeName, size_t threads )
+{
+	try
+	{
+		t_LastError.clear();
+		return localeName ? new NutContext(localeName, threads) : new NutContext(threads);
+	}
+	catch( std::exception& ex )
+	{
+		Fail(NUT_ERROR, ex.what());
+		return NULL;
+	}
+	catch(...)
+	{
+		Fail(NUT_ERROR, "Unknown error.");
+		return NULL;
+	}
+}
+
+
+// ************************************************************************************************************************************
+void NutDestroyContext( NutContextHandle context )
+{
+	delete context;
+}
+
+
+// ************************************************************************************************************************************
+int NutSetBudget( NutContextHandle context, size_t instructions, size_t milliseconds )
+{
+	if (!context)
+		return Fail(NUT_ERROR, "Invalid argument.");
+
+	context->context.SetBudget(instructions, milliseconds);
+	return NUT_OK;
+}
+
+
+// ************************************************************************************************************************************
+NutScriptHandle NutLoadScript( NutContextHandle context, const void* data, size_t size )
+{
+	if (!context || !data)
+	{
+		Fail(NUT_ERROR, "Invalid argument.");
+		return NULL;
+	}
+
+	try
+	{
+		t_LastError.clear();
+		std::unique_ptr<NutScriptObject> script(new NutScriptObject(context));
+		script->script.LoadFromBuffer(data, size);
+		return script.release();
+	}
+	catch( std::exception& ex )
+	{
+		Fail(NUT_ERROR, ex.what());
+		return NULL;
+	}
+	catch(...)
+	{
+		Fail(NUT_ERROR, "Unknown error.");
+		return NULL;
+	}
+}
+
+
+// ************************************************************************************************************************************
+void NutFreeScript( NutScriptHandle script )
+{
+	delete script;
+}
+
+
+// ************************************************************************************************************************************
+int NutDecompile( NutScriptHandle script, const char* functionName, char* buffer, size_t bufferSize, size_t* requiredSize )
+{
+	if (!script)
+		return Fail(NUT_ERROR, "Invalid argument.");
+
+	try
+	{
+		t_LastError.clear();
+		std::string name = functionName ? functionName : "";
+
+		if (!script->rendered || script->functionName != name)
+		{
+			const NutFunction& main = script->script.GetMain();
+			const NutFunction* function = functionName ? main.FindFunction(LString::fromUtf8(name)) : &main;
+			if (!function)
+				return Fail(NUT_ERROR_NOT_FOUND, "Function not found.");
+
+			TextWriter out;
+			{
+				FunctionPrerender prerender(*function, script->owner->pool);
+				if (functionName)
+					function->GenerateFunctionSource(0, out);
+				else
+					function->GenerateBodySource(0, out);
+			}
+
+			script->text = out.GetText();
+			script->functionName = name;
+			script->rendered = true;
+		}
+
+		return CopyOut(script->text, buffer, bufferSize, requiredSize);
+	}
+	catch( std::exception& ex )
+	{
+		return Fail(NUT_ERROR, ex.what());
+	}
+	catch(...)
+	{
+		return Fail(NUT_ERROR, "Unknown error.");
+	}
+}
+
+
+// ************************************************************************************************************************************
+int NutCompare( NutScriptHandle first, NutScriptHandle second, int* equal, char* report, size_t reportSize, size_t* requiredSize )
+{
+	if (!first || !second || !equal || first->owner != second->owner)
+		return Fail(NUT_ERROR, "Invalid argument.");
+
+	try
+	{
+		t_LastError.clear();
+		ThreadPool& pool = first->owner->pool;
+
+		if (!requiredSize)
+		{
+			*equal = first->script.GetMain().DoCompare(second->script.GetMain(), NULL, &pool) ? 1 : 0;
+			return NUT_OK;
+		}
+
+		TextWriter out;
+		*equal = first->script.GetMain().DoCompare(second->script.GetMain(), &out, &pool) ? 1 : 0;
+		return CopyOut(out.GetText(), report, reportSize, requiredSize);
+	}
+	catch( std::exception& ex )
+	{
+		return Fail(NUT_ERROR, ex.what());
+	}
+	catch(...)
+	{
+		return Fail(NUT_ERROR, "Unknown error.");
+	}
+}
+
+
+// ************************************************************************************************************************************
+static bool EnumFunctions( const NutFunction& function, const std::string& parentName, int depth, NutFunctionCallback callback, void* user )
+{
+	for(size_t i = 0; i < function.GetFunctionCount(); ++i)
+	{
+		const NutFunction& nested = function.GetFunction((int)i);
+
+		std::string name = parentName;
+		if (!name.empty())
+			name += "::";
+
+		// Index names functions that are unnamed or not first of their name, which name lookup would not find
+		bool byName = !nested.GetName().empty();
+		for(size_t j = 0; j < i && byName; ++j)
+			if (function.GetFunction((int)j).GetName() == nested.GetName())
+				byName = false;
+
+		if (byName)
+			name += nested.GetName().toUtf8();
+		else
+			name += std::to_string(i);
+
+		if (callback(name.c_str(), depth, nested.GetInstructionCount(), user) != 0)
+			return false;
+
+		if (!EnumFunctions(nested, name, depth + 1, callback, user))
+			return false;
+	}
+
+	return true;
+}
+
+
+// ************************************************************************************************************************************
+int NutEnumFunctions( NutScriptHandle script, NutFunctionCallback callback, void* user )
+{
+	if (!script || !callback)
+		return Fail(NUT_ERROR, "Invalid argument.");
+
+	try
+	{
+		t_LastError.clear();
+		EnumFunctions(script->script.GetMain(), std::string(), 0, callback, user);
+		return NUT_OK;
+	}
+	catch( std::exception& ex )
+	{
+		return Fail(NUT_ERROR, ex.what());
+	}
+	catch(...)
+	{
+		return Fail(NUT_ERROR, "Unknown error.");
+	}
+}
+
+
+// ************************************************************************************************************************************
+const char* NutGetLastError( void )
+{
+	return t_LastError.c_str();
+}
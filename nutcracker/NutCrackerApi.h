@@ -0,0 +1,64 @@
+#pragma once
+#include <stddef.h>
+
+// ************************************************************************************************************************************
+// C interface of decompiler library. Context holds locale settings and worker threads, scripts are loaded from memory
+// into a context and must be freed before it. Different scripts may be used on different threads at once, one script
+// handle only by one thread at a time. Functions returning int return NUT_OK or negative NUT_ERROR_* code, message of
+// last error on calling thread is returned by NutGetLastError.
+
+#if defined(NUTCRACKER_DLL)
+#define NUTCRACKER_API __declspec(dllexport)
+#elif defined(NUTCRACKER_DLL_IMPORT)
+#define NUTCRACKER_API __declspec(dllimport)
+#else
+#define NUTCRACKER_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct NutContext* NutContextHandle;
+typedef struct NutScriptObject* NutScriptHandle;
+
+#define NUT_OK							0
+#define NUT_ERROR						-1		// Bad arguments or failed decompilation, see NutGetLastError
+#define NUT_ERROR_BUFFER_TOO_SMALL		-2		// *requiredSize tells size needed with terminating zero
+#define NUT_ERROR_NOT_FOUND				-3		// No function of given name
+
+// Called for every function of script in order of definition, nested functions right after their parent. Name is
+// qualified with names of parents ("outer::inner", unnamed functions by index) and may be passed to NutDecompile.
+// Nonzero return stops enumeration.
+typedef int (*NutFunctionCallback)( const char* qualifiedName, int depth, size_t instructionCount, void* user );
+
+// Locale name as for setlocale, NULL for classic "C" locale. Zero threads means one per CPU. Returns NULL on failure.
+NUTCRACKER_API NutContextHandle NutCreateContext( const char* localeName, size_t threads );
+NUTCRACKER_API void NutDestroyContext( NutContextHandle context );
+
+// Budget of decompilation of single function, zero is unlimited - function that runs out of it is written as commented
+// disassembly. Must not be called while scripts of context are decompiled.
+NUTCRACKER_API int NutSetBudget( NutContextHandle context, size_t instructions, size_t milliseconds );
+
+// Parses binary .nut file from memory, data is not used after the call. Returns NULL on failure.
+NUTCRACKER_API NutScriptHandle NutLoadScript( NutContextHandle context, const void* data, size_t size );
+NUTCRACKER_API void NutFreeScript( NutScriptHandle script );
+
+// Writes UTF-8 source with terminating zero to buffer - whole script when functionName is NULL, otherwise given
+// function. With too small buffer (or NULL) only *requiredSize is set; text is kept, so that repeated call with
+// large enough buffer does not decompile again.
+NUTCRACKER_API int NutDecompile( NutScriptHandle script, const char* functionName, char* buffer, size_t bufferSize, size_t* requiredSize );
+
+// Sets *equal to 1 when scripts have same functions, literals and code, to 0 otherwise. With requiredSize the differences
+// are described to report buffer (sizes as for NutDecompile, *equal is set also when buffer is too small), without it
+// comparison stops at first difference. Scripts must be loaded in the same context.
+NUTCRACKER_API int NutCompare( NutScriptHandle first, NutScriptHandle second, int* equal, char* report, size_t reportSize, size_t* requiredSize );
+
+NUTCRACKER_API int NutEnumFunctions( NutScriptHandle script, NutFunctionCallback callback, void* user );
+
+// Message of last failed call on this thread, empty if none
+NUTCRACKER_API const char* NutGetLastError( void );
+
+#ifdef __cplusplus
+}
+#endif
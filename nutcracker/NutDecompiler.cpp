@@ -1,11 +1,16 @@
 ﻿#include "stdafx.h"
-#include <unordered_map>
+#include <utility>
+#include <array>
 
 #include "NutScript.h"
 #include "Formatters.h"
 #include "Expressions.h"
 #include "Statements.h"
 #include "BlockState.h"
+#include "RegisterLiveness.h"
+#include "OpcodeScanner.h"
+#include "FunctionPrerender.h"
+#include <chrono>
 using namespace std;
 const char* OpcodeNames[] = 
 {
@@ -106,6 +111,34 @@ ExpressionPtr ToTemporaryVariable( ExpressionPtr exp )
 }
 
 
+// ***************************************************************************************************************
+// Nested blocks (conditions, loops, switch, try...catch) are not decompiled by recursion. Every block is resumable
+// frame on VMState work stack, that decompiles one statement per step and pushes frames of inner blocks, so depth
+// of script nesting is not limited by native stack size.
+class VMState;
+
+class NutFunction::DecompileFrame
+{
+protected:
+	const NutFunction& m_Function;
+	const std::vector<Instruction>& m_Instructions;
+
+public:
+	explicit DecompileFrame( const NutFunction& function )
+	: m_Function(function)
+	, m_Instructions(function.m_Instructions)
+	{
+	}
+
+	virtual ~DecompileFrame()
+	{
+	}
+
+	// Decompiles next part of block, returns false when block is finished and frame can be dropped
+	virtual bool Step( VMState& state ) = 0;
+};
+
+
 // ***************************************************************************************************************
 class VMState
 {
@@ -118,7 +151,6 @@ public:
 	typedef shared_ptr< std::vector<StackElement> > StackCopyPtr;
 	struct DoWhileBlockInfo
 	{
-		int beginPos;
 		std::vector<int> endPos;
 	};
 	struct Block
@@ -133,12 +165,36 @@ private:
 
 	BlockStatementPtr m_Block;
 	std::vector<StackElement> m_Stack;
-	std::unordered_map<int, DoWhileBlockInfo> m_doWhileInfos;
+	std::vector<DoWhileBlockInfo> m_doWhileInfos;		// Pending do...while loops by begin instruction
+	RegisterLiveness m_Liveness;
+	std::vector< std::unique_ptr<NutFunction::DecompileFrame> > m_Frames;
+
+	// Printing of body, with streaming finished top level statements are printed while decompilation goes on
+	TextWriter* m_Out;
+	int m_OutIndent;
+	bool m_Streaming;
+	int m_StreamedIP;					// Instructions before it are printed
+	StatementPtr m_HeldStatement;		// Last printed statement - following while loop may still turn it into for loop
+	TextWriter::Mark m_HeldMark;		// Output position before held statement, or before body if there is none
+	BlockStatement::ContentState m_HeldState;		// Content state before held statement
+	BlockStatement::ContentState m_StreamState;
+
+	// Budget of function, see DecompileContext::SetBudget
+	size_t m_Decompiled;
+	std::chrono::steady_clock::time_point m_Start;
+
 public:
 	BlockState m_BlockState;
 
 	VMState( const NutFunction& parent, int stackSize )
 	: m_Parent(parent)
+	, m_Liveness(parent)
+	, m_Out(NULL)
+	, m_OutIndent(0)
+	, m_Streaming(false)
+	, m_StreamedIP(0)
+	, m_Decompiled(0)
+	, m_Start(std::chrono::steady_clock::now())
 	{
 		m_Stack.resize(stackSize);
 		m_IP = 0;
@@ -147,66 +203,89 @@ public:
 		m_BlockState.blockEnd = parent.m_Instructions.size() + 2;
 
 		PreprocessDoWhileInfo();
+		m_Liveness.Analyze();
+
+		// Set initial stack elements to local identifiers
+		for(vector<NutFunction::LocalVarInfo>::const_reverse_iterator i = parent.m_Locals.rbegin(); i != parent.m_Locals.rend(); ++i)
+			if (i->start_op == 0 && !i->foreachLoopState)
+				AtStack(i->pos) = ExpressionPtr(new LocalVariableExpression(i->name));
 	}
 
 	void PreprocessDoWhileInfo()
 	{
-		for (int ip = 1; ip < (int)m_Parent.m_Instructions.size(); ++ip)
+		const int count = (int)m_Parent.m_Instructions.size();
+		const unsigned char* opcodes = m_Parent.m_Opcodes.data();
+		const int* offsets = m_Parent.m_JumpOffsets.data();
+
+		m_doWhileInfos.resize(count);
+
+		// Loop condition is OP_JZ or OP_JCMP that skips backward OP_JMP to loop beginning
+		std::vector<int> backJumps, events;
+		FindBackwardJumps(opcodes, offsets, count, OP_JMP, backJumps);
+
+		for (auto it = backJumps.begin(); it != backJumps.end(); ++it)
 		{
+			const int ip = *it;
 			const int whilePos = ip - 1;
-			const NutFunction::Instruction& prevInst = m_Parent.m_Instructions[whilePos];
-			if ((prevInst.op == OP_JCMP || prevInst.op == OP_JZ) && prevInst.arg1 == 1)
+			if (whilePos >= 0 && (opcodes[whilePos] == OP_JCMP || opcodes[whilePos] == OP_JZ) && offsets[whilePos] == 1)
 			{
-				const NutFunction::Instruction& curInst = m_Parent.m_Instructions[ip];
-				if (curInst.op == OP_JMP && curInst.arg1 < 0)
-				{
-					int endPos = ip;
-					int beginPos = endPos + curInst.arg1;
-					// must jump before the OP_JZ or OP_JCMP
-					if (beginPos >= whilePos)
-						continue;
-
-					DoWhileBlockInfo& info = m_doWhileInfos[beginPos];
-					info.beginPos = beginPos;
-					info.endPos.push_back(endPos);
-				}
+				int endPos = ip;
+				int beginPos = endPos + offsets[ip];
+				// must jump before the OP_JZ or OP_JCMP
+				if (beginPos >= whilePos || beginPos < 0)
+					continue;
+
+				m_doWhileInfos[beginPos].endPos.push_back(endPos);
+				events.push_back(beginPos);
 			}
 		}
 
+		// Nesting of loops changes only at loop beginnings and OP_JCMP / OP_FOREACH blocks
+		FindOpcodes(opcodes, count, OpcodeBit(OP_JCMP) | OpcodeBit(OP_FOREACH), events);
+		std::sort(events.begin(), events.end());
+		events.erase(std::unique(events.begin(), events.end()), events.end());
+
 		std::vector<Block> blocks;
-		for (int ip = 0; ip < (int)m_Parent.m_Instructions.size(); ++ip)
+		int ip = 0;
+		for (auto it = events.begin(); it != events.end(); ++it)
 		{
+			// Instructions between events only leave finished blocks - one block per instruction
+			while (!blocks.empty())
+			{
+				ip = std::max(ip, blocks.back().end + 1);
+				if (ip >= *it)
+					break;
+
+				blocks.pop_back();
+				ip += 1;
+			}
+
+			ip = *it;
+
 			if (!blocks.empty() && ip > blocks.back().end)
 				blocks.pop_back();
 
-			auto iter = m_doWhileInfos.find(ip);
-			if (iter != m_doWhileInfos.end())
-			{
-				std::vector<int>& poslist = iter->second.endPos;
-				for (auto itpos = poslist.rbegin(); itpos != poslist.rend(); ++itpos)
-					blocks.emplace_back(Block{ ip, *itpos });
-			}
+			const std::vector<int>& poslist = m_doWhileInfos[ip].endPos;
+			for (auto itpos = poslist.rbegin(); itpos != poslist.rend(); ++itpos)
+				blocks.emplace_back(Block{ ip, *itpos });
 
-			const NutFunction::Instruction& curInst = m_Parent.m_Instructions[ip];
-			if (curInst.op == OP_JCMP || curInst.op == OP_FOREACH)
+			if (opcodes[ip] == OP_JCMP || opcodes[ip] == OP_FOREACH)
 			{
-				int destIP = ip + curInst.arg1;
+				int destIP = ip + offsets[ip];
 				while (!blocks.empty() && destIP > blocks.back().end)
 				{
 					PopDoWhileBlock(blocks.back());
 					blocks.pop_back();
 				}
 			}
+
+			ip += 1;
 		}
 	}
 
 	void PopDoWhileBlock(Block block)
 	{
-		auto iter = m_doWhileInfos.find(block.begin);
-		if (iter == m_doWhileInfos.end())
-			return;
-
-		std::vector<int>& poslist = iter->second.endPos;
+		std::vector<int>& poslist = m_doWhileInfos[block.begin].endPos;
 		for (auto itPos = poslist.begin(); itPos != poslist.end(); ++itPos)
 		{
 			if (*itPos == block.end)
@@ -215,24 +294,34 @@ public:
 				break;
 			}
 		}
-		if (poslist.empty())
-			m_doWhileInfos.erase(iter);
 	}
 
 	int PopDoWhileEndPos(int ip)
 	{
-		auto iter = m_doWhileInfos.find(ip);
-		if (iter == m_doWhileInfos.end())
+		if (ip >= (int)m_doWhileInfos.size() || m_doWhileInfos[ip].endPos.empty())
 			return -1;
 
-		std::vector<int>& poslist = iter->second.endPos;
+		std::vector<int>& poslist = m_doWhileInfos[ip].endPos;
 		int endpos = poslist.back();
 		poslist.pop_back();
-		if (poslist.empty())
-			m_doWhileInfos.erase(iter);
 		return endpos;
 	}
 
+	// Counts instruction against budget, throws BudgetError when budget runs out
+	void ChargeInstruction( void )
+	{
+		const DecompileContext& context = m_Parent.GetContext();
+		m_Decompiled += 1;
+
+		if (context.GetInstructionBudget() != 0 && m_Decompiled > context.GetInstructionBudget())
+			throw BudgetError("Exceeded budget of " + std::to_string(context.GetInstructionBudget()) + " instructions.");
+
+		// Clock is read once per 256 instructions
+		if (context.GetTimeBudget() != 0 && (m_Decompiled & 0xFF) == 0 &&
+			std::chrono::steady_clock::now() - m_Start > std::chrono::milliseconds(context.GetTimeBudget()))
+			throw BudgetError("Exceeded budget of " + std::to_string(context.GetTimeBudget()) + " ms.");
+	}
+
 	void NextInstruction( void )
 	{
 		// Search for local variables that expires at previously finished instruction
@@ -254,6 +343,21 @@ public:
 		return m_IP >= (int)m_Parent.m_Instructions.size();
 	}
 
+	void PushFrame( NutFunction::DecompileFrame* frame )
+	{
+		m_Frames.push_back(std::unique_ptr<NutFunction::DecompileFrame>(frame));
+	}
+
+	// Decompiler loop - steps innermost block until work stack is empty
+	void RunFrames( void )
+	{
+		while(!m_Frames.empty())
+		{
+			if (!m_Frames.back()->Step(*this))
+				m_Frames.pop_back();
+		}
+	}
+
 	BlockStatementPtr PushBlock( void )
 	{
 		BlockStatementPtr prevBlock = m_Block;
@@ -311,8 +415,10 @@ public:
 		if (!m_Stack[pos].expression)
 		{
 			// Stack variable is not initialized - temporary make marker for it
-			return ExpressionPtr(new VariableExpression(
-				LStrBuilder("$[stack offset %1]").arg(pos)));
+			static constexpr LStrPattern markerPattern("$[stack offset %1]");
+			LString name;
+			LStrFormat(name, markerPattern).arg(pos);
+			return ExpressionPtr(new VariableExpression(name));
 		}
 		else if (!m_Stack[pos].pendingStatements.empty())
 		{
@@ -410,7 +516,9 @@ public:
 				ExpressionStatementPtr statement = ExpressionStatementPtr(new ExpressionStatement(exp));
 				PushStatement(statement);
 
-				m_Stack[pos].pendingStatements.push_back(statement);
+				// Temporary that is never read afterwards stays a plain statement - no need to track it
+				if (m_Liveness.IsLiveAt(m_IP, pos))
+					m_Stack[pos].pendingStatements.push_back(statement);
 			}
 			else
 			{
@@ -480,10 +588,139 @@ public:
 		}
 	}
 
-	void PrintOutput( std::wostream& out, int n )
+	// Top level statements will be printed to out as soon as they are final instead of at the end
+	// Body is printed straight to out, which is marked so that failure can take printed text back
+	void BeginOutput( TextWriter& out, int n, bool streaming )
+	{
+		m_Out = &out;
+		m_OutIndent = n;
+		m_Streaming = streaming;
+		m_HeldMark = out.SetMark();
+	}
+
+	// Statements of top level block are final when no block is open, no pending statement may be cleared and
+	// no live temporary (table or class being filled) may still be modified by following instructions
+	bool AtSafePoint( void ) const
+	{
+		if (m_Frames.size() != 1)
+			return false;
+
+		for(size_t pos = 0; pos < m_Stack.size(); ++pos)
+		{
+			const StackElement& element = m_Stack[pos];
+
+			if (!element.pendingStatements.empty())
+				return false;
+
+			if (element.expression && element.expression->GetType() != Exp_LocalVariable && m_Liveness.IsLiveAt(m_IP, (int)pos))
+				return false;
+		}
+
+		return true;
+	}
+
+	// Postprocess and print finished top level statements, does the same as BlockStatement::Postprocess piecewise.
+	// Output stays marked before held statement until next call, so that failure can go back to m_StreamedIP.
+	void EmitFinishedStatements( void )
+	{
+		TextWriter& out = *m_Out;
+		std::vector<StatementPtr>& statements = m_Block->Statements();
+
+		StatementPtr held = m_HeldStatement;
+		TextWriter::Mark heldMark = m_HeldMark;
+		BlockStatement::ContentState heldState = m_HeldState;
+		BlockStatement::ContentState state = m_StreamState;
+
+		for( vector<StatementPtr>::iterator i = statements.begin(); i != statements.end(); ++i)
+		{
+			StatementPtr statement = (*i)->Postprocess();
+
+			if (statement->GetType() == Stat_While && held)
+			{
+				StatementPtr forStatement = static_pointer_cast<WhileStatement>(statement)->TryGenerateForStatement(held);
+				if (forStatement)
+				{
+					held = forStatement;
+					state = heldState;
+					out.Rollback(heldMark);
+					BlockStatement::GenerateContentStatement(out, m_OutIndent, held, state);
+					continue;
+				}
+			}
+
+			if (statement->IsEmpty())
+				continue;
+
+			if (heldMark.id != m_HeldMark.id)
+				out.ReleaseMark(heldMark);
+
+			held = statement;
+			heldState = state;
+			heldMark = out.SetMark();
+			BlockStatement::GenerateContentStatement(out, m_OutIndent, held, state);
+		}
+
+		if (heldMark.id != m_HeldMark.id)
+		{
+			out.ReleaseMark(m_HeldMark);
+			m_HeldMark = heldMark;
+		}
+
+		m_HeldStatement = held;
+		m_HeldState = heldState;
+		m_StreamState = state;
+		m_StreamedIP = m_IP;
+		statements.clear();
+	}
+
+	// Ends printing, returns first instruction that is not printed. After failure output goes back to state of
+	// last EmitFinishedStatements - held statement is printed again in case it was turned into for loop since.
+	int FinishOutput( bool failed )
+	{
+		if (!m_Out)
+			return 0;
+
+		if (failed)
+		{
+			m_Out->Rollback(m_HeldMark);
+
+			BlockStatement::ContentState state = m_HeldState;
+			if (m_HeldStatement)
+				BlockStatement::GenerateContentStatement(*m_Out, m_OutIndent, m_HeldStatement, state);
+		}
+
+		m_Out->ReleaseMark(m_HeldMark);
+		m_Out = NULL;
+		m_HeldStatement = StatementPtr();
+		return m_StreamedIP;
+	}
+
+	void StreamFinishedStatements( void )
+	{
+		if (m_Streaming && !m_Block->Statements().empty() && AtSafePoint())
+			EmitFinishedStatements();
+	}
+
+	// Final top level statements, used instead of printing
+	void TakeOutput( std::vector<StatementPtr>& statements )
 	{
 		m_Block->Postprocess();
-		m_Block->GenerateBlockContentCode(out, n);
+		statements.swap(m_Block->Statements());
+	}
+
+	void PrintOutput( void )
+	{
+		if (m_Streaming)
+		{
+			EmitFinishedStatements();
+		}
+		else
+		{
+			m_Block->Postprocess();
+			m_Block->GenerateBlockContentCode(*m_Out, m_OutIndent);
+		}
+
+		FinishOutput(false);
 	}
 
 	int IP( void ) const
@@ -498,9 +735,8 @@ public:
 
 	void PushUnknownOpcode( void )
 	{
-		std::wstringstream buff;
-		m_Parent.PrintOpcode(buff, IP() - 1, m_Parent.m_Instructions[IP() - 1]);
-		PushStatement(StatementPtr(new CommentStatement(buff.str())));
+		// Opcode text is printed only when comment is generated
+		PushStatement(StatementPtr(new CommentStatement(m_Parent, IP() - 1)));
 	}
 };
 
@@ -526,23 +762,15 @@ public:
 		m_Defaults.push_back(value);
 	}
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	virtual void GenerateFunctionCode( TextWriter& out, int n ) const
 	{
-		if (g_DebugMode)
+		if (m_Function.GetContext().IsDebugMode())
 		{
 			out << "$[function #" << m_FunctionIndex << "]";
 			return;
 		}
-		
-		std::vector< LString > defaults;
-		for( std::vector<ExpressionPtr>::const_iterator i = m_Defaults.begin(); i != m_Defaults.end(); ++i)
-		{
-			std::wstringstream defaultBuffer;
-			(*i)->GenerateCode(defaultBuffer, n + 1);
-			defaults.emplace_back(defaultBuffer.str());
-		}
 
-		m_Function.GenerateFunctionSource(n, out, m_name, defaults);
+		m_Function.GenerateFunctionSource(n, out, m_name, m_Defaults);
 	}
 };
 
@@ -550,593 +778,1377 @@ public:
 
 // ***************************************************************************************************************
 // ***************************************************************************************************************
-void NutFunction::DecompileStatement( VMState& state ) const
+class NutFunction::FunctionBodyFrame : public NutFunction::DecompileFrame
 {
-	int doWhileEnd = state.PopDoWhileEndPos(state.IP());
-	if (doWhileEnd > -1)
+public:
+	explicit FunctionBodyFrame( const NutFunction& function )
+	: DecompileFrame(function)
 	{
-		// Found start of do...while loop
-		DecompileDoWhileLoop(state, doWhileEnd);
-		return;
 	}
 
-	const Instruction& op = m_Instructions[state.IP()];
-	int code = op.op;
-	int arg0 = static_cast<unsigned char>(op.arg0);
-	int arg1 = op.arg1;
-	int arg2 = static_cast<unsigned char>(op.arg2);
-	int arg3 = static_cast<unsigned char>(op.arg3);
-
-	state.NextInstruction();
-	
-	switch(code)
+	virtual bool Step( VMState& state )
 	{
-		case OP_LOAD:
-			state.SetVar(arg0, ExpressionPtr(new ConstantExpression(m_Literals[arg1])));
-			break;
+		state.StreamFinishedStatements();
 
-		case OP_LOADINT:
-			state.SetVar(arg0, ExpressionPtr(new ConstantExpression(static_cast<unsigned int>(arg1))));
-			break;
+		if (state.EndOfInstructions())
+			return false;
 
-		case OP_LOADFLOAT:
-			state.SetVar(arg0, ExpressionPtr(new ConstantExpression( *((float*)&arg1) )));
-			break;
+		if (m_Instructions[state.IP()].op == OP_RETURN && (state.IP() == m_Instructions.size() - 1) && m_Instructions[state.IP()].arg0 == -1)
+		{
+			// This is last return statement in function - can be skipped
+			state.NextInstruction();
+			return true;
+		}
 
-		case OP_DLOAD:
-			state.SetVar(arg0, ExpressionPtr(new ConstantExpression(m_Literals[arg1])));
-			state.SetVar(arg2, ExpressionPtr(new ConstantExpression(m_Literals[arg3])));
-			break;
+		m_Function.DecompileStatement(state);
+		return true;
+	}
+};
 
-		case OP_TAILCALL:
-		case OP_CALL:
-			{
-				shared_ptr<FunctionCallExpression> exp = shared_ptr<FunctionCallExpression>(new FunctionCallExpression(state.GetVar(arg1)));
-				for(int i = 1; i < arg3; ++i)
-					exp->AddArgument(state.GetVar(arg2 + i));
 
-				state.SetVar(arg0, exp, true);
-			}
-			break;
+// ***************************************************************************************************************
+class NutFunction::LogicalOperatorFrame : public NutFunction::DecompileFrame
+{
+private:
+	int m_Code;
+	int m_Arg0;
+	int m_DestIp;
+	ExpressionPtr m_LeftArg;
 
-		case OP_PREPCALL:
-		case OP_PREPCALLK:
-			{
-				ExpressionPtr key, obj;
+public:
+	LogicalOperatorFrame( const NutFunction& function, VMState& state, int code, int arg0, int arg1, int arg2 )
+	: DecompileFrame(function)
+	, m_Code(code)
+	, m_Arg0(arg0)
+	{
+		m_LeftArg = state.GetVar(arg2);
+		m_DestIp = state.IP() + arg1;
+	}
 
-				if (code == OP_PREPCALLK)
-					key = ExpressionPtr(new ConstantExpression(m_Literals[arg1]));
-				else
-					key = state.GetVar(arg1);
+	virtual bool Step( VMState& state )
+	{
+		if (state.IP() < m_DestIp && !state.EndOfInstructions())
+		{
+			if (state.IP() == (m_DestIp - 1) && m_Instructions[state.IP()].op == OP_MOVE &&  static_cast<unsigned char>(m_Instructions[state.IP()].arg0) == m_Arg0)
+			{
+				// Last move instruction of block - make simple move instead of variable set - that will be done later by logic operator
+				state.NextInstruction();
+				state.AtStack(m_Arg0) = ToTemporaryVariable(state.GetVar(m_Instructions[state.IP() - 1].arg1));
+			}
+			else
+			{
+				m_Function.DecompileStatement(state);
+			}
 
-				obj = state.GetVar(arg2);
+			return true;
+		}
 
-				ExpressionPtr objAccess = ExpressionPtr(new ArrayIndexingExpression(obj, key));
+		ExpressionPtr opExpr = ExpressionPtr(new BinaryOperatorExpression((m_Code == OP_OR) ? '||' : '&&', m_LeftArg, state.GetVar(m_Arg0)));
+		state.SetVar(m_Arg0, opExpr);
+		return false;
+	}
+};
 
-				state.AtStack(arg3) = ExpressionPtr();
-				state.AtStack(arg0) = objAccess;
-			}
-			break;
 
-		case OP_GETK:
-			state.SetVar(arg0, ExpressionPtr(new ArrayIndexingExpression(state.GetVar(arg2), ExpressionPtr(new ConstantExpression(m_Literals[arg1])))));
-			break;
+// ***************************************************************************************************************
+class NutFunction::ForeachFrame : public NutFunction::DecompileFrame
+{
+private:
+	ExpressionPtr m_ObjectExp;
+	ExpressionPtr m_KeyExp;
+	ExpressionPtr m_ValueExp;
 
-		case OP_MOVE:
-			state.SetVar(arg0,  state.GetVar(arg1));
-			break;
+	BlockStatementPtr m_Block;
+	BlockState m_PrevBlockState;
+	int m_LoopEndIp;
 
-		// *** OP_NEWSLOT moved down
+public:
+	ForeachFrame( const NutFunction& function, VMState& state, int arg0, int arg1, int arg2 )
+	: DecompileFrame(function)
+	{
+		// Initialize local variables that will be state of foreac loop
+		state.InitVar(arg2,  ExpressionPtr(), true);
+		state.InitVar(arg2 + 1,  ExpressionPtr(), true);
+		state.InitVar(arg2 + 2,  ExpressionPtr(), true);
 
-		case OP_DELETE:
-			{
-				ExpressionPtr derefExpr = ExpressionPtr(new ArrayIndexingExpression(state.GetVar(arg1), state.GetVar(arg2)));
-				ExpressionPtr deleteExpt = ExpressionPtr(new UnaryOperatorExpression(OperatorExpression::OPER_DELETE, derefExpr));
-				state.SetVar(arg0, deleteExpt, true);
-			}
-			break;
+		m_ObjectExp = state.GetVar(arg0);
+		m_KeyExp = state.GetVar(arg2);
+		m_ValueExp = state.GetVar(arg2 + 1);
+		state.GetVar(arg2 + 2);		// Iteration reference is not part of statement, only resolve its pending statements
 
+		m_Block = state.PushBlock();
 
-		case OP_SET:
-			{
-				ExpressionPtr leftArg = ExpressionPtr(new ArrayIndexingExpression(state.GetVar(arg1), state.GetVar(arg2)));
-				ExpressionPtr assignExpr = ExpressionPtr(new BinaryOperatorExpression('=', leftArg, state.GetVar(arg3)));
+		// While block found - push loop block
+		m_PrevBlockState = state.m_BlockState;
+		state.m_BlockState.inLoop = BlockState::ForeachLoop;
+		state.m_BlockState.inSwitch = 0;
+		state.m_BlockState.blockStart = state.IP() - 1;
+		state.m_BlockState.blockEnd = state.IP() + arg1 - 1;
+		state.m_BlockState.parent = &m_PrevBlockState;
 
-				if (arg0 != arg3)
-					state.SetVar(arg0, assignExpr, true);
-				else
-					state.PushStatement(StatementPtr(new ExpressionStatement(assignExpr)));
-			}
-			break;
-		
-		case OP_GET:
-			state.SetVar(arg0, ExpressionPtr(new ArrayIndexingExpression(state.GetVar(arg1), state.GetVar(arg2))));
-			break;
+		m_LoopEndIp = state.IP() + arg1;
+	}
 
-		case OP_EQ:
-		case OP_NE:
+	virtual bool Step( VMState& state )
+	{
+		// Decompile loop block
+		if (!state.EndOfInstructions() && state.IP() < m_LoopEndIp)
+		{
+			if (state.IP() == (m_LoopEndIp - 1) && m_Instructions[state.IP()].op == OP_JMP && m_Instructions[state.IP()].arg1 < 1)
 			{
-				ExpressionPtr right = (arg3 != 0) ? ExpressionPtr(new ConstantExpression(m_Literals[arg1])) : state.GetVar(arg1);
-				ExpressionPtr op = ExpressionPtr(new BinaryOperatorExpression((code == OP_NE) ? '!=' : '==', state.GetVar(arg2), right));
-				state.SetVar(arg0, op);
+				// Skip loop ending JMP
+				state.NextInstruction();
 			}
-			break;
-
-// 		case OP_ARITH:
-// 			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression(arg3, state.GetVar(arg2), state.GetVar(arg1))));
-// 			break;
-
-		case OP_BITW:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression(BitWiseOpcodeNames[arg3], state.GetVar(arg2), state.GetVar(arg1))));
-			break;
-
-		case OP_RETURN:
-			if (arg0 == 0xff)
-				state.PushStatement(StatementPtr(new ReturnStatement));
 			else
-				state.PushStatement(StatementPtr(new ReturnStatement(state.GetVar(arg1))));
-
-			break;
-
-		case OP_LOADNULLS:
 			{
-				ExpressionPtr nullExpr = ExpressionPtr(new NullExpression);
-
-				for(int i = 0; i < arg1; ++i)
-					state.SetVar(arg0 + i, nullExpr);
+				m_Function.DecompileStatement(state);
 			}
-			break;
 
-		case OP_LOADROOT:
-			state.SetVar(arg0, ExpressionPtr(new RootTableExpression));
-			break;
+			return true;
+		}
 
-		case OP_LOADBOOL:
-			state.SetVar(arg0, ExpressionPtr(new LiteralConstantExpression( (arg1 != 0) ? "true" : "false" )));
-			break;
+		LoopBaseStatementPtr stat = LoopBaseStatementPtr(new ForeachStatement(m_KeyExp, m_ValueExp, m_ObjectExp, state.PopBlock(m_Block)));
+		stat->SetLoopBlock(state.m_BlockState);
 
-		case OP_DMOVE:
-			state.SetVar(arg0,  state.GetVar(arg1));
-			state.SetVar(arg2,  state.GetVar(arg3));
-			break;
+		// Pop block state
+		state.m_BlockState = m_PrevBlockState;
 
-		case OP_JMP:
-			DecompileJumpInstruction(state, arg1);
-			break;
+		state.PushStatement(stat);
+		return false;
+	}
+};
 
-		// *** OP_JNZ should not be matched - processed in do...while decompilation
 
-		case OP_JCMP:
-			DecompileJCMP(state, arg0, arg1, arg2, arg3);
-			break;
+// ***************************************************************************************************************
+class NutFunction::TryCatchFrame : public NutFunction::DecompileFrame
+{
+private:
+	int m_Arg0;
+	bool m_InCatch;
+	int m_DestIp;
+	LString m_VarName;
 
-		case OP_JZ:
-			DecompileJumpZeroInstruction(state, arg0, arg1);
-			break;
+	BlockStatementPtr m_Block;
+	BlockStatementPtr m_TryBlock;
 
-		case OP_SETOUTER:
+	bool BeginCatch( VMState& state )
+	{
+		if (state.EndOfInstructions() || m_Instructions[state.IP()].op != OP_JMP)
 		{
-			ExpressionPtr leftArg = ExpressionPtr(new LocalVariableExpression(m_OuterValues[arg1].name.GetString()));
-			ExpressionPtr assignExpr = ExpressionPtr(new BinaryOperatorExpression('=', leftArg, state.GetVar(arg2)));
-
-			if (arg0 != 0xFF)
-				state.SetVar(arg0, assignExpr, true);
-			else
-				state.PushStatement(StatementPtr(new ExpressionStatement(assignExpr)));
-			break;
+			state.PopBlock(m_Block);
+			return false;
 		}
-		case OP_GETOUTER:
-			state.SetVar(arg0, ExpressionPtr(new LocalVariableExpression(m_OuterValues[arg1].name.GetString())));
-			break;
 
-// 		case OP_LOADFREEVAR:
-// 			state.SetVar(arg0, ExpressionPtr(new VariableExpression(m_OuterValues[arg1].name.GetString())));
-// 			break;
-// 
-// 		case OP_VARGC:
-// 			state.SetVar(arg0, ExpressionPtr(new LiteralConstantExpression( "vargc" )));
-// 			break;
-// 
-// 		case OP_GETVARGV:
-// 			state.SetVar(arg0, ExpressionPtr(new ArrayIndexingExpression(ExpressionPtr(new LiteralConstantExpression( "vargv" )),state.GetVar(arg1))));
-// 			break;
+		m_TryBlock = state.PushBlock();
 
-		case OP_APPENDARRAY:
-			DecompileAppendArray(state, arg0, arg1, (AppendArrayType)arg2, arg3);
-			break;
+		// second part - catch statement
+		int jump_arg1 = m_Instructions[state.IP()].arg1;
+		state.NextInstruction();
 
-// 		case OP_GETPARENT:
-// 			state.SetVar(arg0, ExpressionPtr(new ArrayIndexingExpression(state.GetVar(arg1), ExpressionPtr(new ConstantExpression("parent")))));
-// 			break;
-		
-		case OP_COMPARITH:
+		// Search for local variable of exception handler
+		state.AtStack(m_Arg0) =  ExpressionPtr();
+
+		for( vector<NutFunction::LocalVarInfo>::const_iterator i = m_Function.m_Locals.begin(); i != m_Function.m_Locals.end(); ++i )
+			if (i->pos == m_Arg0 && i->start_op == state.IP())
 			{
-				ExpressionPtr leftArg = ExpressionPtr(new ArrayIndexingExpression(state.GetVar( ((unsigned int)arg1) >> 16 ), state.GetVar(arg2)));
-				ExpressionPtr opExp = ExpressionPtr(new BinaryOperatorExpression((arg3 << 8) | '=', leftArg,  state.GetVar( 0x0000ffff & arg1 )));
-				state.SetVar(arg0, opExp, true);
-			}
-			break;
+				state.AtStack(m_Arg0) = ExpressionPtr(new LocalVariableExpression(i->name));
+				m_VarName = i->name;
+				break;
+			};
 
+		m_DestIp = state.IP() + jump_arg1;
+		m_InCatch = true;
+		return true;
+	}
 
+public:
+	TryCatchFrame( const NutFunction& function, VMState& state, int arg0 )
+	: DecompileFrame(function)
+	, m_Arg0(arg0)
+	, m_InCatch(false)
+	, m_DestIp(0)
+	{
+		m_Block = state.PushBlock();
+	}
 
-// 		case OP_COMPARITHL:
-// 			{
-// 				ExpressionPtr opExp = ExpressionPtr(new BinaryOperatorExpression((arg3 << 8) | '=', state.GetVar(arg1), state.GetVar(arg2)));
-// 				state.SetVar(arg0, opExp, true);
-// 			}
-// 			break;
-			
-		case OP_INC:
-		case OP_INCL:
+	virtual bool Step( VMState& state )
+	{
+		if (!m_InCatch)
+		{
+			if (!state.EndOfInstructions())
 			{
-				ExpressionPtr arg;
-				if (code == OP_INC)
-					arg = ExpressionPtr(new ArrayIndexingExpression(state.GetVar(arg1), state.GetVar(arg2)));
-				else
-					arg = state.GetVar(arg1);
+				if (m_Instructions[state.IP()].op != OP_POPTRAP)
+				{
+					m_Function.DecompileStatement(state);
+					return true;
+				}
 
-				ExpressionPtr exp;
-				if (op.arg3 > 0)
-					exp = ExpressionPtr(new UnaryOperatorExpression('++', arg));
-				else
-					exp = ExpressionPtr(new UnaryOperatorExpression('--', arg));
-				
-				state.SetVar(arg0, exp, true);
+				state.NextInstruction();
 			}
-			break;
-
-		case OP_PINC:
-		case OP_PINCL:
-			{
-				ExpressionPtr arg;
-				if (code == OP_PINC)
-					arg = ExpressionPtr(new ArrayIndexingExpression(state.GetVar(arg1), state.GetVar(arg2)));
-				else
-					arg = state.GetVar(arg1);
 
-				ExpressionPtr exp;
-				if (op.arg3 > 0)
-					exp = ExpressionPtr(new UnaryPostfixOperatorExpression('++', arg));
-				else
-					exp = ExpressionPtr(new UnaryPostfixOperatorExpression('--', arg));
-				
-				state.SetVar(arg0, exp, true);
-			}
-			break;
+			return BeginCatch(state);
+		}
 
-		case OP_CMP:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression(ComparisionOpcodeNames[arg3], state.GetVar(arg2), state.GetVar(arg1))));
-			break;
+		if (state.IP() < m_DestIp && !state.EndOfInstructions())
+		{
+			m_Function.DecompileStatement(state);
+			return true;
+		}
 
-		case OP_EXISTS:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression('in', state.GetVar(arg2), state.GetVar(arg1))));
-			break;
+		BlockStatementPtr catchBlock = state.PopBlock(m_Block);
 
-		case OP_INSTANCEOF:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression(OperatorExpression::OPER_INSTANCEOF, state.GetVar(arg2), state.GetVar(arg1))));
-			break;
+		state.PushStatement(StatementPtr(new TryCatchStatement(m_TryBlock, catchBlock, m_VarName)));
+		return false;
+	}
+};
+
+
+// ***************************************************************************************************************
+class NutFunction::WhileLoopFrame : public NutFunction::DecompileFrame
+{
+private:
+	ExpressionPtr m_Condition;
+	int m_DestIp;
+
+	BlockStatementPtr m_Block;
+	BlockState m_PrevBlockState;
+
+public:
+	WhileLoopFrame( const NutFunction& function, VMState& state, ExpressionPtr condition, int destIp, int blockStart )
+	: DecompileFrame(function)
+	, m_Condition(condition)
+	, m_DestIp(destIp)
+	{
+		// While block found - push loop block
+		m_PrevBlockState = state.m_BlockState;
+		state.m_BlockState.inLoop = BlockState::WhileLoop;
+		state.m_BlockState.inSwitch = 0;
+		state.m_BlockState.blockStart = blockStart;
+		state.m_BlockState.blockEnd = destIp - 1;
+		state.m_BlockState.parent = &m_PrevBlockState;
+
+		m_Block = state.PushBlock();
+	}
+
+	virtual bool Step( VMState& state )
+	{
+		if (state.IP() < m_DestIp && !state.EndOfInstructions())
+		{
+			assert(state.IP() < m_PrevBlockState.blockEnd);
+			if (state.IP() == (m_DestIp - 1) && m_Instructions[state.IP()].op == OP_JMP && m_Instructions[state.IP()].arg1 < 0)
+			{
+				// Skip loop jump
+				state.NextInstruction();
+			}
+			else
+			{
+				m_Function.DecompileStatement(state);
+			}
+
+			return true;
+		}
+
+		LoopBaseStatementPtr stat = LoopBaseStatementPtr(new WhileStatement(m_Condition, state.PopBlock(m_Block)));
+		stat->SetLoopBlock(state.m_BlockState);
+		state.PushStatement(stat);
+
+		// Pop block state
+		state.m_BlockState = m_PrevBlockState;
+		return false;
+	}
+};
+
+
+// ***************************************************************************************************************
+class NutFunction::IfElseFrame : public NutFunction::DecompileFrame
+{
+private:
+	ExpressionPtr m_Condition;
+	int m_IfBlockEndIp;
+	int m_ElseBlockEndIp;
+	bool m_GotElseBlock;
+	bool m_ElseMatched;
+	bool m_InElse;
+
+	BlockStatementPtr m_Block;
+	BlockStatementPtr m_IfBlock;
+	VMState::StackCopyPtr m_StackCopy;
+	BlockState m_PrevBlockState;
+
+public:
+	IfElseFrame( const NutFunction& function, VMState& state, ExpressionPtr condition, int arg1, int destIp )
+	: DecompileFrame(function)
+	, m_Condition(condition)
+	, m_IfBlockEndIp(destIp)
+	, m_ElseBlockEndIp(0)
+	, m_GotElseBlock(false)
+	, m_ElseMatched(false)
+	, m_InElse(false)
+	{
+		m_Block = state.PushBlock();
+
+		if ((arg1 > 0) && (m_Instructions[m_IfBlockEndIp - 1].op == OP_JMP) && (m_Instructions[m_IfBlockEndIp - 1].arg1 >= 0))
+		{
+			// Last instruction of if block is unconditional forward jump - potentially else block
+			m_ElseBlockEndIp = m_IfBlockEndIp + m_Instructions[m_IfBlockEndIp - 1].arg1;
+
+			// Check if this jump fits into current loop, otherwise it is break statement
+			if (m_ElseBlockEndIp <= state.m_BlockState.blockEnd)
+			{
+				m_GotElseBlock = true;
+				m_StackCopy = state.CloneStack();
+			}
+		}
+		
+		m_PrevBlockState = state.m_BlockState;
+		state.m_BlockState.inLoop = 0;
+		state.m_BlockState.inSwitch = 0;
+		state.m_BlockState.blockStart = state.IP();
+		state.m_BlockState.blockEnd = m_IfBlockEndIp;
+		state.m_BlockState.parent = &m_PrevBlockState;
+	}
+
+	virtual bool Step( VMState& state )
+	{
+		if (!m_InElse)
+		{
+			// Parse if block instructions
+			if (state.IP() < m_IfBlockEndIp && !state.EndOfInstructions())
+			{
+				assert(state.IP() < m_PrevBlockState.blockEnd);
+				if (m_GotElseBlock && m_Instructions[state.IP()].op == OP_JMP && state.IP() == (m_IfBlockEndIp - 1))
+				{
+					// Skip else block jump
+					state.NextInstruction();
+					m_ElseMatched = true;
+				}
+				else
+				{
+					m_Function.DecompileStatement(state);
+				}
+
+				return true;
+			}
+
+			if (!m_ElseMatched)
+				m_GotElseBlock = false;
+
+			if (m_GotElseBlock)
+			{
+				// Else block parsing
+				state.m_BlockState.blockStart = state.IP();
+				state.m_BlockState.blockEnd = m_ElseBlockEndIp;
+
+				m_IfBlock = state.PushBlock();
+				state.SwapStacks(m_StackCopy);
+
+				m_InElse = true;
+				return true;
+			}
+
+			state.m_BlockState = m_PrevBlockState;
+
+			m_IfBlock = state.PopBlock(m_Block);
+			state.PushStatement(StatementPtr(new IfStatement(m_Condition, m_IfBlock, StatementPtr())));
+			return false;
+		}
+
+		if (state.IP() < m_ElseBlockEndIp && !state.EndOfInstructions())
+		{
+			assert(state.IP() < m_PrevBlockState.blockEnd);
+			m_Function.DecompileStatement(state);
+			return true;
+		}
+
+		BlockStatementPtr elseBlock = state.PopBlock(m_Block);
+		state.m_BlockState = m_PrevBlockState;
+		
+		StatementPtr ifStatement = StatementPtr(new IfStatement(m_Condition, m_IfBlock, elseBlock));
+
+		if (m_IfBlockEndIp > 2 && m_Instructions[m_IfBlockEndIp - 2].op != OP_JZ && m_Instructions[m_ElseBlockEndIp - 1].op != OP_JMP)
+		{
+			int target1 = static_cast<unsigned char>(m_Instructions[m_IfBlockEndIp - 2].arg0);
+			int target2 = static_cast<unsigned char>(m_Instructions[m_ElseBlockEndIp - 1].arg0);
+
+			if ((target1 == target2) && (target1 < m_Function.m_StackSize) && state.AtStack(target1) && (state.AtStack(target1)->GetType() != Exp_LocalVariable) &&
+				m_StackCopy->at(target1).expression && m_StackCopy->at(target1).expression->GetType() != Exp_LocalVariable)
+			{
+				// Block match condition operator - try to merge destination stack variables
+				state.MergeStackVariable(m_Condition, target1, m_StackCopy->at(target1), ifStatement);
+			}
+		}
+
+		state.PushStatement(ifStatement);
+		return false;
+	}
+};
+
+
+// ***************************************************************************************************************
+class NutFunction::DoWhileFrame : public NutFunction::DecompileFrame
+{
+private:
+	int m_EndPos;
+	ExpressionPtr m_Condition;
+
+	BlockStatementPtr m_Block;
+	BlockState m_PrevBlockState;
+
+public:
+	DoWhileFrame( const NutFunction& function, VMState& state, int endPos )
+	: DecompileFrame(function)
+	, m_EndPos(endPos)
+	{
+		m_PrevBlockState = state.m_BlockState;
+		state.m_BlockState.inLoop = BlockState::DoWhileLoop;
+		state.m_BlockState.inSwitch = 0;
+		state.m_BlockState.blockStart = state.IP();
+		state.m_BlockState.blockEnd = endPos;
+		state.m_BlockState.parent = &m_PrevBlockState;
+
+		m_Block = state.PushBlock();
+	}
+
+	virtual bool Step( VMState& state )
+	{
+		if (state.IP() < m_EndPos + 1 && !state.EndOfInstructions())
+		{
+			assert(state.IP() <= m_PrevBlockState.blockEnd);
+			if (state.IP() == m_EndPos - 1 )
+			{
+				const Instruction& inst = m_Instructions[state.IP()];
+				if (inst.op == OP_JCMP)
+				{
+					unsigned char condVar = static_cast<unsigned char>(inst.arg0);
+					unsigned char iterVar = static_cast<unsigned char>(inst.arg2);
+					unsigned char cmpOp = static_cast<unsigned char>(inst.arg3);
+
+					ExpressionPtr iterExp = state.GetVar(iterVar);
+					m_Condition = ExpressionPtr(new BinaryOperatorExpression(ComparisionOpcodeNames[cmpOp], iterExp, state.GetVar(condVar)));
+				}
+				else if (inst.op == OP_JZ)
+				{
+					m_Condition = state.GetVar(inst.arg0);
+				}
+				// skip while instruction
+				state.NextInstruction();
+				state.NextInstruction();
+			}
+			else
+			{
+				m_Function.DecompileStatement(state);
+			}
+
+			return true;
+		}
+
+		LoopBaseStatementPtr stat;
+		if (m_Condition != nullptr)
+		{
+			stat = LoopBaseStatementPtr(new DoWhileStatement(m_Condition, state.PopBlock(m_Block)));
+		}
+		else
+		{
+			stat = LoopBaseStatementPtr(new ForStatement(nullptr, nullptr, nullptr, state.PopBlock(m_Block)));
+			state.PushStatement(StatementPtr(new CommentStatement(L"This is a incorrect loop analysis")));
+		}
+
+		stat->SetLoopBlock(state.m_BlockState);
+		state.PushStatement(stat);
+
+		// Pop block state
+		state.m_BlockState = m_PrevBlockState;
+		return false;
+	}
+};
+
+
+// ***************************************************************************************************************
+// Block guarded by OP_JCMP - for loop when block ends with backward jump, if...else statement otherwise
+class NutFunction::CmpJumpFrame : public NutFunction::DecompileFrame
+{
+private:
+	ExpressionPtr m_Condition;
+	bool m_CanBreak;
+	int m_DestIp;
+	bool m_HasEndingJump;
+	int m_ElseEnd;
+	bool m_InElse;
+
+	BlockStatementPtr m_Block;
+	BlockStatementPtr m_IfBlock;
+	VMState::StackCopyPtr m_StackCopy;
+	BlockState m_PrevBlockState;
+
+	bool Finish( VMState& state, BlockStatementPtr elseStat )
+	{
+		StatementPtr ifStatement = StatementPtr(new IfStatement(m_Condition, m_IfBlock, elseStat));
+
+		// Pop block state
+		state.m_BlockState = m_PrevBlockState;
+
+		if (elseStat != nullptr)
+		{
+			int ifBlockEndIp = m_DestIp;
+			int elseBlockEndIp = m_ElseEnd;
+			if (ifBlockEndIp > 2 && m_Instructions[ifBlockEndIp - 2].op != OP_JZ && m_Instructions[elseBlockEndIp - 1].op != OP_JMP)
+			{
+				int target1 = static_cast<unsigned char>(m_Instructions[ifBlockEndIp - 2].arg0);
+				int target2 = static_cast<unsigned char>(m_Instructions[elseBlockEndIp - 1].arg0);
+
+				if ((target1 == target2) && (target1 < m_Function.m_StackSize) && state.AtStack(target1) && (state.AtStack(target1)->GetType() != Exp_LocalVariable) &&
+					m_StackCopy->at(target1).expression && m_StackCopy->at(target1).expression->GetType() != Exp_LocalVariable)
+				{
+					// Block match condition operator - try to merge destination stack variables
+					state.MergeStackVariable(m_Condition, target1, m_StackCopy->at(target1), ifStatement);
+				}
+			}
+		}
+
+		state.PushStatement(ifStatement);
+		return false;
+	}
+
+public:
+	CmpJumpFrame( const NutFunction& function, VMState& state, ExpressionPtr condition, bool canBreak, int destIp )
+	: DecompileFrame(function)
+	, m_Condition(condition)
+	, m_CanBreak(canBreak)
+	, m_DestIp(destIp)
+	, m_HasEndingJump(false)
+	, m_ElseEnd(0)
+	, m_InElse(false)
+	{
+		m_Block = state.PushBlock();
+
+		// While block found - push loop block
+		m_PrevBlockState = state.m_BlockState;
+		state.m_BlockState.inLoop = BlockState::CmpForLoop;
+		state.m_BlockState.inSwitch = 0;
+		state.m_BlockState.blockStart = state.IP() - 1;
+		state.m_BlockState.blockEnd = destIp;
+		state.m_BlockState.parent = &m_PrevBlockState;
+
+		m_StackCopy = state.CloneStack();
+	}
+
+	virtual bool Step( VMState& state )
+	{
+		if (m_InElse)
+		{
+			if (!state.EndOfInstructions() && state.IP() < m_ElseEnd)
+			{
+				assert(state.IP() < m_PrevBlockState.blockEnd);
+				m_Function.DecompileStatement(state);
+				return true;
+			}
+
+			return Finish(state, state.PopBlock(m_Block));
+		}
+
+		// Decompile loop block
+		if (!state.EndOfInstructions() && state.IP() < m_DestIp)
+		{
+			assert(state.IP() < m_PrevBlockState.blockEnd);
+			if (state.IP() == (m_DestIp - 1) && m_Instructions[state.IP()].op == OP_JMP)
+			{
+				// Skip loop ending JMP
+				int jmpOffset = m_Instructions[state.IP()].arg1;
+				state.NextInstruction();
+
+				if (jmpOffset < 1)
+				{
+					m_HasEndingJump = true;
+				}
+				else
+				{
+					m_ElseEnd = state.IP() + jmpOffset;
+					if (m_CanBreak && m_ElseEnd > m_PrevBlockState.blockEnd)
+						state.PushStatement(StatementPtr(new BreakStatement()));
+				}
+			}
+			else
+			{
+				m_Function.DecompileStatement(state);
+			}
+
+			return true;
+		}
+
+		if (m_HasEndingJump)
+		{
+			LoopBaseStatementPtr stat = LoopBaseStatementPtr(new ForStatement(nullptr, m_Condition, nullptr, state.PopBlock(m_Block)));
+			stat->SetLoopBlock(state.m_BlockState);
+
+			// Pop block state
+			state.m_BlockState = m_PrevBlockState;
+
+			state.PushStatement(stat);
+			return false;
+		}
+
+		// may be if-else
+		state.m_BlockState.inLoop = 0;
+
+		m_IfBlock = state.PopBlock(m_Block);
+		if (m_ElseEnd > state.IP() && m_ElseEnd <= m_PrevBlockState.blockEnd)
+		{
+			state.m_BlockState.blockStart = state.IP();
+			state.m_BlockState.blockEnd = m_ElseEnd;
+
+			m_Block = state.PushBlock();
+			state.SwapStacks(m_StackCopy);
+
+			m_InElse = true;
+			return true;
+		}
+
+		return Finish(state, nullptr);
+	}
+};
+
+
+// ***************************************************************************************************************
+class NutFunction::SwitchFrame : public NutFunction::DecompileFrame
+{
+private:
+	enum Phase
+	{
+		CaseBody,			// Instructions of case block
+		CaseCondition,		// Expression evaluated before next case condition
+		DefaultBody,		// Instructions of default block
+	};
+
+	Phase m_Phase;
+	ExpressionPtr m_SwitchVariable;		// Switch statement source variable expression
+	ExpressionPtr m_Condition;
+	int m_CurrentBlockEnd;
+	int m_NextBlockStart;
+
+	BlockStatementPtr m_Block;
+	BlockState m_PrevBlockState;
+	BlockState m_OutCaseBlock;
+
+	void BeginCase( VMState& state )
+	{
+		ExpressionPtr caseValue;
+
+		if (m_Condition->GetType() == Exp_Operator)
+		{
+			shared_ptr<OperatorExpression> operatorExpression = static_pointer_cast<OperatorExpression>(m_Condition);
+			if (operatorExpression->GetOperatorType() == '==')
+			{
+				shared_ptr<BinaryOperatorExpression> comparisionOperator = static_pointer_cast<BinaryOperatorExpression>(m_Condition);
+				
+				if (!m_SwitchVariable)
+					m_SwitchVariable = comparisionOperator->GetArg1();
+
+				caseValue = comparisionOperator->GetArg2();
+			}
+		}
+
+		// Push start of current block
+		state.PushStatement(StatementPtr(new CaseStatement(caseValue)));
+
+		// Create fake blok for case part
+		m_OutCaseBlock = state.m_BlockState;
+		state.m_BlockState.inLoop = 0;
+		state.m_BlockState.inSwitch = 0;
+		state.m_BlockState.blockStart = state.IP();
+		state.m_BlockState.blockEnd = m_CurrentBlockEnd;
+		state.m_BlockState.parent = &m_OutCaseBlock;
+
+		m_NextBlockStart = -1;
+		m_Phase = CaseBody;
+	}
+
+	bool BeginDefault( VMState& state )
+	{
+		if (state.IP() < state.m_BlockState.blockEnd)
+		{
+			// Parse default part
+			state.PushStatement(StatementPtr(new CaseStatement(ExpressionPtr())));
+			m_Phase = DefaultBody;
+			return true;
+		}
+
+		return Finish(state);
+	}
+
+	bool Finish( VMState& state )
+	{
+		state.m_BlockState = m_PrevBlockState;
+		BlockStatementPtr switchBlock = state.PopBlock(m_Block);
+
+		state.PushStatement(StatementPtr(new SwitchStatement(m_SwitchVariable, switchBlock)));	
+		return false;
+	}
+
+public:
+	// Frame is created after parsing OP_JZ instruction and detecting switch chain patter - previous instructin should be JZ
+	SwitchFrame( const NutFunction& function, VMState& state )
+	: DecompileFrame(function)
+	{
+		assert(state.IP() > 0 && m_Instructions[state.IP() - 1].op == OP_JZ);
+
+		// Initially scan trough switch chain to find switch block size (without default part)
+		int pos = state.IP() - 1;
+		for(;;)
+		{
+			if (pos <= state.m_BlockState.blockEnd && m_Instructions[pos].op == OP_JZ && m_Instructions[pos].arg1 > 0)
+			{
+				pos += m_Instructions[pos].arg1;
+				
+				if (pos <= state.m_BlockState.blockEnd && m_Instructions[pos].op == OP_JMP && m_Instructions[pos].arg1 > 0)
+				{
+					pos += m_Instructions[pos].arg1;
+					continue;
+				}
+			}
+
+			break;
+		}
+
+		// Move out of last instruction 
+		pos += 1;
+
+		// Check for common last break in switch block and eventually include it into
+		// switch block
+		if (pos < (int)m_Instructions.size() && m_Instructions[pos].op == OP_JMP && m_Instructions[pos].arg1 == 0)
+			pos += 1;
+
+		m_PrevBlockState = state.m_BlockState;
+		state.m_BlockState.inLoop = 0;
+		state.m_BlockState.inSwitch = 1;
+		state.m_BlockState.blockStart = state.IP() - 1;		// Not precise, but it is not important in case of switch
+		state.m_BlockState.blockEnd = pos;					// Not includes default block, but will be corrected on break statement
+		state.m_BlockState.parent = &m_PrevBlockState;
+
+		// Prepare switch block
+		m_Block = state.PushBlock();
+
+		m_Condition = state.GetVar(m_Instructions[state.IP() - 1].arg0);
+		m_CurrentBlockEnd = state.IP() + m_Instructions[state.IP() - 1].arg1;
+
+		BeginCase(state);
+	}
+
+	virtual bool Step( VMState& state )
+	{
+		switch(m_Phase)
+		{
+			case CaseBody:
+				// Parse current block
+				if (!state.EndOfInstructions() && state.IP() < m_CurrentBlockEnd)
+				{
+					if (state.IP() == (m_CurrentBlockEnd - 1) && m_Instructions[state.IP()].op == OP_JMP && m_Instructions[state.IP()].arg1 > 0 && (state.IP() + m_Instructions[state.IP()].arg1 + 1 < m_OutCaseBlock.blockEnd))
+					{
+						// Last forward jump of block - element of switch chain
+						if (m_Instructions[state.IP()].arg1 > 0)
+							m_NextBlockStart = state.IP() + 1 + m_Instructions[state.IP()].arg1;
+
+						state.NextInstruction();
+					}
+					else
+					{
+						m_Function.DecompileStatement(state);
+					}
+
+					return true;
+				}
+
+				state.m_BlockState = m_OutCaseBlock;
+
+				if (m_NextBlockStart > state.IP() && m_Instructions[m_NextBlockStart - 1].op == OP_JZ && m_Instructions[m_NextBlockStart - 1].arg1 >= 0)
+				{
+					m_Phase = CaseCondition;
+					return true;
+				}
+
+				return BeginDefault(state);
+
+			case CaseCondition:
+				// Parse expression till next case condition
+				if (!state.EndOfInstructions() && state.IP() < (m_NextBlockStart - 1))
+				{
+					m_Function.DecompileStatement(state);
+					return true;
+				}
+				
+				if (state.IP() == (m_NextBlockStart - 1))
+				{
+					// Parse next case condition
+					m_Condition = state.GetVar(m_Instructions[state.IP()].arg0);
+					m_CurrentBlockEnd = state.IP() + 1 + m_Instructions[state.IP()].arg1;
+					state.NextInstruction();
+
+					// Continue switch parsing
+					BeginCase(state);
+					return true;
+				}
+
+				return BeginDefault(state);
+
+			case DefaultBody:
+				if (!state.EndOfInstructions() && state.IP() < state.m_BlockState.blockEnd)
+				{
+					m_Function.DecompileStatement(state);
+					return true;
+				}
+
+				return Finish(state);
+		}
+
+		return false;
+	}
+};
+
+
+
+// ***************************************************************************************************************
+// ***************************************************************************************************************
+// Instruction arguments decoded once, before dispatch to opcode handler
+struct NutFunction::DecodedInstruction
+{
+	const Instruction& op;
+	int code;
+	int arg0;
+	int arg1;
+	int arg2;
+	int arg3;
+};
+
+
+// Opcodes that translate directly to binary operator expression: arg0 = arg2 <operator> arg1
+constexpr int BinaryOpcodeOperator( int code )
+{
+	return	(code == OP_ADD) ? '+' :
+			(code == OP_SUB) ? '-' :
+			(code == OP_MUL) ? '*' :
+			(code == OP_DIV) ? '/' :
+			(code == OP_MOD) ? '%' :
+			(code == OP_EXISTS) ? 'in' :
+			(code == OP_INSTANCEOF) ? OperatorExpression::OPER_INSTANCEOF :
+			0;
+}
+
+// Opcodes that translate directly to unary operator expression: arg0 = <operator> arg1
+constexpr int UnaryOpcodeOperator( int code )
+{
+	return	(code == OP_NEG) ? '-' :
+			(code == OP_NOT) ? '!' :
+			(code == OP_BWNOT) ? '~' :
+			(code == OP_RESUME) ? OperatorExpression::OPER_RESUME :
+			(code == OP_CLONE) ? OperatorExpression::OPER_CLONE :
+			(code == OP_TYPEOF) ? OperatorExpression::OPER_TYPEOF :
+			0;
+}
+
+
+// ***************************************************************************************************************
+// Generic handler of opcodes without own specialization - plain operators or opcodes unknown to decompiler
+template< int Code >
+void NutFunction::DecompileOpcode( VMState& state, const DecodedInstruction& ins ) const
+{
+	if (BinaryOpcodeOperator(Code) != 0)
+		state.SetVar(ins.arg0, ExpressionPtr(new BinaryOperatorExpression(BinaryOpcodeOperator(Code), state.GetVar(ins.arg2), state.GetVar(ins.arg1))));
+	else if (UnaryOpcodeOperator(Code) != 0)
+		state.SetVar(ins.arg0, ExpressionPtr(new UnaryOperatorExpression(UnaryOpcodeOperator(Code), state.GetVar(ins.arg1))));
+	else
+		DecompileUnknownOpcode(state, ins);
+}
+
+
+// ***************************************************************************************************************
+void NutFunction::DecompileUnknownOpcode( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.PushUnknownOpcode();
+
+	if (ins.arg0 < m_StackSize)
+		state.AtStack(ins.arg0) =  ExpressionPtr();
+}
+
+
+// ***************************************************************************************************************
+template<>
+void NutFunction::DecompileOpcode<OP_LINE>( VMState& state, const DecodedInstruction& ins ) const
+{
+	// mark line number
+	static constexpr LStrPattern linePattern("line %1");
+	if (m_Context->IsDebugMode())
+	{
+		LString text;
+		LStrFormat(text, linePattern).arg(ins.arg1);
+		state.PushStatement(StatementPtr(new CommentStatement(text)));
+	}
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_LOAD>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new ConstantExpression(m_LiteralTexts[ins.arg1])));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_LOADINT>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new ConstantExpression(static_cast<unsigned int>(ins.arg1))));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_LOADFLOAT>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new ConstantExpression(ins.op.arg1_float)));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_DLOAD>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new ConstantExpression(m_LiteralTexts[ins.arg1])));
+	state.SetVar(ins.arg2, ExpressionPtr(new ConstantExpression(m_LiteralTexts[ins.arg3])));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_CALL>( VMState& state, const DecodedInstruction& ins ) const
+{
+	shared_ptr<FunctionCallExpression> exp = shared_ptr<FunctionCallExpression>(new FunctionCallExpression(state.GetVar(ins.arg1)));
+	for(int i = 1; i < ins.arg3; ++i)
+		exp->AddArgument(state.GetVar(ins.arg2 + i));
+
+	state.SetVar(ins.arg0, exp, true);
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_TAILCALL>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileOpcode<OP_CALL>(state, ins);
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_PREPCALL>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr key, obj;
+
+	if (ins.code == OP_PREPCALLK)
+		key = ExpressionPtr(new ConstantExpression(m_LiteralTexts[ins.arg1]));
+	else
+		key = state.GetVar(ins.arg1);
+
+	obj = state.GetVar(ins.arg2);
+
+	ExpressionPtr objAccess = ExpressionPtr(new ArrayIndexingExpression(obj, key));
+
+	state.AtStack(ins.arg3) = ExpressionPtr();
+	state.AtStack(ins.arg0) = objAccess;
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_PREPCALLK>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileOpcode<OP_PREPCALL>(state, ins);
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_GETK>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new ArrayIndexingExpression(state.GetVar(ins.arg2), ExpressionPtr(new ConstantExpression(m_LiteralTexts[ins.arg1])))));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_MOVE>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0,  state.GetVar(ins.arg1));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_NEWSLOT>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr objExp = state.GetVar(ins.arg1);
+	ExpressionPtr keyExp = state.GetVar(ins.arg2);
+	ExpressionPtr valueExp = state.GetVar(ins.arg3);
+
+	if (objExp->GetType() == Exp_NewTableExpression)
+	{
+		static_pointer_cast<NewTableExpression>(objExp)->AddElement(keyExp, valueExp);
+		state.SetVar(ins.arg1, objExp);
+	}
+	else if (objExp->GetType() == Exp_NewClassExpression)
+	{
+		bool gotAttributes = (ins.arg0 & 0x01) != 0;
+		bool isStatic = (ins.arg0 & 0x02) != 0;
+
+		ExpressionPtr attributes;
+		if (gotAttributes)
+			attributes = state.GetVar(ins.arg2 - 1);
+
+		static_pointer_cast<NewClassExpression>(objExp)->AddElement(keyExp, valueExp, attributes, isStatic);
+		state.SetVar(ins.arg1, objExp);
+	}
+	else
+	{
+		shared_ptr<ArrayIndexingExpression> derefExp = shared_ptr<ArrayIndexingExpression>(new ArrayIndexingExpression(objExp, keyExp));
+		if (valueExp->GetType() == Exp_Function && derefExp->IsSimpleMemberDeref())
+		{
+			
+			if (objExp->GetType()==Exp_RootTable || objExp->GetType()==Exp_Operator)
+			{
+				//Exp_RootTable: for constructions like "::Variable <- function(...)"
+				//Exp_Operator : for ArrayIndexingExpressions representing "::variable1.variable2 <- function (...)"
+				ExpressionPtr slotExp = ExpressionPtr(new BinaryOperatorExpression('<-', derefExp, valueExp));
+				state.PushStatement(StatementPtr(new ExpressionStatement(slotExp)));
+			}
+			else
+			{
+				shared_ptr<FunctionExpression> funcExp = static_pointer_cast<FunctionExpression>(valueExp);
+				funcExp->SetName(derefExp->ToFunctionNameString());
+				state.PushStatement(StatementPtr(new ExpressionStatement(funcExp)));
+			}
+		}
+		else if (valueExp->GetType() == Exp_NewClassExpression && derefExp->IsSimpleMemberDeref())
+		{
+			shared_ptr<NewClassExpression> classExp = static_pointer_cast<NewClassExpression>(valueExp);
+			classExp->SetName(derefExp->ToString());
+			state.PushStatement(StatementPtr(new ExpressionStatement(classExp)));
+		}
+		else
+		{
+			ExpressionPtr slotExp = ExpressionPtr(new BinaryOperatorExpression('<-', derefExp, valueExp));
+			state.PushStatement(StatementPtr(new ExpressionStatement(slotExp)));
+		}
+	}
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_NEWSLOTA>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileOpcode<OP_NEWSLOT>(state, ins);
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_DELETE>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr derefExpr = ExpressionPtr(new ArrayIndexingExpression(state.GetVar(ins.arg1), state.GetVar(ins.arg2)));
+	ExpressionPtr deleteExpt = ExpressionPtr(new UnaryOperatorExpression(OperatorExpression::OPER_DELETE, derefExpr));
+	state.SetVar(ins.arg0, deleteExpt, true);
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_SET>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr leftArg = ExpressionPtr(new ArrayIndexingExpression(state.GetVar(ins.arg1), state.GetVar(ins.arg2)));
+	ExpressionPtr assignExpr = ExpressionPtr(new BinaryOperatorExpression('=', leftArg, state.GetVar(ins.arg3)));
+
+	if (ins.arg0 != ins.arg3)
+		state.SetVar(ins.arg0, assignExpr, true);
+	else
+		state.PushStatement(StatementPtr(new ExpressionStatement(assignExpr)));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_GET>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new ArrayIndexingExpression(state.GetVar(ins.arg1), state.GetVar(ins.arg2))));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_EQ>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr right = (ins.arg3 != 0) ? ExpressionPtr(new ConstantExpression(m_LiteralTexts[ins.arg1])) : state.GetVar(ins.arg1);
+	ExpressionPtr op = ExpressionPtr(new BinaryOperatorExpression((ins.code == OP_NE) ? '!=' : '==', state.GetVar(ins.arg2), right));
+	state.SetVar(ins.arg0, op);
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_NE>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileOpcode<OP_EQ>(state, ins);
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_BITW>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new BinaryOperatorExpression(BitWiseOpcodeNames[ins.arg3], state.GetVar(ins.arg2), state.GetVar(ins.arg1))));
+}
+
+template<>
+void NutFunction::DecompileOpcode<OP_RETURN>( VMState& state, const DecodedInstruction& ins ) const
+{
+	if (ins.arg0 == 0xff)
+		state.PushStatement(StatementPtr(new ReturnStatement));
+	else
+		state.PushStatement(StatementPtr(new ReturnStatement(state.GetVar(ins.arg1))));
+}
 
-		case OP_AND:
-		case OP_OR:
-			{
-				ExpressionPtr leftArg = state.GetVar(arg2);
+template<>
+void NutFunction::DecompileOpcode<OP_LOADNULLS>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr nullExpr = ExpressionPtr(new NullExpression);
 
-				int destIp = state.IP() + arg1;
-				while(state.IP() < destIp && !state.EndOfInstructions())
-				{
-					if (state.IP() == (destIp - 1) && m_Instructions[state.IP()].op == OP_MOVE &&  static_cast<unsigned char>(m_Instructions[state.IP()].arg0) == arg0)
-					{
-						// Last move instruction of block - make simple move instead of variable set - that will be done later by logic operator
-						state.NextInstruction();
-						state.AtStack(arg0) = ToTemporaryVariable(state.GetVar(m_Instructions[state.IP() - 1].arg1));
-					}
-					else
-					{
-						DecompileStatement(state);
-					}
-				}
+	for(int i = 0; i < ins.arg1; ++i)
+		state.SetVar(ins.arg0 + i, nullExpr);
+}
 
-				ExpressionPtr opExpr = ExpressionPtr(new BinaryOperatorExpression((code == OP_OR) ? '||' : '&&', leftArg, state.GetVar(arg0)));
-				state.SetVar(arg0, opExpr);
-			}
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_LOADROOT>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new RootTableExpression));
+}
 
-		case OP_NEG:
-			state.SetVar(arg0, ExpressionPtr(new UnaryOperatorExpression('-', state.GetVar(arg1))));
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_LOADBOOL>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new LiteralConstantExpression( (ins.arg1 != 0) ? "true" : "false" )));
+}
 
-		case OP_NOT:
-			state.SetVar(arg0, ExpressionPtr(new UnaryOperatorExpression('!', state.GetVar(arg1))));
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_DMOVE>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0,  state.GetVar(ins.arg1));
+	state.SetVar(ins.arg2,  state.GetVar(ins.arg3));
+}
 
-		case OP_BWNOT:
-			state.SetVar(arg0, ExpressionPtr(new UnaryOperatorExpression('~', state.GetVar(arg1))));
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_JMP>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileJumpInstruction(state, ins.arg1);
+}
 
-		case OP_CLOSURE:
-			{
-				shared_ptr<FunctionGeneratingExpression> func = shared_ptr<FunctionGeneratingExpression>(new FunctionGeneratingExpression(arg1, m_Functions[arg1]));
+template<>
+void NutFunction::DecompileOpcode<OP_JCMP>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileJCMP(state, ins.arg0, ins.arg1, ins.arg2, ins.arg3);
+}
 
-				for( vector<int>::const_iterator i = m_Functions[arg1].m_DefaultParams.begin(); i != m_Functions[arg1].m_DefaultParams.end(); ++i)
-					func->AddDefault(state.GetVar(*i));
+template<>
+void NutFunction::DecompileOpcode<OP_JZ>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileJumpZeroInstruction(state, ins.arg0, ins.arg1);
+}
 
-				state.SetVar(arg0, func);
-			}
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_SETOUTER>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr leftArg = ExpressionPtr(new LocalVariableExpression(m_OuterValues[ins.arg1].name.GetString()));
+	ExpressionPtr assignExpr = ExpressionPtr(new BinaryOperatorExpression('=', leftArg, state.GetVar(ins.arg2)));
 
-		case OP_YIELD:
-			state.PushStatement(StatementPtr(new YieldStatement(
-				(arg0 == 0xff) ? ExpressionPtr() : state.GetVar(arg1)
-			)));
-			break;
+	if (ins.arg0 != 0xFF)
+		state.SetVar(ins.arg0, assignExpr, true);
+	else
+		state.PushStatement(StatementPtr(new ExpressionStatement(assignExpr)));
+}
 
-		case OP_RESUME:
-			state.SetVar(arg0, ExpressionPtr(new UnaryOperatorExpression(OperatorExpression::OPER_RESUME, state.GetVar(arg1))));
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_GETOUTER>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new LocalVariableExpression(m_OuterValues[ins.arg1].name.GetString())));
+}
 
-		case OP_FOREACH:
-			{
-				// Initialize local variables that will be state of foreac loop
-				state.InitVar(arg2,  ExpressionPtr(), true);
-				state.InitVar(arg2 + 1,  ExpressionPtr(), true);
-				state.InitVar(arg2 + 2,  ExpressionPtr(), true);
-
-				ExpressionPtr objectExp = state.GetVar(arg0);
-				ExpressionPtr keyExp = state.GetVar(arg2);
-				ExpressionPtr valueExp = state.GetVar(arg2 + 1);
-				ExpressionPtr refExp = state.GetVar(arg2 + 2);
-
-				BlockStatementPtr block = state.PushBlock();
-
-				// While block found - push loop block
-				BlockState prevBlockState = state.m_BlockState;
-				state.m_BlockState.inLoop = BlockState::ForeachLoop;
-				state.m_BlockState.inSwitch = 0;
-				state.m_BlockState.blockStart = state.IP() - 1;
-				state.m_BlockState.blockEnd = state.IP() + arg1 - 1;
-				state.m_BlockState.parent = &prevBlockState;
-
-				int loopEndIp = state.IP() + arg1;
-
-				// Remove variables initialization used only for 
-				//while(!block->Statements().empty() && block->Statements().back()->GetType() == Stat_LocalVar)
-				//{
-				//	const shared_ptr<LocalVarInitStatement> var = static_pointer_cast<LocalVarInitStatement>(block->Statements().back());
-
-				//	if (
-				//		(refExp->GetType() == Exp_LocalVariable && var->GetStackAddress() == (arg2 + 2) && var->GetEndAddress() > state.IP() && var->GetEndAddress() < loopEndIp) ||
-				//		(valueExp->GetType() == Exp_LocalVariable && var->GetStackAddress() == (arg2 + 1) && var->GetEndAddress() > state.IP() && var->GetEndAddress() < loopEndIp) ||
-				//		(keyExp->GetType() == Exp_LocalVariable && var->GetStackAddress() == arg2 && var->GetEndAddress() >= state.IP() && var->GetEndAddress() < loopEndIp)
-				//	   )
-				//	{
-				//		// Last block statement is a variable initialization that is a state of foreach loop - remove it
-				//		block->Statements().pop_back();
-				//	}
-				//	else
-				//	{
-				//		break;
-				//	}
-				//}
-
-				// Decompile loop block
-				while(!state.EndOfInstructions() && state.IP() < loopEndIp)
-				{
-					if (state.IP() == (loopEndIp - 1) && m_Instructions[state.IP()].op == OP_JMP && m_Instructions[state.IP()].arg1 < 1)
-					{
-						// Skip loop ending JMP
-						state.NextInstruction();
-					}
-					else
-					{
-						DecompileStatement(state);
-					}
-				}
+template<>
+void NutFunction::DecompileOpcode<OP_NEWOBJ>( VMState& state, const DecodedInstruction& ins ) const
+{
+	enum NewObjType{ NOT_TABLE, NOT_ARRAY, NOT_CLASS };
+	switch (ins.arg3)
+	{
+	case NOT_TABLE:
+		state.SetVar(ins.arg0, ExpressionPtr(new NewTableExpression));
+		break;				
+	case NOT_ARRAY:
+		state.SetVar(ins.arg0, ExpressionPtr(new NewArrayExpression));
+		break;
+	case NOT_CLASS:
+	{
+		ExpressionPtr attributes;
+		ExpressionPtr baseClass;
 
-				LoopBaseStatementPtr stat = LoopBaseStatementPtr(new ForeachStatement(keyExp, valueExp, objectExp, state.PopBlock(block)));
-				stat->SetLoopBlock(state.m_BlockState);
+		if (ins.arg1 != -1)
+			baseClass = state.GetVar(ins.arg1);
 
-				// Pop block state
-				state.m_BlockState = prevBlockState;
+		if (ins.arg2 != 0xff)
+			attributes = state.GetVar(ins.arg2);
 
-				state.PushStatement(stat);
-			}
-			break;
+		state.SetVar(ins.arg0, ExpressionPtr(new NewClassExpression(baseClass, attributes)));
+		break;
+	}
+	default:
+		assert(0);
+		break;
+	}
+}
 
+template<>
+void NutFunction::DecompileOpcode<OP_APPENDARRAY>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileAppendArray(state, ins.arg0, ins.arg1, (AppendArrayType)ins.arg2, ins.arg3);
+}
 
-		case OP_POSTFOREACH:
-			// Ignore - used always after OP_FOREACH for generator iteration
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_COMPARITH>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr leftArg = ExpressionPtr(new ArrayIndexingExpression(state.GetVar( ((unsigned int)ins.arg1) >> 16 ), state.GetVar(ins.arg2)));
+	ExpressionPtr opExp = ExpressionPtr(new BinaryOperatorExpression((ins.arg3 << 8) | '=', leftArg,  state.GetVar( 0x0000ffff & ins.arg1 )));
+	state.SetVar(ins.arg0, opExp, true);
+}
 
-// 		case OP_DELEGATE:
-// 			state.SetVar(arg0, ExpressionPtr(new DelegateOperatorExpression(state.GetVar(arg2), state.GetVar(arg1))), true);
-// 			break;
-		
-		case OP_CLONE:
-			state.SetVar(arg0, ExpressionPtr(new UnaryOperatorExpression(OperatorExpression::OPER_CLONE, state.GetVar(arg1))));
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_INC>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr arg;
+	if (ins.code == OP_INC)
+		arg = ExpressionPtr(new ArrayIndexingExpression(state.GetVar(ins.arg1), state.GetVar(ins.arg2)));
+	else
+		arg = state.GetVar(ins.arg1);
 
+	ExpressionPtr exp;
+	if (ins.op.arg3 > 0)
+		exp = ExpressionPtr(new UnaryOperatorExpression('++', arg));
+	else
+		exp = ExpressionPtr(new UnaryOperatorExpression('--', arg));
+	
+	state.SetVar(ins.arg0, exp, true);
+}
 
-		case OP_TYPEOF:
-			state.SetVar(arg0, ExpressionPtr(new UnaryOperatorExpression(OperatorExpression::OPER_TYPEOF, state.GetVar(arg1))));
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_INCL>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileOpcode<OP_INC>(state, ins);
+}
 
-		case OP_PUSHTRAP:
-			{
-				// try catch statement
-				BlockStatementPtr block = state.PushBlock();
+template<>
+void NutFunction::DecompileOpcode<OP_PINC>( VMState& state, const DecodedInstruction& ins ) const
+{
+	ExpressionPtr arg;
+	if (ins.code == OP_PINC)
+		arg = ExpressionPtr(new ArrayIndexingExpression(state.GetVar(ins.arg1), state.GetVar(ins.arg2)));
+	else
+		arg = state.GetVar(ins.arg1);
 
-				while(!state.EndOfInstructions())
-				{
-					if (m_Instructions[state.IP()].op == OP_POPTRAP)
-					{
-						state.NextInstruction();
-						break;
-					}
+	ExpressionPtr exp;
+	if (ins.op.arg3 > 0)
+		exp = ExpressionPtr(new UnaryPostfixOperatorExpression('++', arg));
+	else
+		exp = ExpressionPtr(new UnaryPostfixOperatorExpression('--', arg));
+	
+	state.SetVar(ins.arg0, exp, true);
+}
 
-					DecompileStatement(state);
-				}
+template<>
+void NutFunction::DecompileOpcode<OP_PINCL>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileOpcode<OP_PINC>(state, ins);
+}
 
-				if (m_Instructions[state.IP()].op == OP_JMP)
-				{
-					BlockStatementPtr tryBlock = state.PushBlock();
+template<>
+void NutFunction::DecompileOpcode<OP_CMP>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.SetVar(ins.arg0, ExpressionPtr(new BinaryOperatorExpression(ComparisionOpcodeNames[ins.arg3], state.GetVar(ins.arg2), state.GetVar(ins.arg1))));
+}
 
-					// second part - catch statement
-					int jump_arg1 = m_Instructions[state.IP()].arg1;
-					state.NextInstruction();
+template<>
+void NutFunction::DecompileOpcode<OP_AND>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.PushFrame(new LogicalOperatorFrame(*this, state, ins.code, ins.arg0, ins.arg1, ins.arg2));
+}
 
-					// Search for local variable of exception handler
-					state.AtStack(arg0) =  ExpressionPtr();
-					LString varName;
-
-					for( vector<NutFunction::LocalVarInfo>::const_iterator i = m_Locals.begin(); i != m_Locals.end(); ++i )
-						if (i->pos == arg0 && i->start_op == state.IP())
-						{
-							state.AtStack(arg0) = ExpressionPtr(new LocalVariableExpression(i->name));
-							varName = i->name;
-							break;
-						};
-		
-					int destIp = state.IP() + jump_arg1;
-					while(state.IP() < destIp && !state.EndOfInstructions())
-					{
-						DecompileStatement(state);
-					}
+template<>
+void NutFunction::DecompileOpcode<OP_OR>( VMState& state, const DecodedInstruction& ins ) const
+{
+	DecompileOpcode<OP_AND>(state, ins);
+}
 
-					BlockStatementPtr catchBlock = state.PopBlock(block);
+template<>
+void NutFunction::DecompileOpcode<OP_CLOSURE>( VMState& state, const DecodedInstruction& ins ) const
+{
+	shared_ptr<FunctionGeneratingExpression> func = shared_ptr<FunctionGeneratingExpression>(new FunctionGeneratingExpression(ins.arg1, m_Functions[ins.arg1]));
 
-					state.PushStatement(StatementPtr(new TryCatchStatement(tryBlock, catchBlock, varName)));
-				}
-				else
-				{
-					state.PopBlock(block);
-				}
-			}
-			break;
+	for( vector<int>::const_iterator i = m_Functions[ins.arg1].m_DefaultParams.begin(); i != m_Functions[ins.arg1].m_DefaultParams.end(); ++i)
+		func->AddDefault(state.GetVar(*i));
 
+	state.SetVar(ins.arg0, func);
+}
 
-		// *** OP_POPTRAP case unspecified, used when parsing try...catch in OP_PUSHTRAP
-		
-		case OP_THROW:
-			state.PushStatement(StatementPtr(new ThrowStatement(state.GetVar(arg0))));
-			break;
+template<>
+void NutFunction::DecompileOpcode<OP_YIELD>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.PushStatement(StatementPtr(new YieldStatement(
+		(ins.arg0 == 0xff) ? ExpressionPtr() : state.GetVar(ins.arg1)
+	)));
+}
 
-		case OP_NEWOBJ:
-			enum NewObjType{ NOT_TABLE, NOT_ARRAY, NOT_CLASS };
-			switch (arg3)
-			{
-			case NOT_TABLE:
-				state.SetVar(arg0, ExpressionPtr(new NewTableExpression));
-				break;				
-			case NOT_ARRAY:
-				state.SetVar(arg0, ExpressionPtr(new NewArrayExpression));
-				break;
-			case NOT_CLASS:
-			{
-				ExpressionPtr attributes;
-				ExpressionPtr baseClass;
+template<>
+void NutFunction::DecompileOpcode<OP_FOREACH>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.PushFrame(new ForeachFrame(*this, state, ins.arg0, ins.arg1, ins.arg2));
+}
 
-				if (arg1 != -1)
-					baseClass = state.GetVar(arg1);
+template<>
+void NutFunction::DecompileOpcode<OP_POSTFOREACH>( VMState&, const DecodedInstruction& ) const
+{
+	// Ignore - used always after OP_FOREACH for generator iteration
+}
 
-				if (arg2 != 0xff)
-					attributes = state.GetVar(arg2);
+template<>
+void NutFunction::DecompileOpcode<OP_PUSHTRAP>( VMState& state, const DecodedInstruction& ins ) const
+{
+	// try catch statement, OP_POPTRAP is matched by the frame
+	state.PushFrame(new TryCatchFrame(*this, state, ins.arg0));
+}
 
-				state.SetVar(arg0, ExpressionPtr(new NewClassExpression(baseClass, attributes)));
-				break;
-			}
-			default:
-				assert(0);
-				break;
-			}
-			break;
-		case OP_NEWSLOTA:
-		case OP_NEWSLOT:
-			{
-				ExpressionPtr objExp = state.GetVar(arg1);
-				ExpressionPtr keyExp = state.GetVar(arg2);
-				ExpressionPtr valueExp = state.GetVar(arg3);
+template<>
+void NutFunction::DecompileOpcode<OP_THROW>( VMState& state, const DecodedInstruction& ins ) const
+{
+	state.PushStatement(StatementPtr(new ThrowStatement(state.GetVar(ins.arg0))));
+}
 
-				if (objExp->GetType() == Exp_NewTableExpression)
-				{
-					static_pointer_cast<NewTableExpression>(objExp)->AddElement(keyExp, valueExp);
-					state.SetVar(arg1, objExp);
-				}
-				else if (objExp->GetType() == Exp_NewClassExpression)
-				{
-					bool gotAttributes = (arg0 & 0x01) != 0;
-					bool isStatic = (arg0 & 0x02) != 0;
 
-					ExpressionPtr attributes;
-					if (gotAttributes)
-						attributes = state.GetVar(arg2 - 1);
+// ***************************************************************************************************************
+// Dense dispatch table over all 256 opcode values - opcodes without specialization get generic handler,
+// so support for opcodes of modified compilers is added by single specialization of DecompileOpcode.
+struct NutFunction::OpcodeDispatch
+{
+	typedef void (NutFunction::*Handler)( VMState& state, const DecodedInstruction& ins ) const;
+	typedef std::array<Handler, 0x100> HandlerTable;
 
-					static_pointer_cast<NewClassExpression>(objExp)->AddElement(keyExp, valueExp, attributes, isStatic);
-					state.SetVar(arg1, objExp);
-				}
-				else
-				{
-					shared_ptr<ArrayIndexingExpression> derefExp = shared_ptr<ArrayIndexingExpression>(new ArrayIndexingExpression(objExp, keyExp));
-					if (valueExp->GetType() == Exp_Function && derefExp->IsSimpleMemberDeref())
-					{
-						
-						if (objExp->GetType()==Exp_RootTable || objExp->GetType()==Exp_Operator)
-						{
-							//Exp_RootTable: for constructions like "::Variable <- function(...)"
-							//Exp_Operator : for ArrayIndexingExpressions representing "::variable1.variable2 <- function (...)"
-							ExpressionPtr slotExp = ExpressionPtr(new BinaryOperatorExpression('<-', derefExp, valueExp));
-							state.PushStatement(StatementPtr(new ExpressionStatement(slotExp)));
-						}
-						else
-						{
-							shared_ptr<FunctionExpression> funcExp = static_pointer_cast<FunctionExpression>(valueExp);
-							funcExp->SetName(derefExp->ToFunctionNameString());
-							state.PushStatement(StatementPtr(new ExpressionStatement(funcExp)));
-						}
-					}
-					else if (valueExp->GetType() == Exp_NewClassExpression && derefExp->IsSimpleMemberDeref())
-					{
-						shared_ptr<NewClassExpression> classExp = static_pointer_cast<NewClassExpression>(valueExp);
-						classExp->SetName(derefExp->ToString());
-						state.PushStatement(StatementPtr(new ExpressionStatement(classExp)));
-					}
-					else
-					{
-						ExpressionPtr slotExp = ExpressionPtr(new BinaryOperatorExpression('<-', derefExp, valueExp));
-						state.PushStatement(StatementPtr(new ExpressionStatement(slotExp)));
-					}
-				}
-			}
-			break;
-		case OP_ADD:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression('+', state.GetVar(arg2), state.GetVar(arg1))));
-			break;
-		case OP_SUB:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression('-', state.GetVar(arg2), state.GetVar(arg1))));
-			break;
-		case OP_MUL:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression('*', state.GetVar(arg2), state.GetVar(arg1))));
-			break;
-		case OP_DIV:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression('/', state.GetVar(arg2), state.GetVar(arg1))));
-			break;
-		case OP_MOD:
-			state.SetVar(arg0, ExpressionPtr(new BinaryOperatorExpression('%', state.GetVar(arg2), state.GetVar(arg1))));
-			break;
-		case OP_LINE:	// mark line number;
-			if (g_DebugMode)
-				state.PushStatement(StatementPtr(new CommentStatement(LStrBuilder("line %1").arg(arg1).apply())));
-			break;
-		default:
-			state.PushUnknownOpcode();
+	template< int... Codes >
+	static HandlerTable MakeTable( std::integer_sequence<int, Codes...> )
+	{
+		HandlerTable table = {{ &NutFunction::DecompileOpcode<Codes>... }};
+		return table;
+	}
 
-			if (code != OP_JMP)
-			{
-				if (arg0 < m_StackSize)
-					state.AtStack(arg0) =  ExpressionPtr();
-			}
+	static const HandlerTable Handlers;
+};
 
-			break;
+const NutFunction::OpcodeDispatch::HandlerTable NutFunction::OpcodeDispatch::Handlers =
+	NutFunction::OpcodeDispatch::MakeTable(std::make_integer_sequence<int, 0x100>());
+
+
+// ***************************************************************************************************************
+void NutFunction::DecompileStatement( VMState& state ) const
+{
+	int doWhileEnd = state.PopDoWhileEndPos(state.IP());
+	if (doWhileEnd > -1)
+	{
+		// Found start of do...while loop
+		DecompileDoWhileLoop(state, doWhileEnd);
+		return;
 	}
+
+	state.ChargeInstruction();
+
+	const Instruction& op = m_Instructions[state.IP()];
+	const DecodedInstruction ins =
+	{
+		op,
+		op.op,
+		static_cast<unsigned char>(op.arg0),
+		op.arg1,
+		static_cast<unsigned char>(op.arg2),
+		static_cast<unsigned char>(op.arg3)
+	};
+
+	state.NextInstruction();
+
+	(this->*OpcodeDispatch::Handlers[ins.code])(state, ins);
 }
 
 
@@ -1179,167 +2191,42 @@ bool NutFunction::DecompileLoopJumpInstruction(VMState& state, ExpressionPtr con
 
 			if ((destIp + lastBlockOp.arg1) >= blockLimit)
 			{
-				// While block found - push loop block
-				BlockState prevBlockState = state.m_BlockState;
-				state.m_BlockState.inLoop = BlockState::WhileLoop;
-				state.m_BlockState.inSwitch = 0;
-				state.m_BlockState.blockStart = destIp + lastBlockOp.arg1;
-				state.m_BlockState.blockEnd = destIp - 1;
-				state.m_BlockState.parent = &prevBlockState;
-
-				BlockStatementPtr block = state.PushBlock();
-
-				while (state.IP() < destIp && !state.EndOfInstructions())
-				{
-					assert(state.IP() < prevBlockState.blockEnd);
-					if (state.IP() == (destIp - 1) && m_Instructions[state.IP()].op == OP_JMP && m_Instructions[state.IP()].arg1 < 0)
-					{
-						// Skip loop jump
-						state.NextInstruction();
-					}
-					else
-					{
-						DecompileStatement(state);
-					}
-				}
-
-				LoopBaseStatementPtr stat = LoopBaseStatementPtr(new WhileStatement(condPtr, state.PopBlock(block)));
-				stat->SetLoopBlock(state.m_BlockState);
-				state.PushStatement(stat);
-
-				// Pop block state
-				state.m_BlockState = prevBlockState;
-
+				state.PushFrame(new WhileLoopFrame(*this, state, condPtr, destIp, destIp + lastBlockOp.arg1));
 				return true;
 			}
 		}
 	}
-	return false;
-}
-
-void NutFunction::DecompileJumpZeroInstruction( VMState& state, int arg0, int arg1 ) const
-{
-	int destIp = state.IP() + arg1;
-	ExpressionPtr condition = state.GetVar(arg0);
-	if (DecompileLoopJumpInstruction(state, condition, arg1))
-		return;
-
-	// Search for switch chain pattern
-	if (arg1 > 0 && destIp <= state.m_BlockState.blockEnd)
-	{
-		int pos1 = destIp - 1;
-		if (pos1 <= state.m_BlockState.blockEnd && m_Instructions[pos1].op == OP_JMP && m_Instructions[pos1].arg1 > 0)
-		{
-			int pos2 = pos1 + m_Instructions[pos1].arg1;  // +1 -1
-			if (pos2 <= state.m_BlockState.blockEnd && m_Instructions[pos2].op == OP_JZ && m_Instructions[pos2].arg1 >= 0)
-			{
-				// Found beggining of switch block with at least two case elements
-				DecompileSwitchBlock(state);
-				return;
-			}
-		}
-	}
-
-
-	if (arg1 >= 0 && destIp <= state.m_BlockState.blockEnd)
-	{
-		// if instruction
-		BlockStatementPtr block = state.PushBlock();
-		BlockStatementPtr ifBlock, elseBlock;
-		VMState::StackCopyPtr stackCopy;
-
-		//bool elseMatch = false;
-		int ifBlockEndIp = destIp;
-		int elseBlockEndIp = 0;
-		bool gotElseBlock = false;
-			
-		if ((arg1 > 0) && (m_Instructions[ifBlockEndIp - 1].op == OP_JMP) && (m_Instructions[ifBlockEndIp - 1].arg1 >= 0))
-		{
-			// Last instruction of if block is unconditional forward jump - potentially else block
-			elseBlockEndIp = ifBlockEndIp + m_Instructions[ifBlockEndIp - 1].arg1;
-
-			// Check if this jump fits into current loop, otherwise it is break statement
-			if (elseBlockEndIp <= state.m_BlockState.blockEnd)
-			{
-				gotElseBlock = true;
-				stackCopy = state.CloneStack();
-			}
-		}
-		
-		BlockState prevBlockState = state.m_BlockState;
-		state.m_BlockState.inLoop = 0;
-		state.m_BlockState.inSwitch = 0;
-		state.m_BlockState.blockStart = state.IP();
-		state.m_BlockState.blockEnd = ifBlockEndIp;
-		state.m_BlockState.parent = &prevBlockState;
-
-		bool elseMatched = false;
-
-		// Parse if block instructions
-		while(state.IP() < ifBlockEndIp && !state.EndOfInstructions())
-		{
-			assert(state.IP() < prevBlockState.blockEnd);
-			if (gotElseBlock && m_Instructions[state.IP()].op == OP_JMP && state.IP() == (ifBlockEndIp - 1))
-			{
-				// Skip else block jump
-				state.NextInstruction();
-				elseMatched = true;
-			}
-			else
-			{
-				DecompileStatement(state);
-			}
-		}
-
-		if (!elseMatched)
-			gotElseBlock = false;
-
-		StatementPtr ifStatement;
-
-		// Else block parsing
-		if (gotElseBlock)
-		{
-			state.m_BlockState.blockStart = state.IP();
-			state.m_BlockState.blockEnd = elseBlockEndIp;
-
-			ifBlock = state.PushBlock();
-			state.SwapStacks(stackCopy);
-
-			while(state.IP() < elseBlockEndIp && !state.EndOfInstructions())
-			{
-				assert(state.IP() < prevBlockState.blockEnd);
-				DecompileStatement(state);
-			}
-
-			elseBlock = state.PopBlock(block);
-			state.m_BlockState = prevBlockState;
-			
-			ifStatement = StatementPtr(new IfStatement(condition, ifBlock, elseBlock));
+	return false;
+}
 
+void NutFunction::DecompileJumpZeroInstruction( VMState& state, int arg0, int arg1 ) const
+{
+	int destIp = state.IP() + arg1;
+	ExpressionPtr condition = state.GetVar(arg0);
+	if (DecompileLoopJumpInstruction(state, condition, arg1))
+		return;
 
-			if (ifBlockEndIp > 2 && m_Instructions[ifBlockEndIp - 2].op != OP_JZ && m_Instructions[elseBlockEndIp - 1].op != OP_JMP)
+	// Search for switch chain pattern
+	if (arg1 > 0 && destIp <= state.m_BlockState.blockEnd)
+	{
+		int pos1 = destIp - 1;
+		if (pos1 <= state.m_BlockState.blockEnd && m_Instructions[pos1].op == OP_JMP && m_Instructions[pos1].arg1 > 0)
+		{
+			int pos2 = pos1 + m_Instructions[pos1].arg1;  // +1 -1
+			if (pos2 <= state.m_BlockState.blockEnd && m_Instructions[pos2].op == OP_JZ && m_Instructions[pos2].arg1 >= 0)
 			{
-				int target1 = static_cast<unsigned char>(m_Instructions[ifBlockEndIp - 2].arg0);
-				int target2 = static_cast<unsigned char>(m_Instructions[elseBlockEndIp - 1].arg0);
-
-				if ((target1 == target2) && (target1 < m_StackSize) && state.AtStack(target1) && (state.AtStack(target1)->GetType() != Exp_LocalVariable) &&
-					stackCopy->at(target1).expression && stackCopy->at(target1).expression->GetType() != Exp_LocalVariable)
-				{
-					// Block match condition operator - try to merge destination stack variables
-					state.MergeStackVariable(condition, target1, stackCopy->at(target1), ifStatement);
-				}
+				// Found beggining of switch block with at least two case elements
+				DecompileSwitchBlock(state);
+				return;
 			}
 		}
-		else
-		{
-			state.m_BlockState = prevBlockState;
-
-			ifBlock = state.PopBlock(block);
-			ifStatement = StatementPtr(new IfStatement(condition, ifBlock, StatementPtr()));
-		}			
+	}
 
 
-		state.PushStatement(ifStatement);
+	if (arg1 >= 0 && destIp <= state.m_BlockState.blockEnd)
+	{
+		// if instruction
+		state.PushFrame(new IfElseFrame(*this, state, condition, arg1, destIp));
 		return;
 	}
 
@@ -1362,61 +2249,7 @@ void NutFunction::DecompileJumpZeroInstruction( VMState& state, int arg0, int ar
 // ***************************************************************************************************************
 void NutFunction::DecompileDoWhileLoop( VMState& state, int endPos) const
 {
-	BlockState prevBlockState = state.m_BlockState;
-	state.m_BlockState.inLoop = BlockState::DoWhileLoop;
-	state.m_BlockState.inSwitch = 0;
-	state.m_BlockState.blockStart = state.IP();
-	state.m_BlockState.blockEnd = endPos;
-	state.m_BlockState.parent = &prevBlockState;
-
-	BlockStatementPtr block = state.PushBlock();
-	ExpressionPtr condition;
-
-	while (state.IP() < endPos + 1 && !state.EndOfInstructions())
-	{
-		assert(state.IP() <= prevBlockState.blockEnd);
-		if (state.IP() == endPos - 1 )
-		{
-			const Instruction& inst = m_Instructions[state.IP()];
-			if (inst.op == OP_JCMP)
-			{
-				unsigned char condVar = static_cast<unsigned char>(inst.arg0);
-				unsigned char iterVar = static_cast<unsigned char>(inst.arg2);
-				unsigned char cmpOp = static_cast<unsigned char>(inst.arg3);
-
-				ExpressionPtr iterExp = state.GetVar(iterVar);
-				condition = ExpressionPtr(new BinaryOperatorExpression(ComparisionOpcodeNames[cmpOp], iterExp, state.GetVar(condVar)));
-			}
-			else if (inst.op == OP_JZ)
-			{
-				condition = state.GetVar(inst.arg0);
-			}
-			// skip while instruction
-			state.NextInstruction();
-			state.NextInstruction();
-		}
-		else
-		{
-			DecompileStatement(state);
-		}
-	}
-
-	LoopBaseStatementPtr stat;
-	if (condition != nullptr)
-	{
-		stat = LoopBaseStatementPtr(new DoWhileStatement(condition, state.PopBlock(block)));
-	}
-	else
-	{
-		stat = LoopBaseStatementPtr(new ForStatement(nullptr, nullptr, nullptr, state.PopBlock(block)));
-		state.PushStatement(StatementPtr(new CommentStatement(L"This is a incorrect loop analysis")));
-	}
-
-	stat->SetLoopBlock(state.m_BlockState);
-	state.PushStatement(stat);
-
-	// Pop block state
-	state.m_BlockState = prevBlockState;
+	state.PushFrame(new DoWhileFrame(*this, state, endPos));
 }
 
 // if (IsFalse(conditionExp)) ip += offsetIp;
@@ -1429,103 +2262,7 @@ void NutFunction::DecompileJCMP(VMState& state, int condVar, int offsetIp, int i
 	if (DecompileLoopJumpInstruction(state, conditionExp, offsetIp))
 		return;
 
-	BlockStatementPtr block = state.PushBlock();
-
-	// While block found - push loop block
-	BlockState prevBlockState = state.m_BlockState;
-	state.m_BlockState.inLoop = BlockState::CmpForLoop;
-	state.m_BlockState.inSwitch = 0;
-	state.m_BlockState.blockStart = state.IP() - 1;
-	state.m_BlockState.blockEnd = destIP;
-	state.m_BlockState.parent = &prevBlockState;
-
-	// Decompile loop block
-	bool bHasEndingJump = false;
-	int elseEnd = 0;
-	VMState::StackCopyPtr stackCopy = state.CloneStack();
-
-	while (!state.EndOfInstructions() && state.IP() < destIP)
-	{
-		assert(state.IP() < prevBlockState.blockEnd);
-		if (state.IP() == (destIP - 1) && m_Instructions[state.IP()].op == OP_JMP)
-		{
-			// Skip loop ending JMP
-			int jmpOffset = m_Instructions[state.IP()].arg1;
-			state.NextInstruction();
-
-			if (jmpOffset < 1)
-			{
-				bHasEndingJump = true;
-			}
-			else
-			{
-				elseEnd = state.IP() + jmpOffset;
-				if (bCanBreak && elseEnd > prevBlockState.blockEnd)
-					state.PushStatement(StatementPtr(new BreakStatement()));
-			}
-		}
-		else
-		{
-			DecompileStatement(state);
-		}
-	}
-	
-	if (bHasEndingJump)
-	{
-		LoopBaseStatementPtr stat = LoopBaseStatementPtr(new ForStatement(nullptr, conditionExp, nullptr, state.PopBlock(block)));
-		stat->SetLoopBlock(state.m_BlockState);
-
-		// Pop block state
-		state.m_BlockState = prevBlockState;
-
-		state.PushStatement(stat);
-	}
-	else // may be if-else
-	{
-		state.m_BlockState.inLoop = 0;
-
-		BlockStatementPtr ifStat = state.PopBlock(block);
-		BlockStatementPtr elseStat = nullptr;
-		if (elseEnd > state.IP() && elseEnd <= prevBlockState.blockEnd)
-		{
-			state.m_BlockState.blockStart = state.IP();
-			state.m_BlockState.blockEnd = elseEnd;
-
-			BlockStatementPtr block = state.PushBlock();
-			state.SwapStacks(stackCopy);
-			while (!state.EndOfInstructions() && state.IP() < elseEnd)
-			{
-				assert(state.IP() < prevBlockState.blockEnd);
-				DecompileStatement(state);
-			}
-			elseStat = state.PopBlock(block);
-		}
-
-		StatementPtr ifStatement = StatementPtr(new IfStatement(conditionExp, ifStat, elseStat));
-
-		// Pop block state
-		state.m_BlockState = prevBlockState;
-
-		if (elseStat != nullptr)
-		{
-			int ifBlockEndIp = destIP;
-			int elseBlockEndIp = elseEnd;
-			if (ifBlockEndIp > 2 && m_Instructions[ifBlockEndIp - 2].op != OP_JZ && m_Instructions[elseBlockEndIp - 1].op != OP_JMP)
-			{
-				int target1 = static_cast<unsigned char>(m_Instructions[ifBlockEndIp - 2].arg0);
-				int target2 = static_cast<unsigned char>(m_Instructions[elseBlockEndIp - 1].arg0);
-
-				if ((target1 == target2) && (target1 < m_StackSize) && state.AtStack(target1) && (state.AtStack(target1)->GetType() != Exp_LocalVariable) &&
-					stackCopy->at(target1).expression && stackCopy->at(target1).expression->GetType() != Exp_LocalVariable)
-				{
-					// Block match condition operator - try to merge destination stack variables
-					state.MergeStackVariable(conditionExp, target1, stackCopy->at(target1), ifStatement);
-				}
-			}
-		}
-
-		state.PushStatement(ifStatement);
-	}
+	state.PushFrame(new CmpJumpFrame(*this, state, conditionExp, bCanBreak, destIP));
 }
 
 // ***************************************************************************************************************
@@ -1610,134 +2347,7 @@ void NutFunction::DecompileJumpInstruction( VMState& state, int arg1 ) const
 // ***************************************************************************************************************
 void NutFunction::DecompileSwitchBlock( VMState& state ) const
 {
-	// Function is called after parsing OP_JZ instruction and detecting switch chain patter - previous instructin should be JZ
-	assert(state.IP() > 0 && m_Instructions[state.IP() - 1].op == OP_JZ);
-
-	// Initially scan trough switch chain to find switch block size (without default part)
-	int pos = state.IP() - 1;
-	for(;;)
-	{
-		if (pos <= state.m_BlockState.blockEnd && m_Instructions[pos].op == OP_JZ && m_Instructions[pos].arg1 > 0)
-		{
-			pos += m_Instructions[pos].arg1;
-			
-			if (pos <= state.m_BlockState.blockEnd && m_Instructions[pos].op == OP_JMP && m_Instructions[pos].arg1 > 0)
-			{
-				pos += m_Instructions[pos].arg1;
-				continue;
-			}
-		}
-
-		break;
-	}
-
-	// Move out of last instruction 
-	pos += 1;
-
-	// Check for common last break in switch block and eventually include it into
-	// switch block
-	if (pos < (int)m_Instructions.size() && m_Instructions[pos].op == OP_JMP && m_Instructions[pos].arg1 == 0)
-		pos += 1;
-
-	BlockState prevBlockState = state.m_BlockState;
-	state.m_BlockState.inLoop = 0;
-	state.m_BlockState.inSwitch = 1;
-	state.m_BlockState.blockStart = state.IP() - 1;		// Not precise, but it is not important in case of switch
-	state.m_BlockState.blockEnd = pos;					// Not includes default block, but will be corrected on break statement
-	state.m_BlockState.parent = &prevBlockState;
-
-	// Prepare switch block
-	BlockStatementPtr block = state.PushBlock();
-
-	ExpressionPtr switchVariable;		// Switch statement source variable expression
-
-	ExpressionPtr condition = state.GetVar(m_Instructions[state.IP() - 1].arg0);
-	int currentBlockEnd = state.IP() + m_Instructions[state.IP() - 1].arg1;
-
-	for(;;)
-	{
-		ExpressionPtr caseValue;
-
-		if (condition->GetType() == Exp_Operator)
-		{
-			shared_ptr<OperatorExpression> operatorExpression = static_pointer_cast<OperatorExpression>(condition);
-			if (operatorExpression->GetOperatorType() == '==')
-			{
-				shared_ptr<BinaryOperatorExpression> comparisionOperator = static_pointer_cast<BinaryOperatorExpression>(condition);
-				
-				if (!switchVariable)
-					switchVariable = comparisionOperator->GetArg1();
-
-				caseValue = comparisionOperator->GetArg2();
-			}
-		}
-
-		// Push start of current block
-		state.PushStatement(StatementPtr(new CaseStatement(caseValue)));
-
-		// Create fake blok for case part
-		BlockState outCaseBlock = state.m_BlockState;
-		state.m_BlockState.inLoop = 0;
-		state.m_BlockState.inSwitch = 0;
-		state.m_BlockState.blockStart = state.IP();
-		state.m_BlockState.blockEnd = currentBlockEnd;
-		state.m_BlockState.parent = &outCaseBlock;
-
-		int nextBlockStart = -1;
-
-		// Parse current block
-		while(!state.EndOfInstructions() && state.IP() < currentBlockEnd)
-		{
-			if (state.IP() == (currentBlockEnd - 1) && m_Instructions[state.IP()].op == OP_JMP && m_Instructions[state.IP()].arg1 > 0 && (state.IP() + m_Instructions[state.IP()].arg1 + 1 < outCaseBlock.blockEnd))
-			{
-				// Last forward jump of block - element of switch chain
-				if (m_Instructions[state.IP()].arg1 > 0)
-					nextBlockStart = state.IP() + 1 + m_Instructions[state.IP()].arg1;
-
-				state.NextInstruction();
-			}
-			else
-			{
-				DecompileStatement(state);
-			}
-		}
-
-		state.m_BlockState = outCaseBlock;
-
-		if (nextBlockStart > state.IP() && m_Instructions[nextBlockStart - 1].op == OP_JZ && m_Instructions[nextBlockStart - 1].arg1 >= 0)
-		{
-			// Parse expression till next case condition
-			while(!state.EndOfInstructions() && state.IP() < (nextBlockStart - 1))
-				DecompileStatement(state);
-			
-			if (state.IP() == (nextBlockStart - 1))
-			{
-				// Parse next case condition
-				condition = state.GetVar(m_Instructions[state.IP()].arg0);
-				currentBlockEnd = state.IP() + 1 + m_Instructions[state.IP()].arg1;
-				state.NextInstruction();
-
-				// Continue switch parsing
-				continue;
-			}
-		}
-
-		break;
-	}
-
-	if (state.IP() < state.m_BlockState.blockEnd)
-	{
-		// Parse default part
-		state.PushStatement(StatementPtr(new CaseStatement(ExpressionPtr())));
-
-		while(!state.EndOfInstructions() && state.IP() < state.m_BlockState.blockEnd)
-			DecompileStatement(state);
-	}
-
-	state.m_BlockState = prevBlockState;
-	BlockStatementPtr switchBlock = state.PopBlock(block);
-
-	state.PushStatement(StatementPtr(new SwitchStatement(switchVariable, switchBlock)));	
+	state.PushFrame(new SwitchFrame(*this, state));
 }
 
 void NutFunction::DecompileAppendArray(VMState& state, int arg0, int arg1, AppendArrayType aat, int arg3) const
@@ -1757,7 +2367,7 @@ void NutFunction::DecompileAppendArray(VMState& state, int arg0, int arg1, Appen
 		valueExp = state.GetVar(arg1);
 		break;
 	case AAT_LITERAL:
-		valueExp = ExpressionPtr(new ConstantExpression(m_Literals[arg1]));
+		valueExp = ExpressionPtr(new ConstantExpression(m_LiteralTexts[arg1]));
 		break;
 	case AAT_INT:
 		valueExp = ExpressionPtr(new ConstantExpression(target.uintVal));
@@ -1772,7 +2382,7 @@ void NutFunction::DecompileAppendArray(VMState& state, int arg0, int arg1, Appen
 		if (arg3 == 0xFF)
 			valueExp = state.GetLastVar();
 		else
-			valueExp = (arg3 != 0) ? ExpressionPtr(new ConstantExpression(m_Literals[arg1])) : state.GetVar(arg1);
+			valueExp = (arg3 != 0) ? ExpressionPtr(new ConstantExpression(m_LiteralTexts[arg1])) : state.GetVar(arg1);
 		break;
 	}
 
@@ -1783,7 +2393,7 @@ void NutFunction::DecompileAppendArray(VMState& state, int arg0, int arg1, Appen
 	}
 	else
 	{
-		ExpressionPtr appendFunctionExp = ExpressionPtr(new ArrayIndexingExpression(arrayExp, ExpressionPtr(new ConstantExpression(L"append"))));
+		ExpressionPtr appendFunctionExp = ExpressionPtr(new ArrayIndexingExpression(arrayExp, ExpressionPtr(new ConstantExpression(L"append", *m_Context))));
 		shared_ptr<FunctionCallExpression> callExp = shared_ptr<FunctionCallExpression>(new FunctionCallExpression(appendFunctionExp));
 		callExp->AddArgument(arrayExp);
 		callExp->AddArgument(valueExp);
@@ -1793,7 +2403,19 @@ void NutFunction::DecompileAppendArray(VMState& state, int arg0, int arg1, Appen
 }
 
 // ***************************************************************************************************************
-void NutFunction::PrintOpcode(std::wostream& out, int pos, const Instruction& op ) const
+void CommentStatement::PrintOpcode( TextWriter& out ) const
+{
+	m_Function->PrintOpcode(out, m_OpcodePos, m_Function->m_Instructions[m_OpcodePos]);
+}
+
+// ***************************************************************************************************************
+void DisassemblyStatement::GenerateCode( TextWriter& out, int n ) const
+{
+	m_Function.PrintDisassemblyStub(n, out, m_Reason.c_str(), 0);
+}
+
+// ***************************************************************************************************************
+void NutFunction::PrintOpcode(TextWriter& out, int pos, const Instruction& op ) const
 {
 	unsigned int code = static_cast<unsigned int>(op.op);
 	const char* codeName;
@@ -1803,13 +2425,10 @@ void NutFunction::PrintOpcode(std::wostream& out, int pos, const Instruction& op
 	else
 		codeName = OpcodeNames[code];
 
-	out << "["; 
-	out.fill('0');
-	out << std::setw(3) << pos;
-	out.fill(' ');
-	out << "]  " << codeName << spaces(14 - strlen(codeName));
+	out.Printf("[%03d]  ", pos);
+	out << codeName << spaces(14 - strlen(codeName));
 
-	out << std::setw(5) << (int)op.arg0 << "  ";
+	out.Printf("%5d  ", (int)op.arg0);
 
 	switch(code)
 	{
@@ -1819,16 +2438,16 @@ void NutFunction::PrintOpcode(std::wostream& out, int pos, const Instruction& op
 
 		case OP_DLOAD:
 			out << m_Literals[op.arg1];
-			out << std::setw(5) << (int)op.arg2;
+			out.Printf("%5d", (int)op.arg2);
 			out << "  " << m_Literals[ static_cast<unsigned char>(op.arg3) ];
 			break;
 
 		case OP_LOADINT:
-			out << std::setw(5) << op.arg1;
+			out.Printf("%5d", op.arg1);
 			break;
 
 		case OP_LOADFLOAT:
-			out << std::setw(5) << op.arg1_float;
+			out.Printf("%5g", op.arg1_float);
 			break;
 
 		case OP_LOADBOOL:
@@ -1844,7 +2463,7 @@ void NutFunction::PrintOpcode(std::wostream& out, int pos, const Instruction& op
 		case OP_PREPCALLK:
 		case OP_GETK:
 			out << '(' << (int)op.arg2 << ")." << m_Literals[op.arg1].GetString() << "  ";
-			out << std::setw(5) << (int)op.arg3;
+			out.Printf("%5d", (int)op.arg3);
 			break;
 
 
@@ -1853,16 +2472,14 @@ void NutFunction::PrintOpcode(std::wostream& out, int pos, const Instruction& op
 		default:	
 			
 			//out << "  0x" << qSetFieldWidth(8) << qSetPadChar('0') << std::setbase(16) << op.arg1 << qSetPadChar(' ') << std::setbase(10);
-			out << std::setw(5) << (int)op.arg1;
-			out << std::setw(5) << (int)op.arg2;
-			out << std::setw(5) << (int)op.arg3;
+			out.Printf("%5d%5d%5d", (int)op.arg1, (int)op.arg2, (int)op.arg3);
 
 			break;
 	}
 }
 
 // ***************************************************************************************************************
-void NutFunction::GenerateFunctionSource( int n, std::wostream& out, const LString& name, const std::vector< LString >& defaults ) const
+void NutFunction::GenerateFunctionSource( int n, TextWriter& out, const LString& name, const std::vector< ExpressionPtr >& defaults ) const
 {
 	if (name != L"constructor")
 		out << L"function ";
@@ -1886,7 +2503,8 @@ void NutFunction::GenerateFunctionSource( int n, std::wostream& out, const LStri
 		int defaultIndex = i - (m_Parameters.size() - defaults.size());
 		if (defaultIndex >= 0)
 		{
-			out << " = " << defaults[defaultIndex];
+			out << " = ";
+			defaults[defaultIndex]->GenerateCode(out, n + 1);
 		}
 
 		paramsCount += 1;
@@ -1906,98 +2524,199 @@ void NutFunction::GenerateFunctionSource( int n, std::wostream& out, const LStri
 	if (paramsCount > 0)
 		out << ' ';
 
-	out << ')' << std::endl;
+	out << ')' << '\n';
 
-	out << indent(n) << "{" << std::endl;
+	out << indent(n) << "{" << '\n';
 
-	GenerateBodySource(n + 1, out);
+	if (m_Prerendered)
+		FunctionPrerender::WriteBody(*this, n + 1, out);
+	else
+		GenerateBodySource(n + 1, out);
 
-	out << indent(n) << "}";// << std::endl;
-	//out << std::endl;
-	//out << std::endl;
+	out << indent(n) << "}";// << '\n';
+	//out << '\n';
+	//out << '\n';
 }
 
 
 // ***************************************************************************************************************
-void NutFunction::GenerateBodySource( int n, std::wostream& out ) const
+void NutFunction::GenerateBodySource( int n, TextWriter& out, bool streaming ) const
 {
 	//for( auto i = m_Functions.begin(); i != m_Functions.end(); ++i)
 	//	i->GenerateFunctionSource(n, out, extraInfo);
 
 	if (m_IsGenerator)
-		out << indent(n) << "// Function is a generator." << std::endl;
+		out << indent(n) << "// Function is a generator." << '\n';
 
-	if (g_DebugMode)
+	if (m_Context->IsDebugMode())
 	{
-		out << indent(n) << "// Defaults:" << std::endl;
+		out << indent(n) << "// Defaults:" << '\n';
 		for( std::vector<int>::const_iterator i = m_DefaultParams.begin(); i != m_DefaultParams.end(); ++i)
-			out << indent(n) << "//\t" << *i << std::endl;
+			out << indent(n) << "//\t" << *i << '\n';
 		
-		out << std::endl;
+		out << '\n';
 
-		out << indent(n) << "// Literals:" << std::endl;
+		out << indent(n) << "// Literals:" << '\n';
 		for( std::vector<SqObject>::const_iterator i = m_Literals.begin(); i != m_Literals.end(); ++i)
-			out << indent(n) << "//\t" << *i << std::endl;
+			out << indent(n) << "//\t" << *i << '\n';
 
-		out << std::endl;
+		out << '\n';
 
-		out << indent(n) << "// Outer values:" << std::endl;
+		out << indent(n) << "// Outer values:" << '\n';
 		for( vector<OuterValueInfo>::const_iterator i = m_OuterValues.begin(); i != m_OuterValues.end(); ++i)
-			out << indent(n) << "//\t" << i->type << "  src=" << i->src << "  name=" << i->name << std::endl; 
+			out << indent(n) << "//\t" << i->type << "  src=" << i->src << "  name=" << i->name << '\n'; 
 
-		out << std::endl;
+		out << '\n';
 
-		out << indent(n) << "// Local identifiers:" << std::endl;
+		out << indent(n) << "// Local identifiers:" << '\n';
 		for(vector<NutFunction::LocalVarInfo>::const_reverse_iterator i = m_Locals.rbegin(); i != m_Locals.rend(); ++i)
 		{
 			out << indent(n) << "//   -" << i->name << spaces(10 - i->name.size()) 
-				<< " // pos=" << i->pos << "  start=" << i->start_op << "  end=" << i->end_op << (i->foreachLoopState ? " foreach state" : "") << std::endl;
+				<< " // pos=" << i->pos << "  start=" << i->start_op << "  end=" << i->end_op << (i->foreachLoopState ? " foreach state" : "") << '\n';
 		}
 
-		out << std::endl;
-		out << indent(n) << "// Instructions:" << std::endl;
-
-		int currentLine = 0;
-		vector<LineInfo>::const_iterator lineInfo = m_LineInfos.begin();
+		out << '\n';
+		out << indent(n) << "// Instructions:" << '\n';
 
-		for(size_t i = 0; i < m_Instructions.size(); ++i)
-		{
-			while (lineInfo != m_LineInfos.end() && i >= (unsigned int)lineInfo->op)
-			{
-				currentLine = lineInfo->line;
-				++lineInfo;
-			}
-			out.fill(' ');
-			out << indent(n) << "// " << std::setw(5) << currentLine << "  ";
-			PrintOpcode(out, (int)i, m_Instructions[i]);
-			out << std::endl;
-		}
+		PrintListing(n, out);
 
-		out << indent(n) << std::endl;
-		out << indent(n) << "// Decompilation attempt:" << std::endl;
+		out << indent(n) << '\n';
+		out << indent(n) << "// Decompilation attempt:" << '\n';
 	}
 
 	// Crate new state for decompiler virtual machine
 	VMState state(*this, m_StackSize);
-
-	// Set initial stack elements to local identifiers
-	for(vector<NutFunction::LocalVarInfo>::const_reverse_iterator i = m_Locals.rbegin(); i != m_Locals.rend(); ++i)	
-		if (i->start_op == 0 && !i->foreachLoopState)
-			state.AtStack(i->pos) = ExpressionPtr(new LocalVariableExpression(i->name));
+	state.BeginOutput(out, n, streaming);
 
 	// Decompiler loop
-	while(!state.EndOfInstructions())
+	state.PushFrame(new FunctionBodyFrame(*this));
+
+	try
 	{
-		if (m_Instructions[state.IP()].op == OP_RETURN && (state.IP() == m_Instructions.size() - 1) && m_Instructions[state.IP()].arg0 == -1)
+		state.RunFrames();
+
+		// Print decompiled code
+		state.PrintOutput();
+	}
+	catch( Error& ex )		// Also BudgetError
+	{
+		PrintFailedBody(state, n, out, ex.what());
+	}
+	catch( BadFormatError& ex )
+	{
+		PrintFailedBody(state, n, out, ex.what());
+	}
+}
+
+
+// ***************************************************************************************************************
+// Function that fails is printed as disassembly, so that rest of script is not lost. Streamed statements stay, only
+// instructions after them are listed. Debug decompilation reports the error.
+void NutFunction::PrintFailedBody( VMState& state, int n, TextWriter& out, const char* reason ) const
+{
+	int start = state.FinishOutput(true);
+
+	if (m_Context->IsDebugMode())
+		throw;
+
+	if (start > 0)
+		out << '\n';
+
+	PrintDisassemblyStub(n, out, reason, start);
+}
+
+
+// ***************************************************************************************************************
+void NutFunction::TakeFailedBody( std::vector<StatementPtr>& statements, const char* reason ) const
+{
+	if (m_Context->IsDebugMode())
+		throw;
+
+	statements.clear();
+	statements.push_back(StatementPtr(new DisassemblyStatement(*this, reason)));
+}
+
+
+// ***************************************************************************************************************
+// Nested functions created by instructions from start on, in order of index
+void NutFunction::GetFunctionsClosedFrom( int start, std::vector<int>& functions ) const
+{
+	std::vector<bool> closed(m_Functions.size(), start == 0);
+
+	for(size_t i = start; i < m_Instructions.size(); ++i)
+		if (m_Instructions[i].op == OP_CLOSURE && m_Instructions[i].arg1 >= 0 && m_Instructions[i].arg1 < (int)closed.size())
+			closed[m_Instructions[i].arg1] = true;
+
+	for(size_t i = 0; i < closed.size(); ++i)
+		if (closed[i])
+			functions.push_back((int)i);
+}
+
+
+// ***************************************************************************************************************
+// Commented listing in place of body that could not be decompiled, from instruction start on, followed by nested
+// functions that were not printed yet
+void NutFunction::PrintDisassemblyStub( int n, TextWriter& out, const char* reason, int start ) const
+{
+	out << indent(n) << "// Decompilation failed: " << reason << '\n';
+	out << indent(n) << "//   line  instruction" << '\n';
+	PrintListing(n, out, start);
+
+	std::vector<int> functions;
+	GetFunctionsClosedFrom(start, functions);
+
+	for(std::vector<int>::const_iterator i = functions.begin(); i != functions.end(); ++i)
+	{
+		out << '\n' << indent(n) << "// Nested function " << *i << ':' << '\n' << indent(n);
+		m_Functions[*i].GenerateFunctionSource(n, out);
+		out << '\n';
+	}
+}
+
+
+// ***************************************************************************************************************
+// Instructions from start on with source line numbers, each on its own comment line
+void NutFunction::PrintListing( int n, TextWriter& out, int start ) const
+{
+	int currentLine = 0;
+	vector<LineInfo>::const_iterator lineInfo = m_LineInfos.begin();
+
+	for(size_t i = 0; i < m_Instructions.size(); ++i)
+	{
+		while (lineInfo != m_LineInfos.end() && i >= (unsigned int)lineInfo->op)
 		{
-			// This is last return statement in function - can be skipped
-			state.NextInstruction();
-			continue;	
+			currentLine = lineInfo->line;
+			++lineInfo;
 		}
 
-		DecompileStatement(state);
+		if ((int)i < start)
+			continue;
+
+		out << indent(n);
+		out.Printf("// %5d  ", currentLine);
+		PrintOpcode(out, (int)i, m_Instructions[i]);
+		out << '\n';
 	}
+}
+
+
+// ***************************************************************************************************************
+void NutFunction::DecompileBody( std::vector<StatementPtr>& statements ) const
+{
+	VMState state(*this, m_StackSize);
+	state.PushFrame(new FunctionBodyFrame(*this));
 
-	// Print decompiled code
-	state.PrintOutput(out, n);
+	try
+	{
+		state.RunFrames();
+		state.TakeOutput(statements);
+	}
+	catch( Error& ex )		// Also BudgetError
+	{
+		TakeFailedBody(statements, ex.what());
+	}
+	catch( BadFormatError& ex )
+	{
+		TakeFailedBody(statements, ex.what());
+	}
 }
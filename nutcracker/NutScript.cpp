@@ -1,7 +1,7 @@
 ﻿#include "stdafx.h"
 #include "NutScript.h"
-
-bool g_DebugMode = false;
+#include "OpcodeScanner.h"
+#include "ThreadPool.h"
 
 // ***************************************************************************************************************
 const NutFunction* NutFunction::FindFunction( const LString& name ) const
@@ -30,7 +30,7 @@ const NutFunction* NutFunction::FindFunction( const LString& name ) const
 	else
 	{
 		for(size_t i = 0; i < m_Functions.size(); ++i)
-			if (m_Functions[i].m_Name == name)
+			if (m_Functions[i].m_Name == localName)
 			{
 				pos = (int)i;
 				break;
@@ -60,6 +60,8 @@ const NutFunction& NutFunction::GetFunction( int i ) const
 // ***************************************************************************************************************
 void NutFunction::Load( BinaryReader& reader )
 {
+	m_Context = &reader.GetContext();
+
 	reader.ConfirmOnPart();
 
 	reader.ReadSQStringObject(m_SourceName);
@@ -79,8 +81,12 @@ void NutFunction::Load( BinaryReader& reader )
 	reader.ConfirmOnPart();
 
 	m_Literals.resize(nLiterals);	// 字面值、常量
+	m_LiteralTexts.resize(nLiterals);
 	for(int i = 0; i < nLiterals; ++i)
+	{
 		m_Literals[i].Load(reader);
+		m_LiteralTexts[i] = ConstantExpression::Render(m_Literals[i], *m_Context);
+	}
 
 	reader.ConfirmOnPart();
 	
@@ -131,6 +137,14 @@ void NutFunction::Load( BinaryReader& reader )
 		reader.Read(&(m_Instructions.at(0)), nInstructions * sizeof(Instruction));
 	}
 
+	m_Opcodes.resize(nInstructions);
+	m_JumpOffsets.resize(nInstructions);
+	for(int i = 0; i < nInstructions; ++i)
+	{
+		m_Opcodes[i] = static_cast<unsigned char>(m_Instructions[i].op);
+		m_JumpOffsets[i] = m_Instructions[i].arg1;
+	}
+
 	reader.ConfirmOnPart();
 
 	m_Functions.resize(nFunctions);
@@ -149,28 +163,28 @@ void NutFunction::Load( BinaryReader& reader )
 	// The third one, that sometimes is not present, is named @ITERATOR@.
 	// The first var has it's scope start at (OP_FOREACH instruction idx - 1)
 	// Then we mark the next var in locals array and the third if it's @ITERATOR@ var
-	for (std::vector<Instruction>::iterator i = m_Instructions.begin(); i != m_Instructions.end(); ++i)
+	std::vector<int> foreachPositions;
+	FindOpcodes(m_Opcodes.data(), nInstructions, OpcodeBit(OP_FOREACH), foreachPositions);
+
+	for (std::vector<int>::const_iterator i = foreachPositions.begin(); i != foreachPositions.end(); ++i)
 	{
-		if (i->op == OP_FOREACH)
-		{
-			const int ipos = i - m_Instructions.begin();
-			const int idxScopeStart = ipos - 1;
-			const char idxLocalPos = i->arg2;
+		const int ipos = *i;
+		const int idxScopeStart = ipos - 1;
+		const char idxLocalPos = m_Instructions[ipos].arg2;
 
-			for (LocalVarInfos::reverse_iterator v = m_Locals.rbegin(); v != m_Locals.rend();++v)
+		for (LocalVarInfos::reverse_iterator v = m_Locals.rbegin(); v != m_Locals.rend();++v)
+		{
+			if (v->pos == idxLocalPos && v->start_op == idxScopeStart)
 			{
-				if (v->pos == idxLocalPos && v->start_op == idxScopeStart)
+				// idx
+				v->foreachLoopState = true;
+				// value
+				(++v)->foreachLoopState = true;
+				// iterator (if present)
+				if (++v == m_Locals.rend()) break;
+				if(v->name == L"@ITERATOR@")
 				{
-					// idx
 					v->foreachLoopState = true;
-					// value
-					(++v)->foreachLoopState = true;
-					// iterator (if present)
-					if (++v == m_Locals.rend()) break;
-					if(v->name == L"@ITERATOR@")
-					{
-						v->foreachLoopState = true;
-					}
 				}
 			}
 		}
@@ -196,10 +210,21 @@ void NutScript::LoadFromFile( const char* fileName )
 }
 
 
+// ***************************************************************************************************************
+void NutScript::LoadFromBuffer( const void* data, size_t size )
+{
+	LFile file;
+	if (!file.openMemory(data, size))
+		throw BadFormatError();
+
+	LoadFromStream(file);
+}
+
+
 // ***************************************************************************************************************
 void NutScript::LoadFromStream( LFile& in )
 {
-	BinaryReader reader(in);
+	BinaryReader reader(in, m_Context);
 
 	// Magic
 	if (reader.ReadUInt16() != 0xFAFA) 
@@ -239,7 +264,8 @@ bool Eq( const NutFunction::Instruction& a, const NutFunction::Instruction& b )
 }
 
 // ***************************************************************************************************************
-bool NutFunction::DoCompare( const NutFunction& other, const LString& parentName, std::wostream& out ) const
+// Compares function without nested functions. Without out it returns at first difference.
+bool NutFunction::CompareOwn( const NutFunction& other, const LString& name, TextWriter* out ) const
 {
 	bool functionsOk = true;
 	bool literalsOk = true;
@@ -247,35 +273,24 @@ bool NutFunction::DoCompare( const NutFunction& other, const LString& parentName
 	bool outerValuesOk = true;
 	bool instructionsOk = true;
 
-
-	LString name;
-	
-	if (!parentName.empty())
-		name.append(parentName).append(L"::");
-
-	if (!m_Name.empty())
-		name.append(m_Name);
-	else
-		name.append('[').append(m_FunctionIndex).append(']');
+	if (out)
+		*out << name << ':' << '\n';
 
 	if (m_Functions.size() != other.m_Functions.size())
 	{
-		out << name << ':' << std::endl;
-		out << "    - different number of subfunctions: " << m_Functions.size() << " to " << other.m_Functions.size() << std::endl;
-		functionsOk = false;
-	}
-	else
-	{
-		for(size_t i = 0; i < m_Functions.size(); ++i)
-			if (!m_Functions[i].DoCompare(other.m_Functions[i], name, out))
-				functionsOk = false;
+		if (!out)
+			return false;
 
-		out << name << ':' << std::endl;
+		*out << "    - different number of subfunctions: " << m_Functions.size() << " to " << other.m_Functions.size() << '\n';
+		functionsOk = false;
 	}
 
 	if (m_Literals.size() != other.m_Literals.size())
 	{
-		out << "    - different number of literals: " << m_Literals.size() << " to " << other.m_Literals.size() << std::endl;
+		if (!out)
+			return false;
+
+		*out << "    - different number of literals: " << m_Literals.size() << " to " << other.m_Literals.size() << '\n';
 		literalsOk = false;
 	}
 	else
@@ -283,20 +298,29 @@ bool NutFunction::DoCompare( const NutFunction& other, const LString& parentName
 		for(size_t i = 0; i < m_Literals.size(); ++i)
 			if (m_Literals[i] != other.m_Literals[i])
 			{
-				out << "    - different literals @ " << i << ": \"" << m_Literals[i] << "\" and \"" << other.m_Literals[i] << "\"" << std::endl;
+				if (!out)
+					return false;
+
+				*out << "    - different literals @ " << i << ": \"" << m_Literals[i] << "\" and \"" << other.m_Literals[i] << "\"" << '\n';
 				literalsOk = false;
 			}
 	}
 
 	if (m_Parameters.size() != other.m_Parameters.size())
 	{
-		out << "    - different number of parameters: " << m_Parameters.size() << " to " << other.m_Parameters.size() << std::endl;
+		if (!out)
+			return false;
+
+		*out << "    - different number of parameters: " << m_Parameters.size() << " to " << other.m_Parameters.size() << '\n';
 		parametersOk = false;
 	}
 
 	if (m_OuterValues.size() != other.m_OuterValues.size())
 	{
-		out << "    - different number of outer values: " << m_OuterValues.size() << " to " << other.m_OuterValues.size() << std::endl;
+		if (!out)
+			return false;
+
+		*out << "    - different number of outer values: " << m_OuterValues.size() << " to " << other.m_OuterValues.size() << '\n';
 		outerValuesOk = false;
 	}
 	else
@@ -304,14 +328,20 @@ bool NutFunction::DoCompare( const NutFunction& other, const LString& parentName
 		for(size_t i = 0; i < m_OuterValues.size(); ++i)
 			if (m_OuterValues[i].src != other.m_OuterValues[i].src)
 			{
-				out << "    - different outer value source @ " << i << ": " << m_OuterValues[i].src << " and " << other.m_OuterValues[i].src << std::endl;
+				if (!out)
+					return false;
+
+				*out << "    - different outer value source @ " << i << ": " << m_OuterValues[i].src << " and " << other.m_OuterValues[i].src << '\n';
 				outerValuesOk = false;
 			}
 	}
 
 	if (m_Instructions.size() != other.m_Instructions.size())
 	{
-		out << "    - different number of instructions: " << m_Instructions.size() << " to " << other.m_Instructions.size() << std::endl;
+		if (!out)
+			return false;
+
+		*out << "    - different number of instructions: " << m_Instructions.size() << " to " << other.m_Instructions.size() << '\n';
 		instructionsOk = false;
 	}
 	
@@ -323,35 +353,38 @@ bool NutFunction::DoCompare( const NutFunction& other, const LString& parentName
 
 		if (!Eq(a, b))
 		{
+			if (!out)
+				return false;
+
 			instructionsOk = false;
 
 			if ((i + 1) < m_Instructions.size() && Eq(m_Instructions[i + 1], b))
 			{
-				out << "    - instruction missing in second @ [" << i  << "]<->[" << j << "]:" << std::endl;
-				out << "          ";
-				PrintOpcode(out, i, a);
-				out << std::endl;
+				*out << "    - instruction missing in second @ [" << i  << "]<->[" << j << "]:" << '\n';
+				*out << "          ";
+				PrintOpcode(*out, i, a);
+				*out << '\n';
 				--j;
 			}
 			else if ((j + 1) < other.m_Instructions.size() && Eq(other.m_Instructions[j + 1], a))
 			{
-				out << "    - instruction missing in first @ [" << i  << "]<->[" << j << "]:" << std::endl;
-				out << "          ";
-				other.PrintOpcode(out, i, b);
-				out << std::endl;
+				*out << "    - instruction missing in first @ [" << i  << "]<->[" << j << "]:" << '\n';
+				*out << "          ";
+				other.PrintOpcode(*out, i, b);
+				*out << '\n';
 				--i;
 			}
 			else
 			{
-				out << "    - different instructions @ [" << i  << "]<->[" << j << "]:" << std::endl;
-				
-				out << "          ";
-				PrintOpcode(out, i, a);
-				out << std::endl;
+				*out << "    - different instructions @ [" << i  << "]<->[" << j << "]:" << '\n';
+
+				*out << "          ";
+				PrintOpcode(*out, i, a);
+				*out << '\n';
 
-				out << "          ";
-				other.PrintOpcode(out, i, b);
-				out << std::endl;
+				*out << "          ";
+				other.PrintOpcode(*out, i, b);
+				*out << '\n';
 
 				if (a.op != b.op)
 					break;
@@ -360,4 +393,123 @@ bool NutFunction::DoCompare( const NutFunction& other, const LString& parentName
 	}
 
 	return functionsOk && literalsOk && parametersOk && outerValuesOk && instructionsOk;
-}
\ No newline at end of file
+}
+
+
+// ***************************************************************************************************************
+// Pairs of functions to compare in order in which their reports are printed - nested functions before their parent.
+// Nested functions of pair with different number of them are not paired.
+struct ComparePair
+{
+	const NutFunction* first;
+	const NutFunction* second;
+	LString name;
+};
+
+void NutFunction::CollectComparePairs( const NutFunction& other, const LString& parentName, bool names, std::vector<ComparePair>& pairs ) const
+{
+	LString name;
+
+	if (names)
+	{
+		if (!parentName.empty())
+			name.append(parentName).append(L"::");
+
+		if (!m_Name.empty())
+			name.append(m_Name);
+		else
+			name.append('[').append(m_FunctionIndex).append(']');
+	}
+
+	if (m_Functions.size() == other.m_Functions.size())
+		for(size_t i = 0; i < m_Functions.size(); ++i)
+			m_Functions[i].CollectComparePairs(other.m_Functions[i], name, names, pairs);
+
+	ComparePair pair;
+	pair.first = this;
+	pair.second = &other;
+	pair.name = name;
+	pairs.push_back(pair);
+}
+
+
+// ***************************************************************************************************************
+bool NutFunction::DoCompare( const NutFunction& other, TextWriter* out, ThreadPool* pool ) const
+{
+	std::vector<ComparePair> pairs;
+	CollectComparePairs(other, LString(), out != NULL, pairs);
+
+	if (!pool || pool->GetThreadCount() == 1 || pairs.size() < 2)
+	{
+		bool result = true;
+		for(std::vector<ComparePair>::const_iterator i = pairs.begin(); i != pairs.end(); ++i)
+			if (!i->first->CompareOwn(*i->second, i->name, out))
+			{
+				result = false;
+				if (!out)
+					break;
+			}
+
+		return result;
+	}
+
+	// Functions are compared on pool, reports are kept per function and printed in order afterwards. Without report
+	// first difference found stops comparisons that did not start yet. Only tasks of this comparison are waited for,
+	// pool may be shared with other work.
+	std::vector<std::string> reports(out ? pairs.size() : 0);
+	std::atomic<bool> different(false);
+
+	std::mutex mutex;
+	std::condition_variable finished;
+	size_t remaining = pairs.size();
+	std::exception_ptr error;
+
+	for(size_t i = 0; i < pairs.size(); ++i)
+	{
+		const ComparePair* pair = &pairs[i];
+		std::string* report = out ? &reports[i] : NULL;
+
+		pool->Submit([pair, report, &different, &mutex, &finished, &remaining, &error]
+		{
+			std::exception_ptr pairError;
+
+			try
+			{
+				if (report || !different)
+				{
+					TextWriter pairOut;
+					if (!pair->first->CompareOwn(*pair->second, pair->name, report ? &pairOut : NULL))
+						different = true;
+
+					if (report)
+						*report = pairOut.GetText();
+				}
+			}
+			catch(...)
+			{
+				pairError = std::current_exception();
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (pairError && !error)
+				error = pairError;
+
+			if (--remaining == 0)
+				finished.notify_all();
+		}, pair->first->GetWeight());
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [&remaining] { return remaining == 0; });
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+
+	if (out)
+		for(std::vector<std::string>::const_iterator i = reports.begin(); i != reports.end(); ++i)
+			out->Write(i->data(), i->size());
+
+	return !different;
+}
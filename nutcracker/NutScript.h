@@ -1,7 +1,11 @@
 ﻿#pragma once
 #include "SqObject.h"
 #include "Expressions.h"
-extern bool g_DebugMode;
+
+class Statement;
+struct PrerenderSlot;
+struct ComparePair;
+class ThreadPool;
 
 // ****************************************************************************************************************************
 class NutFunction
@@ -57,15 +61,43 @@ private:
 	int m_VarParams;
 
 	std::vector<SqObject> m_Literals;
+	std::vector<ConstantExpression::TextPtr> m_LiteralTexts;	// Source text of m_Literals rendered once
 	std::vector<LString> m_Parameters;
 	std::vector<OuterValueInfo> m_OuterValues;
 	LocalVarInfos m_Locals;
 	std::vector<LineInfo> m_LineInfos;
 	std::vector<int> m_DefaultParams;
 	std::vector<Instruction> m_Instructions;
+	std::vector<unsigned char> m_Opcodes;		// Opcodes of m_Instructions as separate array for scanning
+	std::vector<int> m_JumpOffsets;				// arg1 (jump offset) of m_Instructions
 	std::vector<NutFunction> m_Functions;
+	const DecompileContext* m_Context;		// Context of script, set when function is loaded
+
+	mutable std::shared_ptr<PrerenderSlot> m_Prerendered;	// Body rendered ahead by FunctionPrerender, if active
 
 	friend class VMState;
+	friend class RegisterLiveness;
+	friend class FunctionPrerender;
+	friend class CommentStatement;
+	friend class DisassemblyStatement;
+
+	// Resumable block frames of iterative decompiler, defined in NutDecompiler.cpp
+	class DecompileFrame;
+	class FunctionBodyFrame;
+	class LogicalOperatorFrame;
+	class ForeachFrame;
+	class TryCatchFrame;
+	class WhileLoopFrame;
+	class IfElseFrame;
+	class DoWhileFrame;
+	class CmpJumpFrame;
+	class SwitchFrame;
+
+	// Table dispatched opcode handlers, see NutDecompiler.cpp
+	struct DecodedInstruction;
+	struct OpcodeDispatch;
+	template< int Code > void DecompileOpcode( VMState& state, const DecodedInstruction& ins ) const;
+	void DecompileUnknownOpcode( VMState& state, const DecodedInstruction& ins ) const;
 
 	void DecompileStatement( VMState& state ) const;
 	void DecompileJumpZeroInstruction( VMState& state, int arg0, int arg1 ) const;
@@ -76,14 +108,32 @@ private:
 	void DecompileAppendArray( VMState& state, int arg0, int arg1, AppendArrayType arg2, int arg3) const;
 	void DecompileJCMP( VMState& state, int end, int offsetIp, int begin, int cmpOp) const;
 
-	void PrintOpcode( std::wostream& out, int pos, const Instruction& op ) const;
+	void PrintOpcode( TextWriter& out, int pos, const Instruction& op ) const;
+	void PrintListing( int n, TextWriter& out, int start = 0 ) const;
+	void GetFunctionsClosedFrom( int start, std::vector<int>& functions ) const;
+	void PrintDisassemblyStub( int n, TextWriter& out, const char* reason, int start ) const;
+	void PrintFailedBody( VMState& state, int n, TextWriter& out, const char* reason ) const;		// called while exception is handled
+	void TakeFailedBody( std::vector< std::shared_ptr<Statement> >& statements, const char* reason ) const;
+
+	bool CompareOwn( const NutFunction& other, const LString& name, TextWriter* out ) const;
+	void CollectComparePairs( const NutFunction& other, const LString& parentName, bool names, std::vector<ComparePair>& pairs ) const;
 
 public:
 	NutFunction()
 	{
 		m_FunctionIndex = -1;
+		m_Context = NULL;
 	}
 
+	const DecompileContext& GetContext( void ) const		{ return *m_Context;	}
+
+	const LString& GetName( void ) const					{ return m_Name;					}
+	size_t GetFunctionCount( void ) const					{ return m_Functions.size();		}
+	size_t GetInstructionCount( void ) const				{ return m_Instructions.size();		}
+
+	// Estimated cost of decompiling own body, without nested functions
+	size_t GetWeight( void ) const		{ return m_Instructions.size() + m_Literals.size();	}
+
 	void SetIndex( int index )
 	{
 		m_FunctionIndex = index;
@@ -91,16 +141,19 @@ public:
 
 	void Load( BinaryReader& reader );
 
-	void GenerateFunctionSource( int n, std::wostream& out, const LString& name, const std::vector< LString >& defaults ) const;
-	void GenerateBodySource( int n, std::wostream& out ) const;
+	void GenerateFunctionSource( int n, TextWriter& out, const LString& name, const std::vector< ExpressionPtr >& defaults ) const;
+	void GenerateBodySource( int n, TextWriter& out, bool streaming = false ) const;		// streaming prints top level statements as soon as they are decompiled
+	void DecompileBody( std::vector< std::shared_ptr<Statement> >& statements ) const;		// final top level statements of body, not printed
 
-	void GenerateFunctionSource( int n, std::wostream& out ) const
+	void GenerateFunctionSource( int n, TextWriter& out ) const
 {	//disasemble a function on the fly
-		std::vector< LString > dummy;
+		std::vector< ExpressionPtr > dummy;
 		GenerateFunctionSource(n, out, m_Name, dummy);
 	}
 
-	bool DoCompare( const NutFunction& other, const LString& parentName, std::wostream& out ) const;
+	// Compares functions recursively, on pool if given. Differences are described to out, without out comparison stops
+	// at first difference.
+	bool DoCompare( const NutFunction& other, TextWriter* out, ThreadPool* pool = NULL ) const;
 
 	const NutFunction* FindFunction( const LString& name ) const;
 	const NutFunction& GetFunction( int i ) const;
@@ -111,11 +164,20 @@ public:
 class NutScript
 {
 	NutFunction m_main;
-	
+	const DecompileContext& m_Context;
+
+	NutScript( const NutScript& );
+	NutScript& operator= ( const NutScript& );
 
 public:
+	explicit NutScript( const DecompileContext& context )
+	: m_Context(context)
+	{
+	}
+
 	void LoadFromFile( const char* );
 	void LoadFromStream( LFile& in );
+	void LoadFromBuffer( const void* data, size_t size );		// data needs to live only during the call
 
 	const NutFunction& GetMain( void ) const	{ return m_main;	}
 };
@@ -0,0 +1,106 @@
+#include "stdafx.h"
+#include "OpcodeScanner.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+	#define NUT_SCAN_SSE2
+	#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+
+// ***************************************************************************************************************
+static inline int LowestBit( unsigned int bits )
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+
+// ***************************************************************************************************************
+static inline void AppendBits( unsigned int bits, int base, std::vector<int>& positions )
+{
+	while(bits)
+	{
+		positions.push_back(base + LowestBit(bits));
+		bits &= bits - 1;
+	}
+}
+
+
+// ***************************************************************************************************************
+static inline bool InSet( unsigned char code, OpcodeMask set )
+{
+	return code < 64 && (set & (1ULL << code)) != 0;
+}
+
+
+// ***************************************************************************************************************
+void FindOpcodes( const unsigned char* opcodes, int count, OpcodeMask set, std::vector<int>& positions )
+{
+	int i = 0;
+
+#ifdef NUT_SCAN_SSE2
+	__m128i codes[64];
+	int codesCount = 0;
+
+	for(int code = 0; code < 64; ++code)
+		if (set & (1ULL << code))
+			codes[codesCount++] = _mm_set1_epi8(static_cast<char>(code));
+
+	for(; i + 16 <= count; i += 16)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(opcodes + i));
+		__m128i match = _mm_setzero_si128();
+
+		for(int c = 0; c < codesCount; ++c)
+			match = _mm_or_si128(match, _mm_cmpeq_epi8(block, codes[c]));
+
+		AppendBits(static_cast<unsigned int>(_mm_movemask_epi8(match)), i, positions);
+	}
+#endif
+
+	for(; i < count; ++i)
+		if (InSet(opcodes[i], set))
+			positions.push_back(i);
+}
+
+
+// ***************************************************************************************************************
+void FindBackwardJumps( const unsigned char* opcodes, const int* offsets, int count, Opcode code, std::vector<int>& positions )
+{
+	int i = 0;
+
+#ifdef NUT_SCAN_SSE2
+	const __m128i codeVec = _mm_set1_epi8(static_cast<char>(code));
+
+	for(; i + 16 <= count; i += 16)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(opcodes + i));
+		unsigned int match = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, codeVec)));
+		if (!match)
+			continue;
+
+		// Sign bits of sixteen jump offsets
+		unsigned int negative = 0;
+		for(int k = 0; k < 4; ++k)
+		{
+			__m128i offs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(offsets + i + k * 4));
+			negative |= static_cast<unsigned int>(_mm_movemask_ps(_mm_castsi128_ps(offs))) << (k * 4);
+		}
+
+		AppendBits(match & negative, i, positions);
+	}
+#endif
+
+	for(; i < count; ++i)
+		if (opcodes[i] == code && offsets[i] < 0)
+			positions.push_back(i);
+}
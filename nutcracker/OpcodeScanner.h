@@ -0,0 +1,20 @@
+#pragma once
+#include "enums.h"
+
+// ************************************************************************************************************************************
+// Scanning of opcode byte array kept next to instructions (structure of arrays layout). Scans are vectorized
+// with SSE2 where available, so pattern discovery over large functions runs at memory speed.
+
+// Set of opcodes - all opcodes known to decompiler fit into 64 bits
+typedef unsigned long long OpcodeMask;
+
+constexpr OpcodeMask OpcodeBit( Opcode code )
+{
+	return 1ULL << code;
+}
+
+// Appends to positions indices of all instructions which opcode belongs to the set
+void FindOpcodes( const unsigned char* opcodes, int count, OpcodeMask set, std::vector<int>& positions );
+
+// Appends to positions indices of all instructions with given opcode and negative jump offset
+void FindBackwardJumps( const unsigned char* opcodes, const int* offsets, int count, Opcode code, std::vector<int>& positions );
@@ -0,0 +1,106 @@
+#pragma once
+#include "enums.h"
+
+// ************************************************************************************************************************************
+// Compile time description of stack register usage of every opcode argument.
+// Arguments not marked as register are literal indices, immediates or jump offsets.
+enum OpcodeArgMask : unsigned char
+{
+	ARG_NONE = 0x00,
+	ARG_0 = 0x01,
+	ARG_1 = 0x02,
+	ARG_2 = 0x04,
+	ARG_3 = 0x08,
+};
+
+enum OpcodeFlags : unsigned char
+{
+	OPF_NONE = 0x00,
+	OPF_JUMP = 0x01,			// arg1 is offset of conditional or unconditional jump (relative to next instruction)
+	OPF_NO_FALLTHROUGH = 0x02,	// execution never continues with next instruction
+	OPF_OPERANDS = 0x04,		// register usage depends on operand values - decoded by RegisterLiveness
+	OPF_UNKNOWN = 0x08,			// opcode not known to decompiler - any register may be used
+};
+
+struct OpcodeTraits
+{
+	unsigned char reads;		// ARG_x mask of arguments read as stack registers
+	unsigned char writes;		// ARG_x mask of arguments written as stack registers
+	unsigned char flags;		// OPF_x flags
+};
+
+// ************************************************************************************************************************************
+constexpr OpcodeTraits OpcodeTraitsTable[] =
+{
+	/* OP_LINE			*/	{ ARG_NONE,					ARG_NONE,		OPF_NONE },
+	/* OP_LOAD			*/	{ ARG_NONE,					ARG_0,			OPF_NONE },
+	/* OP_LOADINT		*/	{ ARG_NONE,					ARG_0,			OPF_NONE },
+	/* OP_LOADFLOAT		*/	{ ARG_NONE,					ARG_0,			OPF_NONE },
+	/* OP_DLOAD			*/	{ ARG_NONE,					ARG_0 | ARG_2,	OPF_NONE },
+	/* OP_TAILCALL		*/	{ ARG_1,					ARG_0,			OPF_OPERANDS },
+	/* OP_CALL			*/	{ ARG_1,					ARG_0,			OPF_OPERANDS },
+	/* OP_PREPCALL		*/	{ ARG_1 | ARG_2,			ARG_0 | ARG_3,	OPF_NONE },
+	/* OP_PREPCALLK		*/	{ ARG_2,					ARG_0 | ARG_3,	OPF_NONE },
+	/* OP_GETK			*/	{ ARG_2,					ARG_0,			OPF_NONE },
+	/* OP_MOVE			*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_NEWSLOT		*/	{ ARG_1 | ARG_2 | ARG_3,	ARG_0,			OPF_NONE },
+	/* OP_DELETE		*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_SET			*/	{ ARG_1 | ARG_2 | ARG_3,	ARG_0,			OPF_NONE },
+	/* OP_GET			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_EQ			*/	{ ARG_2,					ARG_0,			OPF_OPERANDS },
+	/* OP_NE			*/	{ ARG_2,					ARG_0,			OPF_OPERANDS },
+	/* OP_ADD			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_SUB			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_MUL			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_DIV			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_MOD			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_BITW			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_RETURN		*/	{ ARG_1,					ARG_NONE,		OPF_NO_FALLTHROUGH },
+	/* OP_LOADNULLS		*/	{ ARG_NONE,					ARG_NONE,		OPF_OPERANDS },
+	/* OP_LOADROOT		*/	{ ARG_NONE,					ARG_0,			OPF_NONE },
+	/* OP_LOADBOOL		*/	{ ARG_NONE,					ARG_0,			OPF_NONE },
+	/* OP_DMOVE			*/	{ ARG_1 | ARG_3,			ARG_0 | ARG_2,	OPF_NONE },
+	/* OP_JMP			*/	{ ARG_NONE,					ARG_NONE,		OPF_JUMP | OPF_NO_FALLTHROUGH },
+	/* OP_JCMP			*/	{ ARG_0 | ARG_2,			ARG_NONE,		OPF_JUMP },
+	/* OP_JZ			*/	{ ARG_0,					ARG_NONE,		OPF_JUMP },
+	/* OP_SETOUTER		*/	{ ARG_2,					ARG_0,			OPF_NONE },
+	/* OP_GETOUTER		*/	{ ARG_NONE,					ARG_0,			OPF_NONE },
+	/* OP_NEWOBJ		*/	{ ARG_NONE,					ARG_0,			OPF_OPERANDS },
+	/* OP_APPENDARRAY	*/	{ ARG_0,					ARG_NONE,		OPF_OPERANDS },
+	/* OP_COMPARITH		*/	{ ARG_2,					ARG_0,			OPF_OPERANDS },
+	/* OP_INC			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_INCL			*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_PINC			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_PINCL			*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_CMP			*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_EXISTS		*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_INSTANCEOF	*/	{ ARG_1 | ARG_2,			ARG_0,			OPF_NONE },
+	/* OP_AND			*/	{ ARG_2,					ARG_0,			OPF_JUMP },
+	/* OP_OR			*/	{ ARG_2,					ARG_0,			OPF_JUMP },
+	/* OP_NEG			*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_NOT			*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_BWNOT			*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_CLOSURE		*/	{ ARG_NONE,					ARG_0,			OPF_OPERANDS },
+	/* OP_YIELD			*/	{ ARG_1,					ARG_NONE,		OPF_NONE },
+	/* OP_RESUME		*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_FOREACH		*/	{ ARG_0,					ARG_NONE,		OPF_JUMP | OPF_OPERANDS },
+	/* OP_POSTFOREACH	*/	{ ARG_0,					ARG_NONE,		OPF_JUMP },
+	/* OP_CLONE			*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_TYPEOF		*/	{ ARG_1,					ARG_0,			OPF_NONE },
+	/* OP_PUSHTRAP		*/	{ ARG_NONE,					ARG_NONE,		OPF_JUMP },
+	/* OP_POPTRAP		*/	{ ARG_NONE,					ARG_NONE,		OPF_NONE },
+	/* OP_THROW			*/	{ ARG_0,					ARG_NONE,		OPF_NO_FALLTHROUGH },
+	/* OP_NEWSLOTA		*/	{ ARG_1 | ARG_2 | ARG_3,	ARG_NONE,		OPF_OPERANDS },
+	/* OP_GETBASE		*/	{ ARG_NONE,					ARG_0,			OPF_NONE },
+	/* OP_CLOSE			*/	{ ARG_NONE,					ARG_NONE,		OPF_NONE },
+};
+
+static_assert(sizeof(OpcodeTraitsTable) / sizeof(OpcodeTraitsTable[0]) == OP_CLOSE + 1, "Opcode traits table does not match Opcode enum.");
+
+constexpr OpcodeTraits UnknownOpcodeTraits = { ARG_NONE, ARG_NONE, OPF_UNKNOWN };
+
+// ************************************************************************************************************************************
+constexpr const OpcodeTraits& GetOpcodeTraits( unsigned int code )
+{
+	return (code <= OP_CLOSE) ? OpcodeTraitsTable[code] : UnknownOpcodeTraits;
+}
@@ -0,0 +1,227 @@
+#include "stdafx.h"
+#include "NutScript.h"
+#include "RegisterLiveness.h"
+#include "OpcodeScanner.h"
+
+
+// ***************************************************************************************************************
+RegisterLiveness::RegisterLiveness( const NutFunction& function )
+: m_Function(function)
+{
+}
+
+
+// ***************************************************************************************************************
+void RegisterLiveness::PrepareTrapHandlers( void )
+{
+	// Instructions between OP_PUSHTRAP and OP_POPTRAP may continue in exception handler
+	const std::vector<NutFunction::Instruction>& code = m_Function.m_Instructions;
+	const int count = (int)code.size();
+	std::vector<int> traps, handlers;
+
+	m_TrapHandler.assign(count, -1);
+	FindOpcodes(m_Function.m_Opcodes.data(), count, OpcodeBit(OP_PUSHTRAP) | OpcodeBit(OP_POPTRAP), traps);
+
+	for(size_t t = 0; t < traps.size(); ++t)
+	{
+		const int ip = traps[t];
+
+		if (code[ip].op == OP_PUSHTRAP)
+			handlers.push_back(ip + 1 + code[ip].arg1);
+		else if (!handlers.empty())
+			handlers.pop_back();
+
+		// Handler stays active for instructions up to (and including) next trap instruction
+		if (!handlers.empty())
+		{
+			const int end = (t + 1 < traps.size()) ? traps[t + 1] + 1 : count;
+			std::fill(m_TrapHandler.begin() + ip + 1, m_TrapHandler.begin() + end, handlers.back());
+		}
+	}
+}
+
+
+// ***************************************************************************************************************
+void RegisterLiveness::GetUsage( int ip, RegisterSet& reads, RegisterSet& writes ) const
+{
+	const NutFunction::Instruction& op = m_Function.m_Instructions[ip];
+	const OpcodeTraits& traits = GetOpcodeTraits(op.op);
+	const int stackSize = std::min(m_Function.m_StackSize, 0x100);
+
+	reads.reset();
+	writes.reset();
+
+	if (traits.flags & OPF_UNKNOWN)
+	{
+		// Nothing known about this instruction - everything may be read
+		reads.set();
+		return;
+	}
+
+	int args[4] =
+	{
+		static_cast<unsigned char>(op.arg0),
+		op.arg1,
+		static_cast<unsigned char>(op.arg2),
+		static_cast<unsigned char>(op.arg3)
+	};
+
+	auto read = [&]( int reg ) { if (reg >= 0 && reg < stackSize) reads.set(reg); };
+	auto write = [&]( int reg ) { if (reg >= 0 && reg < stackSize) writes.set(reg); };
+
+	for(int i = 0; i < 4; ++i)
+	{
+		if (traits.reads & (1 << i))
+			read(args[i]);
+
+		if (traits.writes & (1 << i))
+			write(args[i]);
+	}
+
+	if (traits.flags & OPF_OPERANDS)
+	{
+		switch(op.op)
+		{
+			case OP_TAILCALL:
+			case OP_CALL:
+				for(int i = 0; i < args[3]; ++i)
+					read(args[2] + i);
+				break;
+
+			case OP_NEWSLOTA:
+				// Class member attributes are stored just before the key
+				if (args[0] & 0x01)
+					read(args[2] - 1);
+				break;
+
+			case OP_EQ:
+			case OP_NE:
+				if (args[3] == 0)
+					read(args[1]);
+				break;
+
+			case OP_LOADNULLS:
+				for(int i = 0; i < args[1]; ++i)
+					write(args[0] + i);
+				break;
+
+			case OP_NEWOBJ:
+				read(args[1]);
+				read(args[2]);
+				break;
+
+			case OP_APPENDARRAY:
+				if (args[2] == AAT_STACK)
+				{
+					read(args[1]);
+				}
+				else if (args[2] > AAT_BOOL)
+				{
+					read(args[1]);
+					read(stackSize - 1);
+				}
+				break;
+
+			case OP_COMPARITH:
+				read(((unsigned int)args[1]) >> 16);
+				read(args[1] & 0x0000ffff);
+				break;
+
+			case OP_CLOSURE:
+				if (args[1] >= 0 && args[1] < (int)m_Function.m_Functions.size())
+				{
+					const NutFunction& closure = m_Function.m_Functions[args[1]];
+					for(std::vector<int>::const_iterator i = closure.m_DefaultParams.begin(); i != closure.m_DefaultParams.end(); ++i)
+						read(*i);
+
+					for(std::vector<NutFunction::OuterValueInfo>::const_iterator i = closure.m_OuterValues.begin(); i != closure.m_OuterValues.end(); ++i)
+						if (i->type == NutFunction::OuterValueInfo::otLOCAL && i->src.GetType() == OT_INTEGER)
+							read(i->src.GetInteger());
+				}
+				else
+				{
+					reads.set();
+				}
+				break;
+
+			case OP_FOREACH:
+				// Iteration state is both read and updated in place
+				read(args[2]);
+				read(args[2] + 1);
+				read(args[2] + 2);
+				break;
+		}
+	}
+}
+
+
+// ***************************************************************************************************************
+int RegisterLiveness::GetSuccessors( int ip, int* succ ) const
+{
+	const NutFunction::Instruction& op = m_Function.m_Instructions[ip];
+	const OpcodeTraits& traits = GetOpcodeTraits(op.op);
+	const int count = (int)m_Function.m_Instructions.size();
+	int n = 0;
+
+	if (!(traits.flags & OPF_NO_FALLTHROUGH) && (ip + 1) < count)
+		succ[n++] = ip + 1;
+
+	if (traits.flags & OPF_JUMP)
+	{
+		int dest = ip + 1 + op.arg1;
+		if (dest >= 0 && dest < count)
+			succ[n++] = dest;
+	}
+
+	if (m_TrapHandler[ip] >= 0 && m_TrapHandler[ip] < count)
+		succ[n++] = m_TrapHandler[ip];
+
+	return n;
+}
+
+
+// ***************************************************************************************************************
+void RegisterLiveness::Analyze( void )
+{
+	const int count = (int)m_Function.m_Instructions.size();
+
+	PrepareTrapHandlers();
+	m_LiveIn.assign(count, RegisterSet());
+
+	// Register usage does not change between iterations - decode it once
+	std::vector<RegisterSet> reads(count), writes(count);
+	for(int ip = 0; ip < count; ++ip)
+		GetUsage(ip, reads[ip], writes[ip]);
+
+	// Local variable declaration consumes value that initializes it
+	for(std::vector<NutFunction::LocalVarInfo>::const_iterator i = m_Function.m_Locals.begin(); i != m_Function.m_Locals.end(); ++i)
+		if (i->start_op >= 0 && i->start_op < count && i->pos >= 0 && i->pos <= 0xFF)
+			reads[i->start_op].set(i->pos);
+
+	// Backward dataflow: in = reads | (out & ~writes), iterated till fixed point (loops need extra passes)
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+
+		for(int ip = count - 1; ip >= 0; --ip)
+		{
+			int succ[3];
+			int n = GetSuccessors(ip, succ);
+
+			RegisterSet live;
+			for(int i = 0; i < n; ++i)
+				live |= m_LiveIn[succ[i]];
+
+			live &= ~writes[ip];
+			live |= reads[ip];
+
+			if (live != m_LiveIn[ip])
+			{
+				m_LiveIn[ip] = live;
+				changed = true;
+			}
+		}
+	}
+}
+
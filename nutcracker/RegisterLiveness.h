@@ -0,0 +1,41 @@
+#pragma once
+#include <bitset>
+#include "OpcodeTraits.h"
+
+class NutFunction;
+
+// ************************************************************************************************************************************
+// Def-use and liveness of stack registers for single function, computed by backward dataflow over
+// instruction level control flow graph. Registers are reported live conservatively - when register
+// is reported dead it is never read before next write on any path.
+class RegisterLiveness
+{
+public:
+	typedef std::bitset<256> RegisterSet;
+
+private:
+	const NutFunction& m_Function;
+	std::vector<RegisterSet> m_LiveIn;		// Registers live before each instruction
+	std::vector<int> m_TrapHandler;			// Innermost exception handler for instruction or -1
+
+	void PrepareTrapHandlers( void );
+	void GetUsage( int ip, RegisterSet& reads, RegisterSet& writes ) const;
+	int GetSuccessors( int ip, int* succ ) const;
+
+	RegisterLiveness( const RegisterLiveness& ) = delete;
+	RegisterLiveness& operator = ( const RegisterLiveness& ) = delete;
+
+public:
+	explicit RegisterLiveness( const NutFunction& function );
+
+	void Analyze( void );
+
+	// True when value of register may be read by instruction at ip or any instruction reachable from it
+	bool IsLiveAt( int ip, int reg ) const
+	{
+		if (ip < 0 || ip >= (int)m_LiveIn.size() || reg < 0 || reg > 0xFF)
+			return false;
+
+		return m_LiveIn[ip].test(reg);
+	}
+};
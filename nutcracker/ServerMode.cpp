@@ -0,0 +1,302 @@
+#include "stdafx.h"
+#include "ServerMode.h"
+#include "NutScript.h"
+#include "ThreadPool.h"
+#include "FunctionPrerender.h"
+#include "FileUtils.h"
+#include "JsonLine.h"
+#include <map>
+#include <list>
+
+static const size_t ScriptCacheSize = 16;
+
+
+// ************************************************************************************************************************************
+static void DecodeBase64( const std::string& text, std::vector<char>& data )
+{
+	data.clear();
+	data.reserve(text.size() / 4 * 3);
+
+	unsigned int bits = 0;
+	int count = 0;
+
+	for(std::string::const_iterator i = text.begin(); i != text.end(); ++i)
+	{
+		char c = *i;
+		unsigned int value;
+
+		if (c >= 'A' && c <= 'Z')
+			value = c - 'A';
+		else if (c >= 'a' && c <= 'z')
+			value = c - 'a' + 26;
+		else if (c >= '0' && c <= '9')
+			value = c - '0' + 52;
+		else if (c == '+')
+			value = 62;
+		else if (c == '/')
+			value = 63;
+		else if (c == '=')
+			break;
+		else
+			throw Error("Invalid base64 data.");
+
+		bits = (bits << 6) | value;
+		count += 6;
+
+		if (count >= 8)
+		{
+			count -= 8;
+			data.push_back((char)((bits >> count) & 0xFF));
+		}
+	}
+}
+
+
+// ************************************************************************************************************************************
+// Loaded script kept while its file is unchanged
+struct CachedScript
+{
+	std::string path;
+	std::string localeName;
+	FileStamp stamp;
+	std::shared_ptr<const NutScript> script;
+};
+
+
+// ************************************************************************************************************************************
+class Server
+{
+private:
+	std::string m_LocaleName;
+	size_t m_InstructionBudget;
+	size_t m_TimeBudget;
+	ThreadPool m_Pool;
+	std::map< std::string, std::unique_ptr<DecompileContext> > m_Contexts;
+	std::list<CachedScript> m_Scripts;			// Most recently used first
+
+	const DecompileContext& GetContext( const std::string& localeName );
+	std::shared_ptr<const NutScript> GetScript( const JsonObject& request, const char* fileKey, const char* dataKey );
+
+	void Decompile( const JsonObject& request, JsonWriter& reply );
+	void DecompileFunction( const JsonObject& request, JsonWriter& reply );
+	void Compare( const JsonObject& request, JsonWriter& reply );
+
+public:
+	Server( const char* localeName, size_t threads, size_t instructionBudget, size_t timeBudget )
+	: m_LocaleName(localeName)
+	, m_InstructionBudget(instructionBudget)
+	, m_TimeBudget(timeBudget)
+	, m_Pool(threads)
+	{
+	}
+
+	// Returns false when server should stop
+	bool Handle( const std::string& line, std::string& replyLine );
+};
+
+
+// ************************************************************************************************************************************
+const DecompileContext& Server::GetContext( const std::string& localeName )
+{
+	std::unique_ptr<DecompileContext>& context = m_Contexts[localeName];
+	if (!context)
+	{
+		try
+		{
+			context.reset(new DecompileContext(localeName.c_str()));
+			context->SetBudget(m_InstructionBudget, m_TimeBudget);
+		}
+		catch(...)
+		{
+			m_Contexts.erase(localeName);
+			throw;
+		}
+	}
+
+	return *context;
+}
+
+
+// ************************************************************************************************************************************
+// Script of request - loaded from base64 data, or from file through cache. Script is shared, so that it stays valid
+// when later call of the same request drops it from cache.
+std::shared_ptr<const NutScript> Server::GetScript( const JsonObject& request, const char* fileKey, const char* dataKey )
+{
+	std::string localeName = request.GetString("locale", m_LocaleName.c_str());
+	const DecompileContext& context = GetContext(localeName);
+
+	if (request.Has(dataKey))
+	{
+		std::vector<char> data;
+		DecodeBase64(request.GetString(dataKey), data);
+
+		std::shared_ptr<NutScript> script = std::make_shared<NutScript>(context);
+		script->LoadFromBuffer(data.data(), data.size());
+		return script;
+	}
+
+	if (!request.Has(fileKey))
+		throw Error("Request needs \"%s\" or \"%s\".", fileKey, dataKey);
+
+	std::string path = request.GetString(fileKey);
+
+	FileStamp stamp;
+	if (!GetFileStamp(path, stamp))
+		throw Error("Unable to open file: \"%s\"", path.c_str());
+
+	for(std::list<CachedScript>::iterator i = m_Scripts.begin(); i != m_Scripts.end(); ++i)
+	{
+		if (i->path != path || i->localeName != localeName)
+			continue;
+
+		if (!(i->stamp == stamp))
+		{
+			m_Scripts.erase(i);
+			break;
+		}
+
+		m_Scripts.splice(m_Scripts.begin(), m_Scripts, i);
+		return m_Scripts.front().script;
+	}
+
+	CachedScript entry;
+	entry.path = path;
+	entry.localeName = localeName;
+	entry.stamp = stamp;
+	std::shared_ptr<NutScript> script = std::make_shared<NutScript>(context);
+	script->LoadFromFile(path.c_str());
+	entry.script = script;
+
+	m_Scripts.push_front(std::move(entry));
+	if (m_Scripts.size() > ScriptCacheSize)
+		m_Scripts.pop_back();
+
+	return script;
+}
+
+
+// ************************************************************************************************************************************
+void Server::Decompile( const JsonObject& request, JsonWriter& reply )
+{
+	std::shared_ptr<const NutScript> script = GetScript(request, "file", "data");
+
+	TextWriter out;
+	{
+		FunctionPrerender prerender(script->GetMain(), m_Pool);
+		script->GetMain().GenerateBodySource(0, out);
+	}
+
+	reply.Add("source", out.GetText());
+}
+
+
+// ************************************************************************************************************************************
+void Server::DecompileFunction( const JsonObject& request, JsonWriter& reply )
+{
+	std::shared_ptr<const NutScript> script = GetScript(request, "file", "data");
+
+	std::string name = request.GetString("name");
+	const NutFunction* function = script->GetMain().FindFunction(LString::fromUtf8(name));
+	if (!function)
+		throw Error("Unable to find function \"%s\".", name.c_str());
+
+	TextWriter out;
+	{
+		FunctionPrerender prerender(*function, m_Pool);
+		function->GenerateFunctionSource(0, out);
+	}
+
+	reply.Add("source", out.GetText());
+}
+
+
+// ************************************************************************************************************************************
+void Server::Compare( const JsonObject& request, JsonWriter& reply )
+{
+	if (request.Has("data"))
+		throw Error("Compare takes \"data1\" and \"data2\" instead of \"data\".");
+
+	std::shared_ptr<const NutScript> s1 = GetScript(request, "file1", "data1");
+	std::shared_ptr<const NutScript> s2 = GetScript(request, "file2", "data2");
+
+	if (request.GetBool("report", false))
+	{
+		TextWriter out;
+		bool equal = s1->GetMain().DoCompare(s2->GetMain(), &out, &m_Pool);
+		reply.Add("equal", equal);
+		reply.Add("report", out.GetText());
+	}
+	else
+	{
+		reply.Add("equal", s1->GetMain().DoCompare(s2->GetMain(), NULL, &m_Pool));
+	}
+}
+
+
+// ************************************************************************************************************************************
+bool Server::Handle( const std::string& line, std::string& replyLine )
+{
+	JsonObject request;
+	bool running = true;
+
+	try
+	{
+		request.Parse(line);
+
+		// Reply of failed request is built anew, so that it carries no partial result
+		JsonWriter reply;
+		reply.AddRaw("id", request.GetRaw("id"));
+		reply.Add("ok", true);
+
+		std::string command = request.GetString("cmd");
+
+		if (command == "decompile")
+			Decompile(request, reply);
+		else if (command == "function")
+			DecompileFunction(request, reply);
+		else if (command == "compare")
+			Compare(request, reply);
+		else if (command == "quit")
+			running = false;
+		else
+			throw Error("Unknown command \"%s\".", command.c_str());
+
+		replyLine = reply.Finish();
+	}
+	catch( std::exception& ex )
+	{
+		JsonWriter failure;
+		failure.AddRaw("id", request.GetRaw("id"));
+		failure.Add("ok", false);
+		failure.Add("error", ex.what());
+		replyLine = failure.Finish();
+	}
+
+	return running;
+}
+
+
+// ************************************************************************************************************************************
+int RunServer( const char* localeName, size_t threads, size_t instructionBudget, size_t timeBudget )
+{
+	Server server(localeName, threads, instructionBudget, timeBudget);
+	std::string line;
+
+	while(std::getline(std::cin, line))
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos)
+			continue;
+
+		std::string reply;
+		bool running = server.Handle(line, reply);
+
+		reply += '\n';
+		fwrite(reply.data(), 1, reply.size(), stdout);
+		fflush(stdout);
+
+		if (!running)
+			break;
+	}
+
+	return 0;
+}
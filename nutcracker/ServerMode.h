@@ -0,0 +1,17 @@
+#pragma once
+
+// ************************************************************************************************************************************
+// Server mode - requests are read from standard input, one JSON object per line, and each is answered by one JSON line
+// on standard output. Thread pool, locale contexts and recently loaded scripts are kept between requests.
+//
+//   {"id":1, "cmd":"decompile", "file":"a.nut"}                     -> {"id":1, "ok":true, "source":"..."}
+//   {"id":2, "cmd":"decompile", "data":"<base64>"}                  -> {"id":2, "ok":true, "source":"..."}
+//   {"id":3, "cmd":"function", "file":"a.nut", "name":"a::b"}       -> {"id":3, "ok":true, "source":"..."}
+//   {"id":4, "cmd":"compare", "file1":"a.nut", "file2":"b.nut"}     -> {"id":4, "ok":true, "equal":false}
+//   {"id":5, "cmd":"compare", "file1":"a.nut", "data2":"<base64>"}  -> {"id":5, "ok":true, "equal":true}
+//   {"id":6, "cmd":"quit"}                                          -> {"id":6, "ok":true}
+//
+// "locale" selects locale of multibyte strings per request, "report":true adds differences to compare reply. Failed
+// request is answered with {"id":..., "ok":false, "error":"..."}. Returns when input ends or on quit. Budget of
+// decompilation applies to every request (see DecompileContext::SetBudget).
+int RunServer( const char* localeName, size_t threads, size_t instructionBudget, size_t timeBudget );
@@ -0,0 +1,308 @@
+#include "stdafx.h"
+#include "ShardedOutput.h"
+#include "Statements.h"
+#include "ThreadPool.h"
+#include "FunctionPrerender.h"
+#include "FileUtils.h"
+#include <set>
+#include <map>
+
+
+// ************************************************************************************************************************************
+// Part of output - either single definition written to its own file or run of statements kept in index
+struct Shard
+{
+	std::vector<StatementPtr> statements;
+	std::string fileName;		// Empty for statements kept in index
+	std::string text;			// Rendered statements kept in index
+	size_t localCount;			// Top level locals declared before definition
+
+	Shard() : localCount(0) {}
+};
+
+
+// ************************************************************************************************************************************
+// Top level locals of index in order of declaration. File loaded by dofile does not see them, so that definition
+// using any of them stays in index.
+struct TopLevelLocals
+{
+	std::map<std::string, size_t> declared;		// Name to index of its first declaration
+
+	void Add( const LString& name )
+	{
+		declared.insert(std::make_pair(name.toUtf8(), declared.size()));
+	}
+
+	// Identifiers of rendered text are looked up, member names (after '.' or "::"), strings and comments are skipped.
+	// Same name used for something else only keeps definition in index, which is always correct.
+	bool UsedBy( const std::string& text, size_t localCount ) const
+	{
+		for(size_t pos = 0; pos < text.size(); )
+		{
+			char c = text[pos];
+
+			if (c == '"')
+			{
+				for(++pos; pos < text.size() && text[pos] != '"'; ++pos)
+					if (text[pos] == '\\')
+						++pos;
+
+				++pos;
+			}
+			else if (c == '/' && pos + 1 < text.size() && text[pos + 1] == '/')
+			{
+				pos = text.find('\n', pos);
+			}
+			else if (c == '_' || isalpha((unsigned char)c))
+			{
+				size_t start = pos;
+				while(pos < text.size() && (text[pos] == '_' || isalnum((unsigned char)text[pos])))
+					++pos;
+
+				if (start > 0 && (text[start - 1] == '.' || text[start - 1] == ':'))
+					continue;
+
+				std::map<std::string, size_t>::const_iterator i = declared.find(text.substr(start, pos - start));
+				if (i != declared.end() && i->second < localCount)
+					return true;
+			}
+			else
+			{
+				++pos;
+			}
+		}
+
+		return false;
+	}
+};
+
+
+// Local of index that holds directory of shard files
+static const char* const ShardPathName = "__shardPath";
+
+
+// ************************************************************************************************************************************
+// Name of defined class, function or table if statement is a top level definition, empty otherwise
+static LString GetDefinitionName( const StatementPtr& statement )
+{
+	if (statement->GetType() != Stat_Expression)
+		return LString();
+
+	ExpressionPtr exp = static_pointer_cast<ExpressionStatement>(statement)->GetExpression();
+
+	if (exp->GetType() == Exp_NewClassExpression)
+		return static_pointer_cast<NewClassExpression>(exp)->GetName();
+
+	if (exp->GetType() == Exp_Function)
+		return static_pointer_cast<FunctionExpression>(exp)->GetName();
+
+	if (!exp->IsOperator())
+		return LString();
+
+	shared_ptr<OperatorExpression> op = static_pointer_cast<OperatorExpression>(exp);
+	if (op->GetOperatorNode() != OperatorExpression::Node_Binary || (op->GetOperatorType() != '<-' && op->GetOperatorType() != '='))
+		return LString();
+
+	shared_ptr<BinaryOperatorExpression> slot = static_pointer_cast<BinaryOperatorExpression>(op);
+	ExpressionPtr target = slot->GetArg1();
+	int valueType = slot->GetArg2()->GetType();
+
+	if (valueType != Exp_NewTableExpression && valueType != Exp_NewClassExpression && valueType != Exp_Function)
+		return LString();
+
+	if (!target->IsOperator() || static_pointer_cast<OperatorExpression>(target)->GetOperatorType() != OperatorExpression::OPER_ARRAYIND)
+		return LString();
+
+	shared_ptr<ArrayIndexingExpression> deref = static_pointer_cast<ArrayIndexingExpression>(target);
+	if (!deref->IsSimpleMemberDeref())
+		return LString();
+
+	return deref->ToString();
+}
+
+
+// ************************************************************************************************************************************
+// File name for definition - characters not safe in file names are replaced, names differing only in case are
+// told apart by number suffix
+static std::string MakeFileName( const LString& name, std::set<std::string>& usedNames )
+{
+	size_t start = 0;
+	if (name.compare(0, 2, L"::") == 0)
+		start = 2;
+	else if (name.compare(0, 5, L"this.") == 0)
+		start = 5;
+
+	std::string base;
+	for(size_t i = start; i < name.size() && base.size() < 100; ++i)
+	{
+		wchar_t c = name[i];
+		bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.';
+		base += safe ? static_cast<char>(c) : '_';
+	}
+
+	if (base.empty())
+		base = "shard";
+
+	std::string fileName = base + ".nut";
+
+	for(int n = 2; ; ++n)
+	{
+		std::string key = fileName;
+		std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+
+		if (usedNames.insert(key).second && key != "index.nut")
+			return fileName;
+
+		fileName = base + '_' + std::to_string(n) + ".nut";
+	}
+}
+
+
+// ************************************************************************************************************************************
+static void RenderStatements( TextWriter& out, const std::vector<StatementPtr>& statements )
+{
+	BlockStatement::ContentState state;
+
+	for(std::vector<StatementPtr>::const_iterator i = statements.begin(); i != statements.end(); ++i)
+		BlockStatement::GenerateContentStatement(out, 0, *i, state);
+}
+
+
+// ************************************************************************************************************************************
+// Definition that uses top level locals is moved to index
+static void WriteShard( Shard& shard, const std::string& directory, const TopLevelLocals& locals )
+{
+	TextWriter out;
+	RenderStatements(out, shard.statements);
+	shard.text = out.GetText();
+
+	if (shard.fileName.empty())
+		return;
+
+	if (locals.UsedBy(shard.text, shard.localCount))
+	{
+		shard.fileName.clear();
+		return;
+	}
+
+	WriteFileText(directory + '/' + shard.fileName, shard.text);
+	shard.text.clear();
+}
+
+
+// ************************************************************************************************************************************
+// Shard that fails is replaced by comment with the error, so that other shards and index are still written
+static void RenderShard( Shard& shard, const std::string& directory, const TopLevelLocals& locals )
+{
+	std::string failure;
+
+	try
+	{
+		WriteShard(shard, directory, locals);
+		return;
+	}
+	catch( Error& ex )
+	{
+		failure = ex.what();
+	}
+	catch( BadFormatError& ex )
+	{
+		failure = ex.what();
+	}
+
+	std::string stub = "// Decompilation failed: " + failure + '\n';
+
+	if (shard.fileName.empty())
+		shard.text = stub;
+	else
+		WriteFileText(directory + '/' + shard.fileName, stub);
+}
+
+
+// ************************************************************************************************************************************
+void WriteShardedSource( const NutFunction& function, const char* directory, size_t threads )
+{
+	MakeDirectories(directory);
+
+	// Nested functions are decompiled while top level is
+	ThreadPool pool(threads);
+	FunctionPrerender prerender(function, pool);
+
+	std::vector<StatementPtr> statements;
+	function.DecompileBody(statements);
+
+	// Split top level statements to definitions and runs of other statements
+	std::vector<Shard> shards;
+	std::set<std::string> usedNames;
+	TopLevelLocals locals;
+	locals.Add(L"vargv");
+
+	for(std::vector<StatementPtr>::const_iterator i = statements.begin(); i != statements.end(); ++i)
+	{
+		LString name = GetDefinitionName(*i);
+
+		if ((*i)->GetType() == Stat_LocalVar)
+			locals.Add(static_pointer_cast<LocalVarInitStatement>(*i)->GetVarName());
+
+		if (name.empty() && !shards.empty() && shards.back().fileName.empty())
+		{
+			shards.back().statements.push_back(*i);
+			continue;
+		}
+
+		shards.push_back(Shard());
+		shards.back().statements.push_back(*i);
+
+		if (!name.empty())
+		{
+			shards.back().fileName = MakeFileName(name, usedNames);
+			shards.back().localCount = locals.declared.size();
+		}
+	}
+
+	// Render all parts at once, definitions to their files
+	std::string outputDirectory = directory;
+
+	for(std::vector<Shard>::iterator i = shards.begin(); i != shards.end(); ++i)
+	{
+		Shard* shard = &*i;
+		pool.Submit([shard, &outputDirectory, &locals] { RenderShard(*shard, outputDirectory, locals); });
+	}
+
+	pool.Wait();
+
+	// Index keeps order of definitions and other statements. Shard files are loaded from directory of index, which
+	// is found from source name of running script.
+	FILE* file = CreateOutputFile(outputDirectory + "/index.nut");
+	{
+		TextWriter out(file);
+		bool previousInline = true;
+
+		for(std::vector<Shard>::const_iterator i = shards.begin(); i != shards.end(); ++i)
+			if (!i->fileName.empty())
+			{
+				out << "local " << ShardPathName << " = ::getstackinfos(1).src;" << '\n';
+				out << "while (" << ShardPathName << ".len() > 0 && " << ShardPathName << "[" << ShardPathName << ".len() - 1] != '/' && "
+					<< ShardPathName << "[" << ShardPathName << ".len() - 1] != '\\\\')" << '\n';
+				out << '\t' << ShardPathName << " = " << ShardPathName << ".slice(0, -1);" << '\n';
+				previousInline = false;
+				break;
+			}
+
+		for(std::vector<Shard>::const_iterator i = shards.begin(); i != shards.end(); ++i)
+		{
+			bool isInline = i->fileName.empty();
+
+			if ((i != shards.begin() || !previousInline) && (isInline || previousInline))
+				out << '\n';
+
+			if (isInline)
+				out << i->text;
+			else
+				out << "dofile(" << ShardPathName << " + \"" << i->fileName << "\");" << '\n';
+
+			previousInline = isInline;
+		}
+	}
+	fclose(file);
+}
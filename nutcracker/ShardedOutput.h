@@ -0,0 +1,10 @@
+#pragma once
+#include "NutScript.h"
+
+// ************************************************************************************************************************************
+// Sharded output - every top level class, function and table of main function body is written to its own file in output
+// directory. Other top level statements stay in index file (index.nut), which keeps the original order and loads
+// shard files in place of definitions. Shard files are loaded relative to index file and do not see its top level locals,
+// so that definitions using them stay in index. Files are rendered and written in parallel, zero threads means one per
+// hardware thread.
+void WriteShardedSource( const NutFunction& function, const char* directory, size_t threads );
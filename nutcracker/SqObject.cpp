@@ -1,30 +1,9 @@
 ﻿#include "stdafx.h"
 #include "SqObject.h"
+#include "StringEscape.h"
 using namespace std;
 
 
-// ***********************************************************************************************************************
-void PrintEscapedString(wostream& out, const LString& str)
-{
-	for( auto iter = str.begin(); iter != str.end(); ++iter )
-	{
-		switch(*iter)
-		{
-			case '\r':	out << "\\r";			break;
-			case '\n':	out << "\\n";			break;
-			case '\t':	out << "\\t";			break;
-			case '\v':	out << "\\v";			break;
-			case '\a':	out << "\\a";			break;
-			case '\0':	out << "\\0";			break;
-			case '\\':	out << "\\\\";			break;
-			
-			default:
-				out << *iter;
-				break;
-		}
-	}
-}
-
 // ***********************************************************************************************************************
 void SqObject::Load( BinaryReader& reader )
 {
@@ -135,7 +114,7 @@ bool SqObject::operator == ( const SqObject& other ) const
 }
 
 // ***********************************************************************************************************************
-wostream& operator<< (wostream& os, const SqObject& obj)
+TextWriter& operator<< (TextWriter& os, const SqObject& obj)
 {
 	switch (obj.m_type)
 	{
@@ -162,7 +141,7 @@ wostream& operator<< (wostream& os, const SqObject& obj)
 		break;
 
 	case OT_FLOAT:
-		os << std::showpoint << obj.m_float;
+		os.Printf("%#g", obj.m_float);
 		break;
 
 	}
@@ -36,5 +36,5 @@ public:
 		return !(operator == (other));
 	}
 
-	friend std::wostream& operator<< (std::wostream& os, const SqObject& obj);
+	friend TextWriter& operator<< (TextWriter& os, const SqObject& obj);
 };
@@ -1,40 +1,127 @@
 ﻿#include "stdafx.h"
 #include "Statements.h"
+// ********************************************************************************************************
+// Nested statements are printed by tasks on explicit stack, statement without nested ones is printed directly
+void Statement::GenerateCode( TextWriter& out, int n ) const
+{
+	if (!HasNested())
+	{
+		GenerateSimpleCode(out, n);
+		return;
+	}
+
+	std::vector<StatementGenerateTask> tasks(1, StatementGenerateTask(this, n, false));
+	StatementGenerateTask child;
+
+	while(!tasks.empty())
+	{
+		if (tasks.back().statement->GenerateStep(out, tasks.back(), child))
+			tasks.push_back(child);
+		else
+			tasks.pop_back();
+	}
+}
+
+
+// ********************************************************************************************************
+void Statement::GenerateCodeInBlock( TextWriter& out, int n ) const
+{
+	if (IsBlock())
+	{
+		GenerateCode(out, n);
+		return;
+	}
+
+	out << ::indent(n) << '{' << '\n';
+	GenerateCode(out, n + 1);
+	out << ::indent(n) << '}' << '\n';
+}
+
+
+// ********************************************************************************************************
+// Statements are postprocessed depth first - nested statements of statement are replaced by their postprocessed
+// statements in order, then statement itself is finished
+StatementPtr Statement::Postprocess( void )
+{
+	if (!HasNested())
+		return FinishPostprocess();
+
+	struct Pending
+	{
+		StatementPtr* slot;
+		bool expanded;
+	};
+
+	StatementPtr result = shared_from_this();
+	std::vector<Pending> pending;
+	std::vector<StatementPtr*> nested;
+
+	Pending root = { &result, false };
+	pending.push_back(root);
+
+	while(!pending.empty())
+	{
+		StatementPtr* slot = pending.back().slot;
+
+		if (pending.back().expanded)
+		{
+			*slot = (*slot)->FinishPostprocess();
+			pending.pop_back();
+			continue;
+		}
+
+		pending.back().expanded = true;
+
+		nested.clear();
+		(*slot)->GetNestedStatements(nested);
+
+		for( vector<StatementPtr*>::reverse_iterator i = nested.rbegin(); i != nested.rend(); ++i )
+		{
+			Pending item = { *i, false };
+			pending.push_back(item);
+		}
+	}
+
+	return result;
+}
+
+
 // ********************************************************************************************************
 // *** Instructions block postprocessor *******************************************************************
 // ********************************************************************************************************
-StatementPtr BlockStatement::Postprocess( void )
+StatementPtr BlockStatement::FinishPostprocess( void )
 {
-	for( vector< StatementPtr >::iterator i = m_Statements.begin(); i != m_Statements.end(); )
+	// Statements are compacted in place - merged and empty statements are dropped in single pass
+	size_t kept = 0;
+
+	for( size_t i = 0; i < m_Statements.size(); ++i )
 	{
-		*i = (*i)->Postprocess();
+		StatementPtr statement = m_Statements[i];
 
-		if ((*i)->GetType() == Stat_While && i != m_Statements.begin())
+		if (statement->GetType() == Stat_While && kept > 0)
 		{
-			shared_ptr<WhileStatement> whileStatement = static_pointer_cast<WhileStatement>(*i);
-			StatementPtr forStatement = whileStatement->TryGenerateForStatement(i[-1]);
+			shared_ptr<WhileStatement> whileStatement = static_pointer_cast<WhileStatement>(statement);
+			StatementPtr forStatement = whileStatement->TryGenerateForStatement(m_Statements[kept - 1]);
 
 			if (forStatement)
 			{
-				i[-1] = forStatement;
-				i = m_Statements.erase(i);
+				m_Statements[kept - 1] = forStatement;
 				continue;
 			}
 		}
 
-		if ((*i)->IsEmpty())
-		{
-			i = m_Statements.erase(i);
+		if (statement->IsEmpty())
 			continue;
-		}
-		
-		++i;;
+
+		m_Statements[kept++] = std::move(statement);
 	}
 
+	m_Statements.resize(kept);
+
 	if (m_Statements.empty())
 		return EmptyStatement::Get();
 	else if (m_Statements.size() == 1)
 		return m_Statements[0];
 	else
-		return Statement::Postprocess();
+		return shared_from_this();
 }
@@ -4,6 +4,9 @@
 #include "Formatters.h"
 
 using namespace std::tr1;
+
+class NutFunction;
+
 // *******************************************************************************************
 enum StatementType
 {
@@ -18,6 +21,7 @@ enum StatementType
 	Stat_Continue,
 	Stat_Comment,
 	Stat_Case,
+	Stat_Disassembly,
 
 	Stat_BEGIN_LINE_SEPARATED,
 
@@ -32,34 +36,76 @@ enum StatementType
 
 
 // *******************************************************************************************
-class Statement : public enable_shared_from_this<Statement>
+// Blank line separation state between consecutive statements of block content
+struct StatementContentState
 {
-public:
-	virtual int GetType( void ) const = 0;
-	virtual void GenerateCode(std::wostream& out, int indent) const = 0;
+	bool hasPrevious;
+	bool pendingSpace;
+
+	StatementContentState() : hasPrevious(false), pendingSpace(false) {}
+};
+
+class Statement;
 
-	virtual shared_ptr<Statement> Postprocess( void )
+// Code generation of one statement in progress, see Statement::GenerateStep
+struct StatementGenerateTask
+{
+	const Statement* statement;
+	int indent;
+	bool inBlock;						// Statement other than block is wrapped in braces
+	int stage;							// Part of statement printed next, 0 at start
+	const Statement* current;			// If statement of else-if chain being printed
+	StatementContentState content;		// Separation state of block content
+
+	StatementGenerateTask()
+	: statement(NULL), indent(0), inBlock(false), stage(0), current(NULL)
 	{
-		return shared_from_this();
 	}
 
-	bool IsEmpty( void ) const			{ return GetType() == Stat_Empty;		}
-	bool IsExpression( void ) const		{ return GetType() == Stat_Expression;	}
-	bool IsBlock( void ) const			{ return GetType() == Stat_Block;		}
+	StatementGenerateTask( const Statement* statement, int indent, bool inBlock )
+	: statement(statement), indent(indent), inBlock(inBlock), stage(0), current(NULL)
+	{
+	}
+};
+
+
+// *******************************************************************************************
+// Like expressions, statement kind is stored inline and code generation and postprocessing are dispatched by switch
+// over it (see end of file). Both walk nested statements with explicit stack (see Statements.cpp), so that depth of
+// nesting is not limited by call stack - statements containing other statements do their part in steps.
+class Statement : public enable_shared_from_this<Statement>
+{
+private:
+	const int m_Type;
+
+	void GenerateSimpleCode( TextWriter& out, int indent ) const;
 
-	void GenerateCodeInBlock( std::wostream& out, int indent ) const
+protected:
+	explicit Statement( int type )
+	: m_Type(type)
 	{
-		if (IsBlock())
-		{
-			GenerateCode(out, indent);
-		}
-		else
-		{
-			out << ::indent(indent) << '{' << std::endl;
-			GenerateCode(out, indent + 1);
-			out << ::indent(indent) << '}' << std::endl;
-		}
 	}
+
+public:
+	int GetType( void ) const			{ return m_Type;					}
+	void GenerateCode( TextWriter& out, int indent ) const;
+	void GenerateCodeInBlock( TextWriter& out, int indent ) const;
+
+	// Returns statement that replaces this one in final code, statement itself by default
+	shared_ptr<Statement> Postprocess( void );
+
+	bool IsEmpty( void ) const			{ return m_Type == Stat_Empty;		}
+	bool IsExpression( void ) const		{ return m_Type == Stat_Expression;	}
+	bool IsBlock( void ) const			{ return m_Type == Stat_Block;		}
+	bool HasNested( void ) const		{ return m_Type == Stat_Block || m_Type > Stat_BEGIN_LINE_SEPARATED;	}
+
+	// Prints statement up to its next nested statement, which is returned in child. Returns false when statement
+	// is complete.
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const;
+
+	// Slots of nested statements, each is replaced by its postprocessed statement before FinishPostprocess is called
+	void GetNestedStatements( std::vector< shared_ptr<Statement>* >& nested );
+	shared_ptr<Statement> FinishPostprocess( void );
 };
 
 typedef shared_ptr<Statement> StatementPtr;
@@ -69,22 +115,19 @@ typedef shared_ptr<Statement> StatementPtr;
 class EmptyStatement : public Statement
 {
 public:
-	virtual int GetType( void ) const
+	EmptyStatement()
+	: Statement(Stat_Empty)
 	{
-		return Stat_Empty;
 	}
 
-	virtual void GenerateCode( std::wostream&, int ) const
+	void GenerateCode( TextWriter&, int ) const
 	{
 	}
 
+	// Shared instance, initialized once even when statements are postprocessed on several threads
 	static StatementPtr Get( void )
 	{
-		static StatementPtr s_instance;
-
-		if (!s_instance)
-			s_instance = StatementPtr(new EmptyStatement);
-
+		static const StatementPtr s_instance(new EmptyStatement);
 		return s_instance;
 	}
 };
@@ -98,36 +141,32 @@ private:
 
 public:
 	explicit ExpressionStatement( ExpressionPtr exp )
+	: Statement(Stat_Expression)
 	{
 		m_Expression = exp;
 	}
 
-	virtual int GetType( void ) const
-	{
-		return Stat_Expression;
-	}
-
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		if (!m_Expression)
 			return;
 
 		if (m_Expression->GetType() == Exp_NewClassExpression || m_Expression->GetType() == Exp_Function)
 		{
-			out << indent(n) << expression_out(m_Expression, n) << std::endl << std::endl;
+			out << indent(n) << expression_out(m_Expression, n) << '\n' << '\n';
 		}
 		else
 		{
-			out << indent(n) << expression_out(m_Expression, n) << ';' << std::endl;
+			out << indent(n) << expression_out(m_Expression, n) << ';' << '\n';
 		}
 	}
 
-	virtual StatementPtr Postprocess( void )
+	StatementPtr FinishPostprocess( void )
 	{
 		if (!m_Expression)
 			return EmptyStatement::Get();
 
-		return Statement::Postprocess();
+		return shared_from_this();
 	}
 
 	void Clear( void )
@@ -157,6 +196,7 @@ private:
 
 public:
 	BlockStatement()
+	: Statement(Stat_Block)
 	{
 	}
 
@@ -175,52 +215,70 @@ public:
 		return m_Statements;
 	}	
 
-	virtual int GetType( void ) const
-	{
-		return Stat_Block;
-	}
+	typedef StatementContentState ContentState;
 
-	void GenerateBlockContentCode( std::wostream& out, int n ) const
+	// Prints separation before statement of block content, returns indent of statement
+	static int BeginContentStatement( TextWriter& out, int n, const StatementPtr& statement, ContentState& state )
 	{
-		StatementPtr prevStatement;
-		bool pendingSpace = false;
-
-		for( vector< StatementPtr >::const_iterator i = m_Statements.begin(); i != m_Statements.end(); ++i )
+		if (statement->GetType() == Stat_Case)
 		{
-			StatementPtr statement = *i;
-			
-			if (statement->GetType() == Stat_Case)
-			{
-				if (prevStatement)
-					out << std::endl;
+			if (state.hasPrevious)
+				out << '\n';
+
+			state.pendingSpace = false;
+			state.hasPrevious = false;
+			return std::max(0, n - 1);
+		}
+
+		bool separatedStatement = statement->GetType() > Stat_BEGIN_LINE_SEPARATED;
 
-				statement->GenerateCode(out, std::max(0, n - 1));
-				pendingSpace = false;
-				prevStatement = StatementPtr();
-				continue;
-			}
+		if (state.hasPrevious && (separatedStatement || state.pendingSpace))
+			out << '\n';
+
+		state.pendingSpace = separatedStatement;
+		state.hasPrevious = true;
+		return n;
+	}
+
+	static void GenerateContentStatement( TextWriter& out, int n, const StatementPtr& statement, ContentState& state )
+	{
+		int statementIndent = BeginContentStatement(out, n, statement, state);
+		statement->GenerateCode(out, statementIndent);
+	}
 
-			bool separatedStatement = statement->GetType() > Stat_BEGIN_LINE_SEPARATED;
+	void GenerateBlockContentCode( TextWriter& out, int n ) const
+	{
+		ContentState state;
 
-			if (prevStatement && (separatedStatement || pendingSpace))
-				out << std::endl;
+		for( vector< StatementPtr >::const_iterator i = m_Statements.begin(); i != m_Statements.end(); ++i )
+			GenerateContentStatement(out, n, *i, state);
+	}
 
-			statement->GenerateCode(out, n);
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
+	{
+		int n = task.indent;
 
-			pendingSpace = separatedStatement;
+		if (task.stage == 0)
+			out << ::indent(n) << '{' << '\n';
 
-			prevStatement = statement;
+		if ((size_t)task.stage < m_Statements.size())
+		{
+			const StatementPtr& statement = m_Statements[task.stage++];
+			child = StatementGenerateTask(statement.get(), BeginContentStatement(out, n + 1, statement, task.content), false);
+			return true;
 		}
+
+		out << ::indent(n) << '}' << '\n';
+		return false;
 	}
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GetNestedStatements( std::vector<StatementPtr*>& nested )
 	{
-		out << ::indent(n) << '{' << std::endl;
-		GenerateBlockContentCode(out, n + 1);
-		out << ::indent(n) << '}' << std::endl;
+		for( vector< StatementPtr >::iterator i = m_Statements.begin(); i != m_Statements.end(); ++i )
+			nested.push_back(&*i);
 	}
 
-	virtual StatementPtr Postprocess( void );
+	StatementPtr FinishPostprocess( void );
 };
 
 typedef shared_ptr<BlockStatement> BlockStatementPtr;
@@ -234,29 +292,9 @@ private:
 	StatementPtr m_WhenTrue, m_WhenFalse;
 	bool m_Canceled;
 
-private:
-	void _generateCode( std::wostream& out, int n ) const
-	{
-		out << "if (" << expression_out(m_Condition, n) << ')' << std::endl;
-		m_WhenTrue->GenerateCodeInBlock(out, n);
-
-		if (m_WhenFalse)
-		{
-			if (m_WhenFalse->GetType() == Stat_If)
-			{
-				out << ::indent(n) << "else ";
-				static_pointer_cast<IfStatement>(m_WhenFalse)->_generateCode(out, n);
-			}
-			else
-			{
-				out << ::indent(n) << "else" << std::endl;
-				m_WhenFalse->GenerateCodeInBlock(out, n);
-			}
-		}
-	}
-
 public:
 	explicit IfStatement( ExpressionPtr condition, StatementPtr whenTrue, StatementPtr whenFalse )
+	: Statement(Stat_If)
 	{
 		m_Canceled = false;
 		m_Condition = condition;
@@ -264,15 +302,44 @@ public:
 		m_WhenFalse = whenFalse;
 	}
 
-	virtual int GetType( void ) const
+	// Else-if chain is printed by one task, task.current is if statement being printed
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
 	{
-		return Stat_If;
-	}
+		int n = task.indent;
+		const IfStatement* current = static_cast<const IfStatement*>(task.current);
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
-	{
-		out << ::indent(n);
-		_generateCode(out, n);
+		switch(task.stage)
+		{
+			case 0:
+				out << ::indent(n);
+				current = this;
+				break;
+
+			case 1:
+				if (!current->m_WhenFalse)
+					return false;
+
+				if (current->m_WhenFalse->GetType() == Stat_If)
+				{
+					out << ::indent(n) << "else ";
+					current = static_cast<const IfStatement*>(current->m_WhenFalse.get());
+					break;
+				}
+
+				out << ::indent(n) << "else" << '\n';
+				child = StatementGenerateTask(current->m_WhenFalse.get(), n, true);
+				task.stage = 2;
+				return true;
+
+			default:
+				return false;
+		}
+
+		out << "if (" << expression_out(current->m_Condition, n) << ')' << '\n';
+		child = StatementGenerateTask(current->m_WhenTrue.get(), n, true);
+		task.current = current;
+		task.stage = 1;
+		return true;
 	}
 
 	const ExpressionPtr GetConditionExpression( void ) const
@@ -285,17 +352,20 @@ public:
 		m_Canceled = true;
 	}
 
-	virtual StatementPtr Postprocess( void )
+	void GetNestedStatements( std::vector<StatementPtr*>& nested )
 	{
-		m_WhenTrue = m_WhenTrue->Postprocess();
+		nested.push_back(&m_WhenTrue);
 
 		if (m_WhenFalse)
-			m_WhenFalse = m_WhenFalse->Postprocess();
+			nested.push_back(&m_WhenFalse);
+	}
 
+	StatementPtr FinishPostprocess( void )
+	{
 		if (m_Canceled && m_WhenTrue->IsEmpty() && (!m_WhenFalse || m_WhenFalse->IsEmpty()))
 			return EmptyStatement::Get();
 
-		return Statement::Postprocess();
+		return shared_from_this();
 	}
 };
 
@@ -310,6 +380,7 @@ private:
 
 public:
 	explicit LocalVarInitStatement(const LString& name, int stackAddress, int startAddress, int endAddress, ExpressionPtr init = ExpressionPtr())
+	: Statement(Stat_LocalVar)
 	{
 		m_Name = name;
 		m_StackAddress = stackAddress;
@@ -318,19 +389,14 @@ public:
 		m_Initialization = init;
 	}
 
-	virtual int GetType( void ) const
-	{
-		return Stat_LocalVar;
-	}
-
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		out << ::indent(n) << "local " << m_Name;
 
 		if (!m_Initialization)
-			out << ';' << std::endl;
+			out << ';' << '\n';
 		else
-			out << " = " << expression_out(m_Initialization, n) << ';' << std::endl;
+			out << " = " << expression_out(m_Initialization, n) << ';' << '\n';
 	}
 
 	const LString& GetVarName(void) const
@@ -351,25 +417,22 @@ private:
 
 public:
 	ReturnStatement()
+	: Statement(Stat_Return)
 	{
 	}
 
 	explicit ReturnStatement( ExpressionPtr retExpr )
+	: Statement(Stat_Return)
 	{
 		m_Expression = retExpr;
 	}
 
-	virtual int GetType( void ) const
-	{
-		return Stat_Return;
-	}
-
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		if (!m_Expression)
-			out << ::indent(n) << "return;" << std::endl;
+			out << ::indent(n) << "return;" << '\n';
 		else
-			out << ::indent(n) << "return " << expression_out(m_Expression, n) << ';' << std::endl;
+			out << ::indent(n) << "return " << expression_out(m_Expression, n) << ';' << '\n';
 	}
 };
 
@@ -381,18 +444,14 @@ private:
 
 public:
 	explicit ThrowStatement( ExpressionPtr retExpr )
+	: Statement(Stat_Throw)
 	{
 		m_Expression = retExpr;
 	}
 
-	virtual int GetType( void ) const
-	{
-		return Stat_Throw;
-	}
-
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
-		out << ::indent(n) << "throw " << expression_out(m_Expression, n) << ';' << std::endl;
+		out << ::indent(n) << "throw " << expression_out(m_Expression, n) << ';' << '\n';
 	}
 };
 
@@ -404,21 +463,17 @@ private:
 
 public:
 	explicit YieldStatement( ExpressionPtr retExpr )
+	: Statement(Stat_Yield)
 	{
 		m_Expression = retExpr;
 	}
 
-	virtual int GetType( void ) const
-	{
-		return Stat_Yield;
-	}
-
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		if (m_Expression)
-			out << ::indent(n) << "yield " << expression_out(m_Expression, n) << ';' << std::endl;
+			out << ::indent(n) << "yield " << expression_out(m_Expression, n) << ';' << '\n';
 		else
-			out << ::indent(n) << "yield;" << std::endl;
+			out << ::indent(n) << "yield;" << '\n';
 	}
 };
 
@@ -433,31 +488,38 @@ private:
 
 public:
 	explicit TryCatchStatement(StatementPtr tryStatement, StatementPtr catchStatement, const LString& varName)
+	: Statement(Stat_TryCatch)
 	{
 		m_Try = tryStatement;
 		m_Catch = catchStatement;
 		m_CatchVariable = varName;
 	}
 
-	virtual int GetType( void ) const
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
 	{
-		return Stat_TryCatch;
-	}
+		int n = task.indent;
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
-	{
-		out << ::indent(n) << "try" << std::endl;
-		m_Try->GenerateCodeInBlock(out, n);
-		out << ::indent(n) << "catch( " << m_CatchVariable << " )" << std::endl;
-		m_Catch->GenerateCodeInBlock(out, n);
+		switch(task.stage++)
+		{
+			case 0:
+				out << ::indent(n) << "try" << '\n';
+				child = StatementGenerateTask(m_Try.get(), n, true);
+				return true;
+
+			case 1:
+				out << ::indent(n) << "catch( " << m_CatchVariable << " )" << '\n';
+				child = StatementGenerateTask(m_Catch.get(), n, true);
+				return true;
+
+			default:
+				return false;
+		}
 	}
 
-	virtual StatementPtr Postprocess( void )
+	void GetNestedStatements( std::vector<StatementPtr*>& nested )
 	{
-		m_Try = m_Try->Postprocess();
-		m_Catch = m_Catch->Postprocess();
-
-		return Statement::Postprocess();
+		nested.push_back(&m_Try);
+		nested.push_back(&m_Catch);
 	}
 };
 
@@ -466,14 +528,14 @@ public:
 class BreakStatement : public Statement
 {
 public:
-	virtual int GetType( void ) const
+	BreakStatement()
+	: Statement(Stat_Break)
 	{
-		return Stat_Break;
 	}
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
-		out << ::indent(n) << "break;" << std::endl;
+		out << ::indent(n) << "break;" << '\n';
 	}
 };
 
@@ -481,14 +543,14 @@ public:
 class ContinueStatement : public Statement
 {
 public:
-	virtual int GetType( void ) const
+	ContinueStatement()
+	: Statement(Stat_Continue)
 	{
-		return Stat_Continue;
 	}
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
-		out << ::indent(n) << "continue;" << std::endl;
+		out << ::indent(n) << "continue;" << '\n';
 	}
 };
 
@@ -497,22 +559,58 @@ class CommentStatement : public Statement
 {
 private:
 	LString m_Text;
+	const NutFunction* m_Function;		// Function of commented opcode, if comment is opcode listing
+	int m_OpcodePos;
+
+	void PrintOpcode( TextWriter& out ) const;
 
 public:
 	explicit CommentStatement(const LString& text)
+	: Statement(Stat_Comment)
+	, m_Function(NULL)
+	, m_OpcodePos(0)
 	{
 		m_Text = text;
 	}
 
-	virtual int GetType( void ) const
+	explicit CommentStatement(const NutFunction& function, int opcodePos)
+	: Statement(Stat_Comment)
+	, m_Function(&function)
+	, m_OpcodePos(opcodePos)
 	{
-		return Stat_Comment;
 	}
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
+	{
+		out << ::indent(n) << "  // ";
+
+		if (m_Function)
+			PrintOpcode(out);
+		else
+			out << m_Text;
+
+		out << '\n';
+	}
+};
+
+
+// *******************************************************************************************
+// Commented disassembly in place of body that could not be decompiled (see NutFunction::PrintDisassemblyStub)
+class DisassemblyStatement : public Statement
+{
+private:
+	const NutFunction& m_Function;
+	std::string m_Reason;
+
+public:
+	DisassemblyStatement( const NutFunction& function, const char* reason )
+	: Statement(Stat_Disassembly)
+	, m_Function(function)
+	, m_Reason(reason)
 	{
-		out << ::indent(n) << "  // " << m_Text << std::endl;
 	}
+
+	void GenerateCode( TextWriter& out, int n ) const;
 };
 
 
@@ -524,6 +622,11 @@ protected:
 	int m_LoopEndAddress;
 	int m_LoopFlags;
 
+	explicit LoopBaseStatement( int type )
+	: Statement(type)
+	{
+	}
+
 public:
 	void SetLoopBlock( const BlockState& blockState )
 	{
@@ -559,6 +662,7 @@ private:
 
 public:
 	explicit ForStatement( StatementPtr initialization, ExpressionPtr condition, StatementPtr incrementation, StatementPtr block )
+	: LoopBaseStatement(Stat_For)
 	{
 		m_Initialization = initialization;
 		m_Condition = condition;
@@ -566,28 +670,28 @@ public:
 		m_Block = block;
 	}
 
-	virtual int GetType( void ) const
-	{
-		return Stat_For;
-	}
-
-	void GenerateStatementInline( std::wostream& out, int n, StatementPtr statement ) const
+	void GenerateStatementInline( TextWriter& out, int n, StatementPtr statement ) const
 	{
-		std::wstringstream buff;
+		// Following lines of statement are indented by writer as they are generated
+		TextWriter buff;
+		buff.SetIndent(n);
 		statement->GenerateCode(buff, 0);
-		LString text = buff.str();
+		const std::string& text = buff.GetText();
 
-		while (!text.empty() && (text[text.length()-1] == '\n' || text[text.length()-1] == ';'))
-			text.resize(text.length()-1); //remove last element
+		size_t length = text.length();
+		while (length > 0 && (text[length - 1] == '\n' || text[length - 1] == ';'))
+			length -= 1; //remove last element
 
-		AssureIndents(text, n);
-
-		out << text;
+		out.Write(text.data(), length);
 	}
 
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
 	{
+		if (task.stage++ > 0)
+			return false;
+
+		int n = task.indent;
 		out << ::indent(n) << "for( ";
 		
 		if (m_Initialization)
@@ -603,14 +707,14 @@ public:
 		if (m_Incrementation)
 			GenerateStatementInline(out, n, m_Incrementation);
 		
-		out << " )" << std::endl;
-		m_Block->GenerateCodeInBlock(out, n);
+		out << " )" << '\n';
+		child = StatementGenerateTask(m_Block.get(), n, true);
+		return true;
 	}
 
-	virtual StatementPtr Postprocess( void )
+	void GetNestedStatements( std::vector<StatementPtr*>& nested )
 	{
-		m_Block = m_Block->Postprocess();
-		return Statement::Postprocess();
+		nested.push_back(&m_Block);
 	}
 };
 
@@ -624,27 +728,26 @@ private:
 
 public:
 	explicit WhileStatement( ExpressionPtr condition, StatementPtr block )
+	: LoopBaseStatement(Stat_While)
 	{
 		m_Condition = condition;
 		m_Block = block;
 	}
 
-	virtual int GetType( void ) const
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
 	{
-		return Stat_While;
-	}
+		if (task.stage++ > 0)
+			return false;
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
-	{
-		out << ::indent(n) << "while (" << expression_out(m_Condition, n) << ')' << std::endl;
-		m_Block->GenerateCodeInBlock(out, n);
+		int n = task.indent;
+		out << ::indent(n) << "while (" << expression_out(m_Condition, n) << ')' << '\n';
+		child = StatementGenerateTask(m_Block.get(), n, true);
+		return true;
 	}
 
-	virtual StatementPtr Postprocess( void )
+	void GetNestedStatements( std::vector<StatementPtr*>& nested )
 	{
-		m_Block = m_Block->Postprocess();
-
-		return Statement::Postprocess();
+		nested.push_back(&m_Block);
 	}
 
 	StatementPtr GetForIncrementStatement( void )
@@ -708,28 +811,30 @@ private:
 
 public:
 	explicit DoWhileStatement( ExpressionPtr condition, StatementPtr block )
+	: LoopBaseStatement(Stat_DoWhile)
 	{
 		m_Condition = condition;
 		m_Block = block;
 	}
 
-	virtual int GetType( void ) const
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
 	{
-		return Stat_DoWhile;
-	}
+		int n = task.indent;
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
-	{
-		out << ::indent(n) << "do" << std::endl;
-		m_Block->GenerateCodeInBlock(out, n);
-		out << ::indent(n) << "while (" << expression_out(m_Condition, n) << ");" << std::endl;
+		if (task.stage++ > 0)
+		{
+			out << ::indent(n) << "while (" << expression_out(m_Condition, n) << ");" << '\n';
+			return false;
+		}
+
+		out << ::indent(n) << "do" << '\n';
+		child = StatementGenerateTask(m_Block.get(), n, true);
+		return true;
 	}
 
-	virtual StatementPtr Postprocess( void )
+	void GetNestedStatements( std::vector<StatementPtr*>& nested )
 	{
-		m_Block = m_Block->Postprocess();
-
-		return Statement::Postprocess();
+		nested.push_back(&m_Block);
 	}
 };
 
@@ -743,6 +848,7 @@ private:
 
 public:
 	explicit ForeachStatement( ExpressionPtr key, ExpressionPtr value, ExpressionPtr object, StatementPtr block )
+	: LoopBaseStatement(Stat_Foreach)
 	{
 		m_Key = key;
 		m_Value = value;
@@ -750,28 +856,26 @@ public:
 		m_Block = block;
 	}
 
-	virtual int GetType( void ) const
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
 	{
-		return Stat_Foreach;
-	}
+		if (task.stage++ > 0)
+			return false;
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
-	{
+		int n = task.indent;
 		out << ::indent(n) << "foreach( ";
 		
 		if (m_Key && (!m_Key->IsVariable() || static_pointer_cast<VariableExpression>(m_Key)->GetVariableName() != L"@INDEX@"))
 			out << expression_out(m_Key, n) << ", ";
 
-		out << expression_out(m_Value, n) << " in " << expression_out(m_Object, n) << " )" << std::endl;
+		out << expression_out(m_Value, n) << " in " << expression_out(m_Object, n) << " )" << '\n';
 
-		m_Block->GenerateCodeInBlock(out, n);
+		child = StatementGenerateTask(m_Block.get(), n, true);
+		return true;
 	}
 
-	virtual StatementPtr Postprocess( void )
+	void GetNestedStatements( std::vector<StatementPtr*>& nested )
 	{
-		m_Block = m_Block->Postprocess();
-
-		return Statement::Postprocess();
+		nested.push_back(&m_Block);
 	}
 };
 
@@ -784,27 +888,26 @@ private:
 
 public:
 	explicit SwitchStatement( ExpressionPtr variable, StatementPtr block )
+	: Statement(Stat_Switch)
 	{
 		m_Variable = variable;
 		m_Block = block;
 	}
 
-	virtual int GetType( void ) const
+	bool GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
 	{
-		return Stat_Switch;
-	}
+		if (task.stage++ > 0)
+			return false;
 
-	virtual void GenerateCode( std::wostream& out, int n ) const
-	{
-		out << ::indent(n) << "switch(" << expression_out(m_Variable, n) << ')' << std::endl;
-		m_Block->GenerateCodeInBlock(out, n);
+		int n = task.indent;
+		out << ::indent(n) << "switch(" << expression_out(m_Variable, n) << ')' << '\n';
+		child = StatementGenerateTask(m_Block.get(), n, true);
+		return true;
 	}
 
-	virtual StatementPtr Postprocess( void )
+	void GetNestedStatements( std::vector<StatementPtr*>& nested )
 	{
-		m_Block = m_Block->Postprocess();
-
-		return Statement::Postprocess();
+		nested.push_back(&m_Block);
 	}
 };
 
@@ -816,21 +919,101 @@ private:
 
 public:
 	explicit CaseStatement( ExpressionPtr value )
+	: Statement(Stat_Case)
 	{
 		m_Value = value;
 	}
 
-	virtual int GetType( void ) const
-	{
-		return Stat_Case;
-	}
-
-	virtual void GenerateCode( std::wostream& out, int n ) const
+	void GenerateCode( TextWriter& out, int n ) const
 	{
 		if (m_Value)
-			out << ::indent(n) << "case " << expression_out(m_Value, n) << ':' << std::endl;
+			out << ::indent(n) << "case " << expression_out(m_Value, n) << ':' << '\n';
 		else
-			out << ::indent(n) << "default:" << std::endl;
+			out << ::indent(n) << "default:" << '\n';
 	}
 };
 
+
+// *******************************************************************************************
+inline void Statement::GenerateSimpleCode( TextWriter& out, int n ) const
+{
+	switch(m_Type)
+	{
+		case Stat_Empty:		break;
+		case Stat_Expression:	static_cast<const ExpressionStatement*>(this)->GenerateCode(out, n);	break;
+		case Stat_LocalVar:		static_cast<const LocalVarInitStatement*>(this)->GenerateCode(out, n);	break;
+		case Stat_Return:		static_cast<const ReturnStatement*>(this)->GenerateCode(out, n);		break;
+		case Stat_Throw:		static_cast<const ThrowStatement*>(this)->GenerateCode(out, n);			break;
+		case Stat_Yield:		static_cast<const YieldStatement*>(this)->GenerateCode(out, n);			break;
+		case Stat_Break:		static_cast<const BreakStatement*>(this)->GenerateCode(out, n);			break;
+		case Stat_Continue:		static_cast<const ContinueStatement*>(this)->GenerateCode(out, n);		break;
+		case Stat_Comment:		static_cast<const CommentStatement*>(this)->GenerateCode(out, n);		break;
+		case Stat_Case:			static_cast<const CaseStatement*>(this)->GenerateCode(out, n);			break;
+		case Stat_Disassembly:	static_cast<const DisassemblyStatement*>(this)->GenerateCode(out, n);	break;
+	}
+}
+
+
+// *******************************************************************************************
+inline bool Statement::GenerateStep( TextWriter& out, StatementGenerateTask& task, StatementGenerateTask& child ) const
+{
+	// Braces around statement that is not block
+	if (task.inBlock && m_Type != Stat_Block)
+	{
+		if (task.stage++ > 0)
+		{
+			out << ::indent(task.indent) << '}' << '\n';
+			return false;
+		}
+
+		out << ::indent(task.indent) << '{' << '\n';
+		child = StatementGenerateTask(this, task.indent + 1, false);
+		return true;
+	}
+
+	switch(m_Type)
+	{
+		case Stat_Block:		return static_cast<const BlockStatement*>(this)->GenerateStep(out, task, child);
+		case Stat_If:			return static_cast<const IfStatement*>(this)->GenerateStep(out, task, child);
+		case Stat_TryCatch:		return static_cast<const TryCatchStatement*>(this)->GenerateStep(out, task, child);
+		case Stat_For:			return static_cast<const ForStatement*>(this)->GenerateStep(out, task, child);
+		case Stat_While:		return static_cast<const WhileStatement*>(this)->GenerateStep(out, task, child);
+		case Stat_DoWhile:		return static_cast<const DoWhileStatement*>(this)->GenerateStep(out, task, child);
+		case Stat_Foreach:		return static_cast<const ForeachStatement*>(this)->GenerateStep(out, task, child);
+		case Stat_Switch:		return static_cast<const SwitchStatement*>(this)->GenerateStep(out, task, child);
+
+		default:
+			GenerateSimpleCode(out, task.indent);
+			return false;
+	}
+}
+
+
+// *******************************************************************************************
+inline void Statement::GetNestedStatements( std::vector<StatementPtr*>& nested )
+{
+	switch(m_Type)
+	{
+		case Stat_Block:		static_cast<BlockStatement*>(this)->GetNestedStatements(nested);		break;
+		case Stat_If:			static_cast<IfStatement*>(this)->GetNestedStatements(nested);			break;
+		case Stat_TryCatch:		static_cast<TryCatchStatement*>(this)->GetNestedStatements(nested);		break;
+		case Stat_For:			static_cast<ForStatement*>(this)->GetNestedStatements(nested);			break;
+		case Stat_While:		static_cast<WhileStatement*>(this)->GetNestedStatements(nested);		break;
+		case Stat_DoWhile:		static_cast<DoWhileStatement*>(this)->GetNestedStatements(nested);		break;
+		case Stat_Foreach:		static_cast<ForeachStatement*>(this)->GetNestedStatements(nested);		break;
+		case Stat_Switch:		static_cast<SwitchStatement*>(this)->GetNestedStatements(nested);		break;
+	}
+}
+
+
+// *******************************************************************************************
+inline StatementPtr Statement::FinishPostprocess( void )
+{
+	switch(m_Type)
+	{
+		case Stat_Expression:	return static_cast<ExpressionStatement*>(this)->FinishPostprocess();
+		case Stat_Block:		return static_cast<BlockStatement*>(this)->FinishPostprocess();
+		case Stat_If:			return static_cast<IfStatement*>(this)->FinishPostprocess();
+		default:				return shared_from_this();
+	}
+}
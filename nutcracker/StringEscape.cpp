@@ -0,0 +1,218 @@
+#include "stdafx.h"
+#include "StringEscape.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+	#define NUT_ESCAPE_SSE2
+	#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+
+// ***************************************************************************************************************
+// Escape sequences of ASCII characters in script literals, NULL for characters written as \x code
+static const wchar_t* const LiteralEscapes[0x80] =
+{
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, L"\\a", NULL, L"\\t", L"\\n", L"\\v", NULL, L"\\r", NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, L"\\\"", NULL, NULL, NULL, NULL, L"\\\'", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, L"\\\\", NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+};
+
+// Escape sequences of control characters and backslash in literal listings, NULL for characters written as they are
+static const char* const ControlEscapes[0x20] =
+{
+	"\\0", NULL, NULL, NULL, NULL, NULL, NULL, "\\a", NULL, "\\t", "\\n", "\\v", NULL, "\\r", NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+};
+
+
+// ***************************************************************************************************************
+static inline int LowestBit( unsigned int bits )
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+
+// ***************************************************************************************************************
+static inline bool IsSpecial( wchar_t c, EscapeSet set )
+{
+	if (c < 0x20 || c == '\\')
+		return true;
+
+	return set == Escape_Literal && (c > 0x7E || c == '\"' || c == '\'');
+}
+
+
+// ***************************************************************************************************************
+#ifdef NUT_ESCAPE_SSE2
+
+template< size_t CharSize > struct PlainScanner;
+
+// 16 bit wchar_t (Windows)
+template<> struct PlainScanner<2>
+{
+	static const size_t Lanes = 8;
+
+	// Byte mask of characters that need no escaping
+	static unsigned int PlainMask( const wchar_t* text, EscapeSet set )
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text));
+
+		// Saturated 0x20 - c is zero exactly for c >= 0x20
+		__m128i plain = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_set1_epi16(0x20), chars), zero);
+		plain = _mm_andnot_si128(_mm_cmpeq_epi16(chars, _mm_set1_epi16('\\')), plain);
+
+		if (set == Escape_Literal)
+		{
+			plain = _mm_and_si128(plain, _mm_cmpeq_epi16(_mm_subs_epu16(chars, _mm_set1_epi16(0x7E)), zero));
+			plain = _mm_andnot_si128(_mm_cmpeq_epi16(chars, _mm_set1_epi16('\"')), plain);
+			plain = _mm_andnot_si128(_mm_cmpeq_epi16(chars, _mm_set1_epi16('\'')), plain);
+		}
+
+		return static_cast<unsigned int>(_mm_movemask_epi8(plain));
+	}
+};
+
+// 32 bit wchar_t
+template<> struct PlainScanner<4>
+{
+	static const size_t Lanes = 4;
+
+	static unsigned int PlainMask( const wchar_t* text, EscapeSet set )
+	{
+		__m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text));
+
+		__m128i plain = _mm_cmpgt_epi32(chars, _mm_set1_epi32(0x1F));
+		plain = _mm_andnot_si128(_mm_cmpeq_epi32(chars, _mm_set1_epi32('\\')), plain);
+
+		if (set == Escape_Literal)
+		{
+			plain = _mm_and_si128(plain, _mm_cmplt_epi32(chars, _mm_set1_epi32(0x7F)));
+			plain = _mm_andnot_si128(_mm_cmpeq_epi32(chars, _mm_set1_epi32('\"')), plain);
+			plain = _mm_andnot_si128(_mm_cmpeq_epi32(chars, _mm_set1_epi32('\'')), plain);
+		}
+
+		return static_cast<unsigned int>(_mm_movemask_epi8(plain));
+	}
+};
+
+#endif
+
+
+// ***************************************************************************************************************
+size_t ScanPlainRun( const wchar_t* text, size_t size, EscapeSet set )
+{
+	size_t i = 0;
+
+#ifdef NUT_ESCAPE_SSE2
+	typedef PlainScanner< sizeof(wchar_t) > Scanner;
+
+	for(; i + Scanner::Lanes <= size; i += Scanner::Lanes)
+	{
+		unsigned int special = ~Scanner::PlainMask(text + i, set) & 0xFFFF;
+		if (special)
+			return i + LowestBit(special) / sizeof(wchar_t);
+	}
+#endif
+
+	for(; i < size; ++i)
+		if (IsSpecial(text[i], set))
+			break;
+
+	return i;
+}
+
+
+// ***************************************************************************************************************
+static void AppendHexCode( LString& result, wchar_t c )
+{
+	static const wchar_t digits[] = L"0123456789abcdef";
+
+	wchar_t buffer[12];
+	wchar_t* p = buffer + 12;
+	unsigned int value = static_cast<unsigned int>(c);
+
+	for(int n = 0; n < 4 || value; ++n)
+	{
+		*--p = digits[value & 0xF];
+		value >>= 4;
+	}
+
+	result.append(L"\\x");
+	result.append(p, buffer + 12 - p);
+}
+
+
+// ***************************************************************************************************************
+void AppendEscapedLiteral( LString& result, const LString& str, const DecompileContext& context )
+{
+	const wchar_t* text = str.data();
+	const size_t size = str.size();
+
+	result.reserve(result.size() + size + 2);
+	result += '\"';
+
+	for(size_t pos = 0; pos < size; )
+	{
+		size_t run = ScanPlainRun(text + pos, size - pos, Escape_Literal);
+		result.append(text + pos, run);
+		pos += run;
+
+		// Printable non ASCII characters are taken as they are
+		while(pos < size && static_cast<unsigned int>(text[pos]) >= 0x80 && context.IsPrintable(text[pos]))
+			result += text[pos++];
+
+		if (pos == size || !IsSpecial(text[pos], Escape_Literal))
+			continue;
+
+		wchar_t c = text[pos++];
+		const wchar_t* escape = (static_cast<unsigned int>(c) < 0x80) ? LiteralEscapes[c] : NULL;
+
+		if (escape)
+			result.append(escape);
+		else
+			AppendHexCode(result, c);
+	}
+
+	result += '\"';
+}
+
+
+// ***************************************************************************************************************
+void PrintEscapedString( TextWriter& out, const LString& str )
+{
+	const wchar_t* text = str.data();
+	const size_t size = str.size();
+
+	for(size_t pos = 0; pos < size; )
+	{
+		size_t run = ScanPlainRun(text + pos, size - pos, Escape_Control);
+		out.Write(text + pos, run);
+		pos += run;
+
+		if (pos == size)
+			break;
+
+		wchar_t c = text[pos++];
+		const char* escape = (c == '\\') ? "\\\\" : ControlEscapes[c];
+
+		if (escape)
+			out << escape;
+		else
+			out << c;
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+// ************************************************************************************************************************************
+// Escaping of string literals. Runs of characters that need no escaping are found with SSE2 where available and
+// copied in bulk, escape tables are consulted only at special characters.
+
+enum EscapeSet
+{
+	Escape_Control,		// Control characters and backslash (literal listings)
+	Escape_Literal,		// Also quotes and all non ASCII characters, that must pass printability check (script source)
+};
+
+// Returns length of prefix of text that contains no character of escape set
+size_t ScanPlainRun( const wchar_t* text, size_t size, EscapeSet set );
+
+// Appends str as quoted script string literal - quotes are escaped and characters not printable in locale of context
+// written as \x codes
+void AppendEscapedLiteral( LString& result, const LString& str, const DecompileContext& context );
+
+// Writes str with control characters and backslash escaped
+void PrintEscapedString( TextWriter& out, const LString& str );
@@ -0,0 +1,78 @@
+#include "stdafx.h"
+#include "StringEscape.h"
+
+// ***************************************************************************************************************
+// Checks ScanPlainRun against escape rules for every ASCII code unit at every position of a block. Block of 64
+// characters goes through vector scanner where it is available, single character always through scalar loop.
+
+static const size_t BlockSize = 64;
+
+
+// ***************************************************************************************************************
+static bool IsEscaped( unsigned int c, EscapeSet set )
+{
+	if (c < 0x20 || c == '\\')
+		return true;
+
+	return set == Escape_Literal && (c > 0x7E || c == '\"' || c == '\'');
+}
+
+
+// ***************************************************************************************************************
+static int CheckCodeUnit( unsigned int c, EscapeSet set, const char* setName )
+{
+	int failures = 0;
+
+	wchar_t unit = static_cast<wchar_t>(c);
+	size_t single = ScanPlainRun(&unit, 1, set);
+
+	if (single != (IsEscaped(c, set) ? 0 : 1))
+	{
+		std::cout << setName << ": scalar scan of 0x" << std::hex << c << std::dec << " returned " << single << std::endl;
+		failures += 1;
+	}
+
+	for(size_t pos = 0; pos < BlockSize; ++pos)
+	{
+		std::vector<wchar_t> text(BlockSize, L'a');
+		text[pos] = unit;
+
+		size_t expected = IsEscaped(c, set) ? pos : BlockSize;
+		size_t run = ScanPlainRun(text.data(), text.size(), set);
+
+		if (run != expected)
+		{
+			std::cout << setName << ": scan of 0x" << std::hex << c << std::dec << " at " << pos << " returned " << run
+				<< ", expected " << expected << std::endl;
+			failures += 1;
+		}
+	}
+
+	return failures;
+}
+
+
+// ***************************************************************************************************************
+int main( void )
+{
+	int failures = 0;
+
+	for(unsigned int c = 0; c < 0x80; ++c)
+	{
+		failures += CheckCodeUnit(c, Escape_Control, "control");
+		failures += CheckCodeUnit(c, Escape_Literal, "literal");
+	}
+
+	// U+001F is last control character, saturated subtraction from 0x20 must not treat it as plain
+	const wchar_t boundary[] = L"    \x20\x20\x1F\x20";
+	if (ScanPlainRun(boundary, 8, Escape_Control) != 6)
+	{
+		std::cout << "control: U+001F after spaces not found" << std::endl;
+		failures += 1;
+	}
+
+	if (failures == 0)
+		std::cout << "StringEscapeTest: all passed" << std::endl;
+
+	return failures == 0 ? 0 : 1;
+}
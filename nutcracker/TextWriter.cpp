@@ -0,0 +1,329 @@
+#include "stdafx.h"
+#include "TextWriter.h"
+#include <stdarg.h>
+
+
+// ************************************************************************************************************************************
+TextWriter::TextWriter()
+: m_File(NULL)
+, m_Spilled(0)
+, m_Indent(0)
+, m_LineStart(false)
+, m_NextMarkId(0)
+{
+}
+
+
+// ************************************************************************************************************************************
+TextWriter::TextWriter( FILE* file )
+: m_File(file)
+, m_Spilled(0)
+, m_Indent(0)
+, m_LineStart(false)
+, m_NextMarkId(0)
+{
+	m_Buffer.reserve(ChunkSize * 2);
+}
+
+
+// ************************************************************************************************************************************
+TextWriter::~TextWriter()
+{
+	Flush();
+}
+
+
+// ************************************************************************************************************************************
+// Text after oldest mark is kept
+void TextWriter::Spill( void )
+{
+	size_t size = m_Buffer.size();
+	if (!m_Marks.empty())
+		size = std::min(size, static_cast<size_t>(m_Marks.front().pos - m_Spilled));
+
+	if (size == 0)
+		return;
+
+	fwrite(m_Buffer.data(), 1, size, m_File);
+	m_Buffer.erase(0, size);
+	m_Spilled += size;
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::Flush( void )
+{
+	m_Marks.clear();
+
+	if (!m_File)
+		return;
+
+	Spill();
+	fflush(m_File);
+}
+
+
+// ************************************************************************************************************************************
+TextWriter::Mark TextWriter::SetMark( void )
+{
+	Mark mark;
+	mark.pos = m_Spilled + m_Buffer.size();
+	mark.id = m_NextMarkId++;
+	mark.indent = m_Indent;
+	mark.lineStart = m_LineStart;
+
+	m_Marks.push_back(mark);
+	return mark;
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::Rollback( const Mark& mark )
+{
+	assert(mark.pos >= m_Spilled && mark.pos <= m_Spilled + m_Buffer.size());
+
+	m_Buffer.resize(static_cast<size_t>(mark.pos - m_Spilled));
+	m_Indent = mark.indent;
+	m_LineStart = mark.lineStart;
+
+	while(!m_Marks.empty() && m_Marks.back().id > mark.id)
+		m_Marks.pop_back();
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::ReleaseMark( const Mark& mark )
+{
+	for(std::vector<Mark>::iterator i = m_Marks.begin(); i != m_Marks.end(); ++i)
+		if (i->id == mark.id)
+		{
+			m_Marks.erase(i);
+			break;
+		}
+
+	if (m_File && m_Buffer.size() >= ChunkSize)
+		Spill();
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::AppendIndent( void )
+{
+	static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
+	static const int tabsCount = sizeof(tabs) - 1;
+
+	for(int n = m_Indent; n > 0; n -= tabsCount)
+		m_Buffer.append(tabs, std::min(n, tabsCount));
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::WriteIndented( const char* text, size_t size )
+{
+	const char* end = text + size;
+
+	while(text < end)
+	{
+		if (m_LineStart)
+		{
+			AppendIndent();
+			m_LineStart = false;
+		}
+
+		const char* eol = static_cast<const char*>(memchr(text, '\n', end - text));
+		const char* next = eol ? eol + 1 : end;
+
+		m_Buffer.append(text, next - text);
+		m_LineStart = (eol != NULL);
+		text = next;
+	}
+
+	if (m_File && m_Buffer.size() >= ChunkSize)
+		Spill();
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::Write( const char* text, size_t size )
+{
+	if (m_Indent)
+	{
+		WriteIndented(text, size);
+		return;
+	}
+
+	m_Buffer.append(text, size);
+
+	if (m_File && m_Buffer.size() >= ChunkSize)
+		Spill();
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::Write( const wchar_t* text, size_t size )
+{
+	if (!m_Indent)
+	{
+		AppendWide(text, size);
+	}
+	else
+	{
+		const wchar_t* end = text + size;
+
+		while(text < end)
+		{
+			if (m_LineStart)
+			{
+				AppendIndent();
+				m_LineStart = false;
+			}
+
+			const wchar_t* eol = wmemchr(text, L'\n', end - text);
+			const wchar_t* next = eol ? eol + 1 : end;
+
+			AppendWide(text, next - text);
+			m_LineStart = (eol != NULL);
+			text = next;
+		}
+	}
+
+	if (m_File && m_Buffer.size() >= ChunkSize)
+		Spill();
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::AppendWide( const wchar_t* text, size_t size )
+{
+	const wchar_t* end = text + size;
+
+	while(text < end)
+	{
+		// Plain ASCII runs are copied as they are
+		const wchar_t* run = text;
+		while(text < end && *text < 0x80)
+			++text;
+
+		if (text != run)
+		{
+			size_t pos = m_Buffer.size();
+			m_Buffer.resize(pos + (text - run));
+			for(char* dst = &m_Buffer[pos]; run != text; ++run, ++dst)
+				*dst = static_cast<char>(*run);
+		}
+
+		if (text == end)
+			break;
+
+		unsigned int code = static_cast<unsigned int>(*text++);
+
+		// UTF-16 surrogate pair (wchar_t is 16 bit on Windows)
+		if (code >= 0xD800 && code < 0xDC00 && text < end && *text >= 0xDC00 && *text < 0xE000)
+			code = 0x10000 + ((code - 0xD800) << 10) + (static_cast<unsigned int>(*text++) - 0xDC00);
+
+		if (code < 0x800)
+		{
+			m_Buffer.push_back(static_cast<char>(0xC0 | (code >> 6)));
+			m_Buffer.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+		}
+		else if (code < 0x10000)
+		{
+			m_Buffer.push_back(static_cast<char>(0xE0 | (code >> 12)));
+			m_Buffer.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+			m_Buffer.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+		}
+		else
+		{
+			m_Buffer.push_back(static_cast<char>(0xF0 | (code >> 18)));
+			m_Buffer.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+			m_Buffer.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+			m_Buffer.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+		}
+	}
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::Fill( char c, int count )
+{
+	if (count <= 0)
+		return;
+
+	if (m_LineStart && m_Indent)
+	{
+		AppendIndent();
+		m_LineStart = false;
+	}
+
+	m_Buffer.append(count, c);
+
+	if (m_File && m_Buffer.size() >= ChunkSize)
+		Spill();
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::WriteShifted( const std::string& text, int n )
+{
+	const char* line = text.data();
+	const char* end = line + text.size();
+
+	while(line < end)
+	{
+		const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+		const char* next = eol ? eol + 1 : end;
+
+		if (*line != '\n')
+			Fill('\t', n);
+
+		Write(line, next - line);
+		line = next;
+	}
+}
+
+
+// ************************************************************************************************************************************
+void TextWriter::WriteUnsigned( unsigned long long value, bool negative )
+{
+	char buffer[24];
+	char* p = buffer + sizeof(buffer);
+
+	do
+	{
+		*--p = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while(value);
+
+	if (negative)
+		*--p = '-';
+
+	Write(p, buffer + sizeof(buffer) - p);
+}
+
+
+// ************************************************************************************************************************************
+// Short texts are formatted on stack, longer ones are formatted again to heap buffer of required size
+void TextWriter::Printf( const char* format, ... )
+{
+	char buffer[256];
+
+	va_list args, retry;
+	va_start(args, format);
+	va_copy(retry, args);
+
+	int size = vsnprintf(buffer, sizeof(buffer), format, args);
+
+	if (size >= (int)sizeof(buffer))
+	{
+		std::vector<char> text(size + 1);
+		vsnprintf(text.data(), text.size(), format, retry);
+		Write(text.data(), size);
+	}
+	else if (size > 0)
+	{
+		Write(buffer, size);
+	}
+
+	va_end(retry);
+	va_end(args);
+}
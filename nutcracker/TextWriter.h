@@ -0,0 +1,102 @@
+#pragma once
+
+// ************************************************************************************************************************************
+// Output sink for generated source. Text is encoded to UTF-8 straight into a chunk buffer, which is either kept
+// in memory or written to a FILE with large fwrite calls when it fills up. Writer may also carry an indent level
+// that is inserted lazily at beginning of every new line. Marks let text written after them be taken back - text
+// after oldest mark stays in buffer until the mark is released.
+class TextWriter
+{
+public:
+	struct Mark
+	{
+		unsigned long long pos;			// Count of bytes written before mark
+		unsigned int id;				// Marks set later have larger id
+		int indent;
+		bool lineStart;
+	};
+
+private:
+	static const size_t ChunkSize = 64 * 1024;
+
+	FILE* m_File;
+	std::string m_Buffer;
+	unsigned long long m_Spilled;		// Bytes written to file or cleared before buffer
+	int m_Indent;
+	bool m_LineStart;
+	std::vector<Mark> m_Marks;			// Set marks in order of id
+	unsigned int m_NextMarkId;
+
+	TextWriter( const TextWriter& );
+	TextWriter& operator= ( const TextWriter& );
+
+	void Spill( void );
+	void AppendWide( const wchar_t* text, size_t size );
+	void AppendIndent( void );
+	void WriteIndented( const char* text, size_t size );
+	void WriteUnsigned( unsigned long long value, bool negative );
+
+public:
+	// In-memory writer
+	TextWriter();
+
+	// Writer flushing to file
+	explicit TextWriter( FILE* file );
+
+	~TextWriter();
+
+	void Write( const char* text, size_t size );
+	void Write( const wchar_t* text, size_t size );
+	void Fill( char c, int count );
+	void WriteShifted( const std::string& text, int n );		// UTF-8 text with n tabs added to every non empty line
+	void Printf( const char* format, ... );
+	void Flush( void );							// Writes all text to file, releases marks
+
+	Mark SetMark( void );
+	void Rollback( const Mark& mark );			// Drops text written after mark and releases marks set after it
+	void ReleaseMark( const Mark& mark );
+
+	// Indentation added to lines that start after this call (text of current line is not affected)
+	void SetIndent( int n )							{ m_Indent = std::max(0, n); m_LineStart = false;	}
+	int GetIndent( void ) const						{ return m_Indent;				}
+
+	// Text accumulated by in-memory writer (for file writers only the part not yet flushed)
+	const std::string& GetText( void ) const		{ return m_Buffer;				}
+	LString GetWideText( void ) const				{ return LString::fromUtf8(m_Buffer);	}
+	void Clear( void )								{ m_Spilled += m_Buffer.size(); m_Buffer.clear();	}
+
+	TextWriter& operator<< ( char c )
+	{
+		if (m_Indent)
+		{
+			WriteIndented(&c, 1);
+			return *this;
+		}
+
+		m_Buffer.push_back(c);
+		if (m_File && m_Buffer.size() >= ChunkSize)
+			Spill();
+		return *this;
+	}
+
+	TextWriter& operator<< ( wchar_t c )
+	{
+		if (c < 0x80)
+			return *this << static_cast<char>(c);
+
+		Write(&c, 1);
+		return *this;
+	}
+
+	TextWriter& operator<< ( const char* text )				{ Write(text, strlen(text)); return *this;				}
+	TextWriter& operator<< ( const wchar_t* text )			{ Write(text, wcslen(text)); return *this;				}
+	TextWriter& operator<< ( const std::string& text )		{ Write(text.data(), text.size()); return *this;		}
+	TextWriter& operator<< ( const std::wstring& text )		{ Write(text.data(), text.size()); return *this;		}
+
+	TextWriter& operator<< ( int value )					{ WriteUnsigned(value < 0 ? 0ULL - value : value, value < 0); return *this;	}
+	TextWriter& operator<< ( long value )					{ WriteUnsigned(value < 0 ? 0ULL - value : value, value < 0); return *this;	}
+	TextWriter& operator<< ( long long value )				{ WriteUnsigned(value < 0 ? 0ULL - value : value, value < 0); return *this;	}
+	TextWriter& operator<< ( unsigned int value )			{ WriteUnsigned(value, false); return *this;			}
+	TextWriter& operator<< ( unsigned long value )			{ WriteUnsigned(value, false); return *this;			}
+	TextWriter& operator<< ( unsigned long long value )		{ WriteUnsigned(value, false); return *this;			}
+};
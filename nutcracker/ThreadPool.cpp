@@ -0,0 +1,192 @@
+#include "stdafx.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+
+// Pool and queue index of worker running on current thread
+static thread_local const ThreadPool* t_Pool = NULL;
+static thread_local size_t t_Worker = 0;
+
+
+// ************************************************************************************************************************************
+ThreadPool::ThreadPool( size_t threads )
+: m_Submitted(0)
+, m_Queued(0)
+, m_Running(0)
+, m_Stopping(false)
+{
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	m_Queues.reserve(threads);
+	for(size_t i = 0; i < threads; ++i)
+		m_Queues.push_back(std::unique_ptr<Queue>(new Queue));
+
+	m_Workers.reserve(threads);
+	for(size_t i = 0; i < threads; ++i)
+		m_Workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+}
+
+
+// ************************************************************************************************************************************
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+
+	m_TaskReady.notify_all();
+
+	for(std::vector<std::thread>::iterator i = m_Workers.begin(); i != m_Workers.end(); ++i)
+		i->join();
+}
+
+
+// ************************************************************************************************************************************
+void ThreadPool::Submit( Task task, size_t weight )
+{
+	Entry entry;
+	entry.task = std::move(task);
+	entry.weight = weight;
+	entry.order = m_Submitted++;
+
+	Queue& queue = (t_Pool == this) ? *m_Queues[t_Worker] : *m_Queues[entry.order % m_Queues.size()];
+
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.heap.push_back(std::move(entry));
+		std::push_heap(queue.heap.begin(), queue.heap.end(), IsLighter);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Queued += 1;
+	}
+
+	m_TaskReady.notify_one();
+}
+
+
+// ************************************************************************************************************************************
+void ThreadPool::Wait( void )
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_AllDone.wait(lock, [this] { return m_Queued == 0 && m_Running == 0; });
+
+	if (m_Error)
+	{
+		std::exception_ptr error = m_Error;
+		m_Error = std::exception_ptr();
+		std::rethrow_exception(error);
+	}
+}
+
+
+// ************************************************************************************************************************************
+bool ThreadPool::IsLighter( const Entry& a, const Entry& b )
+{
+	if (a.weight != b.weight)
+		return a.weight < b.weight;
+
+	return a.order > b.order;
+}
+
+
+// ************************************************************************************************************************************
+bool ThreadPool::PopHeaviest( Queue& queue, Entry& entry )
+{
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.heap.empty())
+		return false;
+
+	std::pop_heap(queue.heap.begin(), queue.heap.end(), IsLighter);
+	entry = std::move(queue.heap.back());
+	queue.heap.pop_back();
+	return true;
+}
+
+
+// ************************************************************************************************************************************
+// Worker has already claimed one queued task, so some queue holds a task for it. Another worker may take it first,
+// but then that worker leaves the task it has claimed, so search is repeated until a task is found.
+void ThreadPool::TakeTask( size_t worker, Entry& entry )
+{
+	for(;;)
+	{
+		if (PopHeaviest(*m_Queues[worker], entry))
+			return;
+
+		// Steal heaviest task on top of other queues
+		Queue* victim = NULL;
+		Entry best;
+		best.weight = 0;
+		best.order = 0;
+
+		for(size_t i = 1; i < m_Queues.size(); ++i)
+		{
+			Queue& queue = *m_Queues[(worker + i) % m_Queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+
+			if (!queue.heap.empty() && (!victim || IsLighter(best, queue.heap.front())))
+			{
+				victim = &queue;
+				best.weight = queue.heap.front().weight;
+				best.order = queue.heap.front().order;
+			}
+		}
+
+		if (victim && PopHeaviest(*victim, entry))
+			return;
+
+		std::this_thread::yield();
+	}
+}
+
+
+// ************************************************************************************************************************************
+void ThreadPool::WorkerLoop( size_t worker )
+{
+	t_Pool = this;
+	t_Worker = worker;
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	for(;;)
+	{
+		m_TaskReady.wait(lock, [this] { return m_Stopping || m_Queued > 0; });
+
+		if (m_Queued == 0)
+			return;
+
+		m_Queued -= 1;
+		m_Running += 1;
+
+		lock.unlock();
+
+		Entry entry;
+		TakeTask(worker, entry);
+
+		std::exception_ptr error;
+		try
+		{
+			entry.task();
+		}
+		catch(...)
+		{
+			error = std::current_exception();
+		}
+
+		// Captures of task are released before it counts as done
+		entry.task = Task();
+
+		lock.lock();
+
+		if (error && !m_Error)
+			m_Error = error;
+
+		m_Running -= 1;
+		if (m_Running == 0 && m_Queued == 0)
+			m_AllDone.notify_all();
+	}
+}
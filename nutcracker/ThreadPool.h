@@ -0,0 +1,63 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+// ************************************************************************************************************************************
+// Fixed set of worker threads running submitted tasks, heaviest first. Each worker has its own queue: tasks submitted
+// by a worker go to its queue, other tasks are spread over queues. Worker takes heaviest task of its own queue and when
+// that is empty steals heaviest task found in other queues, so large task split to parts keeps all workers busy.
+// Wait() blocks until all tasks submitted so far are done and rethrows first exception thrown by any of them.
+class ThreadPool
+{
+public:
+	typedef std::function<void ()> Task;
+
+private:
+	struct Entry
+	{
+		Task task;
+		size_t weight;
+		size_t order;		// Submission number, earlier task goes first among equal weights
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::vector<Entry> heap;
+	};
+
+	std::vector<std::thread> m_Workers;
+	std::vector< std::unique_ptr<Queue> > m_Queues;
+	std::atomic<size_t> m_Submitted;
+	std::mutex m_Mutex;
+	std::condition_variable m_TaskReady;
+	std::condition_variable m_AllDone;
+	size_t m_Queued;		// Tasks in queues not claimed by any worker yet
+	size_t m_Running;
+	bool m_Stopping;
+	std::exception_ptr m_Error;
+
+	ThreadPool( const ThreadPool& );
+	ThreadPool& operator= ( const ThreadPool& );
+
+	static bool IsLighter( const Entry& a, const Entry& b );
+	static bool PopHeaviest( Queue& queue, Entry& entry );
+
+	void TakeTask( size_t worker, Entry& entry );
+	void WorkerLoop( size_t worker );
+
+public:
+	// Zero threads means one per hardware thread
+	explicit ThreadPool( size_t threads = 0 );
+	~ThreadPool();
+
+	// Weight is estimated cost of task in any unit used consistently by caller
+	void Submit( Task task, size_t weight = 0 );
+	void Wait( void );
+
+	size_t GetThreadCount( void ) const			{ return m_Workers.size();		}
+};
@@ -1,5 +1,9 @@
 ﻿#include "stdafx.h"
 #include "NutScript.h"
+#include "ShardedOutput.h"
+#include "BatchMode.h"
+#include "ServerMode.h"
+#include "FunctionPrerender.h"
 
 const char* version = "0.02";
 const char* nutVersion = "3.x";
@@ -12,11 +16,22 @@ void Usage( void )
 	std::cout << "  Usage:" << std::endl;
 	std::cout << "    nutcracker [options] <file to decompile>" << std::endl;
 	std::cout << "    nutcracker -cmp <file1> <file2>" << std::endl;
+	std::cout << "    nutcracker [-j <threads>] -batch <input dir> <output dir>" << std::endl;
+	std::cout << "    nutcracker [-j <threads>] -server" << std::endl;
 	std::cout << std::endl;
 	std::cout << "  Options:" << std::endl;
 	std::cout << "   -h         Display usage info" << std::endl;
 	std::cout << "   -cmp       Compare two binary files" << std::endl;
+	std::cout << "   -batch     Decompile all .nut files in directory tree to output directory" << std::endl;
+	std::cout << "   -server    Answer JSON requests read line by line from standard input" << std::endl;
+	std::cout << "   -j <count> Number of threads, one per CPU by default" << std::endl;
+	std::cout << "   -jr <count>, -jl <count>, -jw <count>" << std::endl;
+	std::cout << "              Number of batch threads reading, loading and writing files (2, 1, 2 by default)" << std::endl;
 	std::cout << "   -d <name>  Display debug decompilation for function" << std::endl;
+	std::cout << "   -budget <count>  Print function as disassembly after decompiling this many instructions" << std::endl;
+	std::cout << "   -timeout <ms>    Print function as disassembly after decompiling it for this long" << std::endl;
+	std::cout << "   -o <dir>   Write each top level class, function and table to its own file in directory" << std::endl;
+	std::cout << "              (index.nut keeps the order)" << std::endl;
 	std::cout << "   -l <locale> Specify locale name for multibyte string convert" << std::endl;
 	std::cout << "               Read \"https://msdn.microsoft.com/en-us/library/x99tb11d(v=vs.140).aspx\" for detail." << std::endl;
 	std::cout << std::endl;
@@ -24,18 +39,20 @@ void Usage( void )
 }
 
 
-int Compare( const char* file1, const char* file2, bool general )
+int Compare( const char* file1, const char* file2, bool general, size_t threads, const char* localeName )
 {
 	try
 	{
-		NutScript s1, s2;
+		DecompileContext context(localeName);
+		NutScript s1(context), s2(context);
 		s1.LoadFromFile(file1);
 		s2.LoadFromFile(file2);
 
+		ThreadPool pool(threads);
+
 		if (general)
 		{
-			std::wstringstream stream;
-			bool result = s1.GetMain().DoCompare(s2.GetMain(), "", stream);
+			bool result = s1.GetMain().DoCompare(s2.GetMain(), NULL, &pool);
 
 			if (result)
 				std::cout << "[         ]";
@@ -48,7 +65,10 @@ int Compare( const char* file1, const char* file2, bool general )
 		}
 		else
 		{
-			bool result = s1.GetMain().DoCompare(s2.GetMain(), "", std::wcout);
+			TextWriter out(stdout);
+			bool result = s1.GetMain().DoCompare(s2.GetMain(), &out, &pool);
+			out.Flush();
+
 			std::cout << std::endl << "Result: " << (result ? "Ok" : "ERROR") << std::endl;
 
 			return result ? 0 : -1;
@@ -63,19 +83,20 @@ int Compare( const char* file1, const char* file2, bool general )
 
 void DebugFunctionPrint( const NutFunction& function )
 {
-	g_DebugMode = true;
-
-	std::wstringstream stream;
-	function.GenerateFunctionSource(0, stream);
-	std::wcout << stream.str();
+	TextWriter out(stdout);
+	function.GenerateFunctionSource(0, out);
 }
 
-int Decompile( const char* file, const char* debugFunction )
+int Decompile( const char* file, const char* debugFunction, const char* outputDirectory, size_t threads, const char* localeName, size_t instructionBudget, size_t timeBudget )
 {
-	std::wstringstream stream;
+	TextWriter out(stdout);
 	try
 	{
-		NutScript script;
+		DecompileContext context(localeName);
+		context.SetDebugMode(debugFunction != NULL);
+		context.SetBudget(instructionBudget, timeBudget);
+
+		NutScript script(context);
 		script.LoadFromFile(file);
 
 		if (debugFunction)
@@ -87,7 +108,11 @@ int Decompile( const char* file, const char* debugFunction )
 			}
 			else
 			{
-				const NutFunction* func = script.GetMain().FindFunction(debugFunction);
+				// Command line is in multibyte encoding of locale, as are function names in script
+				LString name;
+				name.assign(debugFunction, strlen(debugFunction), context.GetLocale());
+
+				const NutFunction* func = script.GetMain().FindFunction(name);
 				if (!func)
 				{
 					std::cout << "Unable to find function \"" << debugFunction << "\"." << std::endl;
@@ -99,12 +124,20 @@ int Decompile( const char* file, const char* debugFunction )
 			}
 		}
 
-		script.GetMain().GenerateBodySource(0, stream);
-		std::wcout << stream.str();
+		if (outputDirectory)
+		{
+			WriteShardedSource(script.GetMain(), outputDirectory, threads);
+		}
+		else
+		{
+			ThreadPool pool(threads);
+			FunctionPrerender prerender(script.GetMain(), pool);
+			script.GetMain().GenerateBodySource(0, out, true);
+		}
 	}
 	catch( std::exception& ex )
 	{
-		std::wcout << stream.str();
+		out.Flush();
 		std::cout << "Error: " << ex.what() << std::endl;
 		return -1;
 	}
@@ -114,8 +147,13 @@ int Decompile( const char* file, const char* debugFunction )
 
 int main( int argc, char* argv[] )
 {
-	BinaryReader::SetLocale(".OCP");
+	const char* localeName = ".OCP";
 	const char* debugFunction = NULL;
+	const char* outputDirectory = NULL;
+	size_t threads = 0;
+	size_t instructionBudget = 0;	// Per function budget of decompilation, zero is unlimited
+	size_t timeBudget = 0;
+	BatchThreads batchThreads;
 
 	for( int i = 1; i < argc; ++i)
 	{
@@ -134,6 +172,81 @@ int main( int argc, char* argv[] )
 			debugFunction = argv[i + 1];
 			i += 1;
 		}
+		else if (0 == _stricmp(argv[i], "-j"))
+		{
+			if ((argc - i) < 2 || atoi(argv[i + 1]) < 1)
+			{
+				Usage();
+				return -1;
+			}
+			threads = atoi(argv[i + 1]);
+			batchThreads.decompile = threads;
+			i += 1;
+		}
+		else if (0 == _stricmp(argv[i], "-jr") || 0 == _stricmp(argv[i], "-jl") || 0 == _stricmp(argv[i], "-jw"))
+		{
+			if ((argc - i) < 2 || atoi(argv[i + 1]) < 1)
+			{
+				Usage();
+				return -1;
+			}
+
+			size_t count = atoi(argv[i + 1]);
+			switch(tolower(argv[i][2]))
+			{
+				case 'r': batchThreads.read = count; break;
+				case 'l': batchThreads.load = count; break;
+				case 'w': batchThreads.write = count; break;
+			}
+			i += 1;
+		}
+		else if (0 == _stricmp(argv[i], "-budget") || 0 == _stricmp(argv[i], "-timeout"))
+		{
+			if ((argc - i) < 2 || atoi(argv[i + 1]) < 1)
+			{
+				Usage();
+				return -1;
+			}
+
+			if (0 == _stricmp(argv[i], "-budget"))
+				instructionBudget = atoi(argv[i + 1]);
+			else
+				timeBudget = atoi(argv[i + 1]);
+			i += 1;
+		}
+		else if (0 == _stricmp(argv[i], "-batch"))
+		{
+			if ((argc - i) < 3)
+			{
+				Usage();
+				return -1;
+			}
+			try
+			{
+				DecompileContext context(localeName);
+				context.SetBudget(instructionBudget, timeBudget);
+				return DecompileBatch(argv[i + 1], argv[i + 2], batchThreads, context) == 0 ? 0 : -1;
+			}
+			catch( std::exception& ex )
+			{
+				std::cout << "Error: " << ex.what() << std::endl;
+				return -1;
+			}
+		}
+		else if (0 == _stricmp(argv[i], "-server"))
+		{
+			return RunServer(localeName, threads, instructionBudget, timeBudget);
+		}
+		else if (0 == _stricmp(argv[i], "-o"))
+		{
+			if ((argc - i) < 2)
+			{
+				Usage();
+				return -1;
+			}
+			outputDirectory = argv[i + 1];
+			i += 1;
+		}
 		else if (0 == _stricmp(argv[i], "-l"))
 		{
 			if ((argc - i) < 2)
@@ -144,7 +257,8 @@ int main( int argc, char* argv[] )
 
 			try
 			{
-				BinaryReader::SetLocale(argv[i + 1]);
+				std::locale locale(argv[i + 1]);
+				localeName = argv[i + 1];
 			}
 			catch (std::exception& ex)
 			{
@@ -159,7 +273,7 @@ int main( int argc, char* argv[] )
 				Usage();
 				return -1;
 			}
-			return Compare(argv[i + 1], argv[i + 2], false);
+			return Compare(argv[i + 1], argv[i + 2], false, threads, localeName);
 		}
 		else if (0 == _stricmp(argv[i], "-cmpg"))
 		{
@@ -168,11 +282,11 @@ int main( int argc, char* argv[] )
 				Usage();
 				return -1;
 			}
-			return Compare(argv[i + 1], argv[i + 2], true);
+			return Compare(argv[i + 1], argv[i + 2], true, threads, localeName);
 		}
 		else
 		{
-			int res = Decompile(argv[i], debugFunction);
+			int res = Decompile(argv[i], debugFunction, outputDirectory, threads, localeName, instructionBudget, timeBudget);
 			return res;
 		}
 	}
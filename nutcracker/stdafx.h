@@ -14,5 +14,7 @@
 #include "enums.h"
 
 #include "LString.h"
+#include "DecompileContext.h"
 #include "BinaryReader.h"
 #include "Errors.h"
+#include "TextWriter.h"